@@ -42,6 +42,11 @@ public:
 			h = any.h->Duplicate();
 	}
 
+	Any(Any&& any) noexcept
+		: h(std::move(any.h))
+	{
+	}
+
 	Any& operator= (Any any)
 	{
 		any.Swap(*this);
@@ -98,7 +103,7 @@ private:
 	template <class T>
 	struct Holder: public AbstractHolder {
 		Holder(T t)
-			: d(t)
+			: d(std::move(t))
 		{
 		}
 		std::unique_ptr<AbstractHolder> Duplicate() const {
@@ -106,6 +106,7 @@ namespace {
 
 	class CharClassesImpl: public Feature {
 	public:
+		bool HooksParenthesized() const { return false; }
 		CharClassesImpl(): m_table(Singleton<CharClassesTable>()) {}
 		int Priority() const { return 10; }
 
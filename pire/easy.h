@@ -208,7 +208,9 @@ private:
 			fsm.PrependAnything();
 		fsm.AppendAnything();
 		
-		if (fsm.Determine())
+		// Do not even try to determine patterns which will not fit anyway
+		fsm.RemoveEpsilons();
+		if (!fsm.EstimateDeterminedSize().Exceeds(Fsm::DefaultMaxSize) && fsm.Determine())
 			m_scanner = fsm.Compile<Scanner>();
 		else
 			m_slow = fsm.Compile<SlowScanner>();
@@ -73,6 +73,8 @@ namespace {
 			}
 		}
 		
+		bool HooksParenthesized() const { return true; }
+
 		void Parenthesized(Fsm& fsm)
 		{
 			if (StateRepetition != NoRepetition) {
@@ -137,6 +137,15 @@ public:
 
 	CapturingScanner() {}
 	CapturingScanner(const CapturingScanner& s): LoadedScanner(s) {}
+
+	/// Returns a copy of the scanner having private tables, which can be safely modified
+	CapturingScanner Clone() const
+	{
+		CapturingScanner s(*this);
+		s.Unshare();
+		return s;
+	}
+
 	explicit CapturingScanner(Fsm& fsm, size_t distance = 0)
 	{
 		if (distance) {
@@ -29,6 +29,7 @@
 #include "../stub/lexical_cast.h"
 #include "../stub/stl.h"
 #include <tuple>
+#include <unordered_map>
 
 namespace Pire {
 
@@ -279,6 +280,23 @@ bool operator < (const DeterminedState& left, const DeterminedState& right) {
 	return asTuple(left) < asTuple(right);
 }
 
+bool operator == (const DeterminedState& left, const DeterminedState& right) {
+	return left.matched == right.matched && left.unmatched == right.unmatched
+		&& left.separated == right.separated && left.lagging == right.lagging;
+}
+
+struct DeterminedStateHash {
+	size_t operator()(const DeterminedState& state) const {
+		size_t hash = 0;
+		for (const StateGroup* group : {&state.matched, &state.unmatched, &state.separated, &state.lagging}) {
+			for (const auto& taggedState : *group)
+				hash = (hash ^ (taggedState.first * 8 + taggedState.second)) * 1099511628211ULL;
+			hash = (hash ^ group->size()) * 1099511628211ULL;
+		}
+		return hash;
+	}
+};
+
 bool InvalidCharRange(const TVector<Char>& range) {
 	for (const auto letter : range) {
 		if (letter < MaxCharUnaligned && letter != 256) {
@@ -292,7 +310,7 @@ class BasicCountingFsmDetermineTask : public CountingFsmTask {
 public:
 	using CountingFsmTask::LettersTbl;
 	typedef DeterminedState State;
-	typedef TMap<State, size_t> InvStates;
+	typedef std::unordered_map<State, size_t, DeterminedStateHash> InvStates;
 
 	explicit BasicCountingFsmDetermineTask(const Fsm& fsm, RawState reInitial)
 		: mFsm(fsm)
@@ -349,6 +367,7 @@ public:
 				newActions[ns].swap(outputIt->second);
 			}
 		}
+		mActionByState.clear();
 	}
 
 protected:
@@ -494,12 +513,11 @@ private:
 		return StateGroup{TaggedState{mFsm.Initial(), CountingFsm::NotMatched}};
 	}
 
-	void AddAction(State from, Char letter, unsigned long value) const {
+	void AddAction(const State& from, Char letter, unsigned long value) const {
 		if (!value) {
 			return;
 		}
-		TransitionTagRow& row = mActionByState[from];
-		row[letter] = value;
+		mActionByState[from][letter] = value;
 	}
 
 	void MakeTaggedStates(StateGroup& matched, StateGroup& unmatched, StateGroup& separated, const Fsm::StatesSet& destinations, unsigned long sourceTag) const {
@@ -556,7 +574,7 @@ private:
 	Fsm::StatesSet mDeadStates;
 	TSet<Char> mInvalidLetters;
 
-	mutable TMap<State, TransitionTagRow> mActionByState;
+	mutable std::unordered_map<State, TransitionTagRow, DeterminedStateHash> mActionByState;
 };
 
 class CountingFsmDetermineTask : public BasicCountingFsmDetermineTask {
@@ -741,6 +759,127 @@ namespace {
 	Pire::Fsm FsmForChar(Pire::Char c) { Pire::Fsm f; f.AppendSpecial(c); return f; }
 }
 
+namespace Impl {
+
+/**
+ * Builds a CountingScanner from the product of the separated regexp with itself:
+ * the first component tracks the current match, and the second one is a backup
+ * where the scanner resumes if the current match dies.
+ * Transitions are written into the scanner directly as they are found.
+ */
+class CountingScannerDetermineTask {
+public:
+	typedef Fsm::LettersTbl LettersTbl;
+	typedef ypair<size_t, size_t> State;
+
+	struct StateHash {
+		size_t operator()(const State& state) const { return state.first * 0x9E3779B97F4A7C15ULL ^ state.second; }
+	};
+	typedef std::unordered_map<State, size_t, StateHash> InvStates;
+
+	CountingScannerDetermineTask(const Fsm& fsm, CountingScanner& scanner)
+		: mFsm(fsm)
+		, mScanner(scanner)
+		, mDead(fsm.Size(), false)
+	{
+		for (auto&& state : fsm.DeadStates())
+			mDead[state] = true;
+	}
+
+	const LettersTbl& Letters() const { return mFsm.Letters(); }
+
+	State Initial() const { return State(mFsm.Initial(), mFsm.Initial()); }
+
+	bool IsRequired(const State&) const { return true; }
+
+	State Next(const State& state, Char letter) const
+	{
+		Action action;
+		return Transition(state, letter, action);
+	}
+
+	void AcceptStates(const TVector<State>& states)
+	{
+		mStates = states;
+		mNext.resize(states.size() * Letters().Size());
+		mScanner.Init(states.size(), Letters(), 0, 1);
+	}
+
+	void Connect(size_t from, size_t to, Char letter)
+	{
+		Action action;
+		Transition(mStates[from], letter, action);
+		mScanner.SetJump(from, letter, to, mScanner.RemapAction(action));
+		mNext[from * Letters().Size() + Letters().Index(letter)] = to;
+	}
+
+	typedef bool Result;
+	static Result Success() { return true; }
+	static Result Failure() { return false; }
+
+	/// Sets state tags; to be called once all transitions are connected
+	void Finish()
+	{
+		const size_t lettersCount = Letters().Size();
+		TVector< TVector<size_t> > previous(mStates.size());
+		for (size_t from = 0; from != mStates.size(); ++from)
+			for (size_t letter = 0; letter != lettersCount; ++letter)
+				previous[mNext[from * lettersCount + letter]].push_back(from);
+
+		// A state is dead unless some final state is reachable from it
+		TVector<bool> alive(mStates.size(), false);
+		TVector<size_t> queue;
+		for (size_t state = 0; state != mStates.size(); ++state)
+			if (mFsm.IsFinal(mStates[state].first)) {
+				alive[state] = true;
+				queue.push_back(state);
+			}
+		for (size_t i = 0; i != queue.size(); ++i)
+			for (auto&& from : previous[queue[i]])
+				if (!alive[from]) {
+					alive[from] = true;
+					queue.push_back(from);
+				}
+
+		for (size_t state = 0; state != mStates.size(); ++state) {
+			const size_t first = mStates[state].first;
+			mScanner.SetTag(state, CountingScanner::Tag(mFsm.Tag(first)
+				| (mFsm.IsFinal(first) ? CountingScanner::FinalFlag : 0)
+				| (alive[state] ? 0 : CountingScanner::DeadFlag)));
+		}
+		mScanner.FinishBuild();
+	}
+
+private:
+	const Fsm& mFsm;
+	CountingScanner& mScanner;
+	TVector<bool> mDead;
+	TVector<State> mStates;
+	TVector<size_t> mNext;
+
+	size_t Destination(size_t state, Char letter) const
+	{
+		const Fsm::StatesSet& dests = mFsm.Destinations(state, letter);
+		Y_ASSERT(dests.size() == 1);
+		return *dests.begin();
+	}
+
+	State Transition(const State& state, Char letter, Action& action) const
+	{
+		State next(Destination(state.first, letter), Destination(state.second, letter));
+		action = 0;
+		if (mDead[next.first]) {
+			action = CountingScanner::DeadFlag | (mFsm.Tag(next.first) & CountingScanner::Matched);
+			next.first = next.second;
+		}
+		if (mFsm.IsFinal(next.first) || (mFsm.IsFinal(next.second) && !(mFsm.Tag(next.first) & CountingScanner::Matched)))
+			next.second = mFsm.Initial();
+		return next;
+	}
+};
+
+}
+
 CountingScanner::CountingScanner(const Fsm& re, const Fsm& sep)
 {
 	Fsm res = re;
@@ -762,75 +901,12 @@ CountingScanner::CountingScanner(const Fsm& re, const Fsm& sep)
 	// Make a full Cartesian product of two sep_res
 	sep_re.Determine();
 	sep_re.Unsparse();
-	TSet<size_t> dead = sep_re.DeadStates();
-
-	PIRE_IFDEBUG(Cdbg << "=== Original FSM ===" << Endl << sep_re << ">>> " << sep_re.Size() << " states, dead: [" << Join(dead.begin(), dead.end(), ", ") << "]" << Endl);
-
-	Fsm sq;
-
-	typedef ypair<size_t, size_t> NewState;
-	TVector<NewState> states;
-	TMap<NewState, size_t> invstates;
-
-	states.push_back(NewState(sep_re.Initial(), sep_re.Initial()));
-	invstates.insert(ymake_pair(states.back(), states.size() - 1));
-
-	// TODO: this loop reminds me a general determination task...
-	for (size_t curstate = 0; curstate < states.size(); ++curstate) {
-
-		unsigned long tag = sep_re.Tag(states[curstate].first);
-		if (tag)
-			sq.SetTag(curstate, tag);
-		sq.SetFinal(curstate, sep_re.IsFinal(states[curstate].first));
-
-		PIRE_IFDEBUG(Cdbg << "State " << curstate << " = (" << states[curstate].first << ", " << states[curstate].second << ")" << Endl);
-		for (Fsm::LettersTbl::ConstIterator lit = sep_re.Letters().Begin(), lie = sep_re.Letters().End(); lit != lie; ++lit) {
-
-			Char letter = lit->first;
-
-			const Fsm::StatesSet& mr = sep_re.Destinations(states[curstate].first, letter);
-			const Fsm::StatesSet& br = sep_re.Destinations(states[curstate].second, letter);
-
-			if (mr.size() != 1)
-				Y_ASSERT(!"Wrong transition size for main");
-			if (br.size() != 1)
-				Y_ASSERT(!"Wrong transition size for backup");
-
-			NewState ns(*mr.begin(), *br.begin());
-			PIRE_IFDEBUG(NewState savedNs = ns);
-			unsigned long outputs = 0;
-
-			PIRE_IFDEBUG(ystring dbgout);
-			if (dead.find(ns.first) != dead.end()) {
-				PIRE_IFDEBUG(dbgout = ((sep_re.Tag(ns.first) & Matched) ? ", ++cur" : ", max <- cur"));
-				outputs = DeadFlag | (sep_re.Tag(ns.first) & Matched);
-				ns.first = ns.second;
-			}
-			if (sep_re.IsFinal(ns.first) || (sep_re.IsFinal(ns.second) && !(sep_re.Tag(ns.first) & Matched)))
-				ns.second = sep_re.Initial();
-
-			PIRE_IFDEBUG(if (ns != savedNs) Cdbg << "Diverted transition to (" << savedNs.first << ", " << savedNs.second << ") on " << (char) letter << " to (" << ns.first << ", " << ns.second << ")" << dbgout << Endl);
-
-			TMap<NewState, size_t>::iterator nsi = invstates.find(ns);
-			if (nsi == invstates.end()) {
-				PIRE_IFDEBUG(Cdbg << "New state " << states.size() << " = (" << ns.first << ", " << ns.second << ")" << Endl);
-				states.push_back(ns);
-				nsi = invstates.insert(ymake_pair(states.back(), states.size() - 1)).first;
-				sq.Resize(states.size());
-			}
-
-			for (TVector<Char>::const_iterator li = lit->second.second.begin(), le = lit->second.second.end(); li != le; ++li)
-			sq.Connect(curstate, nsi->second, *li);
-			if (outputs)
-				sq.SetOutput(curstate, nsi->second, outputs);
-		}
-	}
 
-	sq.Determine();
+	PIRE_IFDEBUG(Cdbg << "=== Original FSM ===" << Endl << sep_re << ">>> " << sep_re.Size() << " states" << Endl);
 
-	PIRE_IFDEBUG(Cdbg << "=== FSM ===" << Endl << sq << Endl);
-	Init(sq.Size(), sq.Letters(), sq.Initial(), 1);
-	BuildScanner(sq, *this);
+	Impl::CountingScannerDetermineTask task(sep_re, *this);
+	Impl::Determine(task, std::numeric_limits<size_t>::max());
+	task.Finish();
 }
 
 namespace Impl {
@@ -1028,7 +1104,7 @@ void NoGlueLimitCountingScanner::Load(yistream* s) {
 			ActionsBuffer.reset();
 			Actions = nullptr;
 		} else {
-			ActionsBuffer = TActionsBuffer(new ActionIndex[actionsSize]);
+			ActionsBuffer = TActionsBuffer(actionsSize);
 			ActionsBuffer[0] = actionsSize;
 			LoadPodArray(s, &ActionsBuffer[1], actionsSize - 1);
 			Actions = ActionsBuffer.get();
@@ -41,6 +41,8 @@ namespace Impl {
 
 	class NoGlueLimitCountingScannerGlueTask;
 
+	class CountingScannerDetermineTask;
+
 	template <class AdvancedScanner>
 	AdvancedScanner MakeAdvancedCountingScanner(const Fsm& re, const Fsm& sep, bool* simple);
 };
@@ -154,6 +156,14 @@ public:
 		return x.action;
 	}
 
+	/// Returns a copy of the scanner having private tables, which can be safely modified
+	DerivedScanner Clone() const
+	{
+		DerivedScanner s(static_cast<const DerivedScanner&>(*this));
+		s.Unshare();
+		return s;
+	}
+
 	Action Next(State& s, Char c) const
 	{
 		return NextTranslated(s, Translate(c));
@@ -173,6 +183,28 @@ public:
 
 	size_t StateIndex(const State& s) const { return StateIdx(s.m_state); }
 
+	/// Packed states take this many 32-bit words (see PackState())
+	size_t PackedStateSize() const { return 2 + 2 * RegexpsCount(); }
+
+	/**
+	 * Packs the state into PackedStateSize() words, keeping only the counters
+	 * of regexps the scanner actually has. Unlike states, packed states do not
+	 * depend on the scanner's address, so they remain valid after the same
+	 * scanner image has been reloaded (or mapped by another process).
+	 */
+	void PackState(const State& s, ui32* packed) const
+	{
+		packed[0] = static_cast<ui32>(StateIdx(s.m_state));
+		s.PackCounters(packed + 1, RegexpsCount());
+	}
+
+	void UnpackState(const ui32* packed, State& s) const
+	{
+		static_cast<const DerivedScanner*>(this)->Initialize(s);
+		s.m_state = IdxToState(packed[0]);
+		s.UnpackCounters(packed + 1, RegexpsCount());
+	}
+
 protected:
 	using LoadedScanner::Init;
 	using LoadedScanner::InternalState;
@@ -214,6 +246,22 @@ private:
 	ui32 m_total[MAX_RE_COUNT];
 	size_t m_updatedMask;
 
+	void PackCounters(ui32* packed, size_t regexpsCount) const
+	{
+		Y_ASSERT(regexpsCount <= MAX_RE_COUNT);
+		*packed++ = static_cast<ui32>(m_updatedMask >> MAX_RE_COUNT);
+		packed = std::copy(m_current, m_current + regexpsCount, packed);
+		std::copy(m_total, m_total + regexpsCount, packed);
+	}
+
+	void UnpackCounters(const ui32* packed, size_t regexpsCount)
+	{
+		Y_ASSERT(regexpsCount <= MAX_RE_COUNT);
+		m_updatedMask = static_cast<size_t>(*packed++) << MAX_RE_COUNT;
+		std::copy(packed, packed + regexpsCount, m_current);
+		std::copy(packed + regexpsCount, packed + 2 * regexpsCount, m_total);
+	}
+
 	template <class DerivedScanner, class State>
 	friend class BaseCountingScanner;
 
@@ -269,6 +317,7 @@ private:
 	}
 
 	friend void BuildScanner<CountingScanner>(const Fsm&, CountingScanner&);
+	friend class Impl::CountingScannerDetermineTask;
 	friend class Impl::ScannerGlueCommon<CountingScanner>;
 	friend class Impl::CountingScannerGlueTask<CountingScanner>;
 };
@@ -341,6 +390,20 @@ private:
 	TVector<ui32> m_current;
 	TVector<ui32> m_total;
 
+	void PackCounters(ui32* packed, size_t regexpsCount) const
+	{
+		*packed++ = 0; // No update mask, kept for the common layout
+		packed = std::copy(m_current.begin(), m_current.begin() + regexpsCount, packed);
+		std::copy(m_total.begin(), m_total.begin() + regexpsCount, packed);
+	}
+
+	void UnpackCounters(const ui32* packed, size_t regexpsCount)
+	{
+		++packed;
+		m_current.assign(packed, packed + regexpsCount);
+		m_total.assign(packed + regexpsCount, packed + 2 * regexpsCount);
+	}
+
 	template <class DerivedScanner, class State>
 	friend class BaseCountingScanner;
 
@@ -360,7 +423,7 @@ class NoGlueLimitCountingScanner : public BaseCountingScanner<NoGlueLimitCountin
 public:
 	using State = NoGlueLimitCountingState;
 	using ActionIndex = ui32;
-	using TActionsBuffer = std::unique_ptr<ActionIndex[]>;
+	using TActionsBuffer = Impl::SharedArray<ActionIndex>;
 
 private:
 	TActionsBuffer ActionsBuffer;
@@ -372,16 +435,10 @@ public:
 	NoGlueLimitCountingScanner(const Fsm& re, const Fsm& sep, bool* simple = nullptr);
 	NoGlueLimitCountingScanner(const NoGlueLimitCountingScanner& rhs)
 	    : BaseCountingScanner(rhs)
+	    , ActionsBuffer(rhs.ActionsBuffer)
+	    , Actions(rhs.Actions)
 	    , AdvancedScannerCompatibilityMode(rhs.AdvancedScannerCompatibilityMode)
 	{
-		if (rhs.ActionsBuffer) {
-			Y_ASSERT(rhs.Actions);
-			ActionsBuffer = TActionsBuffer(new ActionIndex [*rhs.Actions]);
-			std::copy_n(rhs.ActionsBuffer.get(), *rhs.Actions, ActionsBuffer.get());
-			Actions = ActionsBuffer.get();
-		} else {
-			Actions = rhs.Actions;
-		}
 	}
 
 	NoGlueLimitCountingScanner(NoGlueLimitCountingScanner&& other) : BaseCountingScanner() {
@@ -478,7 +535,7 @@ private:
 		Y_ASSERT(!actions.empty());
 		Y_ASSERT(actions[0] == actions.size());
 
-		ActionsBuffer = TActionsBuffer(new ActionIndex[actions.size()]);
+		ActionsBuffer = TActionsBuffer(actions.size());
 		std::copy(actions.begin(), actions.end(), ActionsBuffer.get());
 		Actions = ActionsBuffer.get();
 	}
@@ -107,6 +107,7 @@ namespace {
 
 	class GlueSimilarGlyphsImpl: public Feature {
 	public:
+		bool HooksParenthesized() const { return false; }
 		GlueSimilarGlyphsImpl(): m_table(Singleton<GlyphTable>()) {}
 		int Priority() const { return 9; }
 
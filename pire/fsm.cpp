@@ -28,6 +28,7 @@
 #include <iterator>
 #include <numeric>
 #include <queue>
+#include <cmath>
 #include <utility>
 #include "fsm.h"
 #include "vbitset.h"
@@ -39,6 +40,7 @@
 #include <stdio.h>
 #include "stub/lexical_cast.h"
 #include "platform.h"
+#include "probes.h"
 
 namespace Pire {
 	
@@ -485,7 +487,9 @@ Fsm& Fsm::operator += (const Fsm& rhs)
 				outputs[final].insert(ymake_pair(toAndOutput.first + lhsSize, toAndOutput.second));
 		}
 
-	ClearFinal();
+	// If rhs accepts an empty string, our final states remain final
+	if (!rhs.IsFinal(rhs.initial))
+		ClearFinal();
 	for (auto&& letter : rhs.m_final)
 		SetFinal(letter + lhsSize, true);
 	determined = false;
@@ -630,65 +634,184 @@ Fsm& Fsm::Reverse()
 	return *this;
 }
 
-TSet<size_t> Fsm::DeadStates() const
+InputNormalization::InputNormalization()
 {
-	TSet<size_t> res;
+	for (unsigned ch = 0; ch != 1 << (sizeof(char)*8); ++ch)
+		m_map[ch] = static_cast<unsigned char>(ch);
+}
 
-	for (int invert = 0; invert <= 1; ++invert) {
-		Fsm digraph;
-		digraph.Resize(Size());
-		for (TransitionTable::const_iterator j = m_transitions.begin(), je = m_transitions.end(); j != je; ++j) {
-			for (TransitionRow::const_iterator k = j->begin(), ke = j->end(); k != ke; ++k) {
-				for (StatesSet::const_iterator toSt = k->second.begin(), toSte = k->second.end(); toSt != toSte; ++toSt) {
-					// We only care if the states are connected or not regerdless through what letter
-					if (invert) {
-						// Build an FSM with inverted transitions
-						digraph.Connect(*toSt, j - m_transitions.begin(), 0);
-					} else {
-						digraph.Connect(j - m_transitions.begin(), *toSt, 0);
-					}
-				}
-			}
+InputNormalization& InputNormalization::Map(unsigned char from, unsigned char to)
+{
+	for (auto&& ch : m_map)
+		if (ch == from)
+			ch = to;
+	return *this;
+}
+
+InputNormalization& InputNormalization::Lowercase()
+{
+	for (unsigned char ch = 'A'; ch <= 'Z'; ++ch)
+		Map(ch, ch - 'A' + 'a');
+	return *this;
+}
+
+InputNormalization& InputNormalization::Digits(unsigned char to /* = '0' */)
+{
+	for (unsigned char ch = '0'; ch <= '9'; ++ch)
+		Map(ch, to);
+	return *this;
+}
+
+InputNormalization& InputNormalization::Whitespace(unsigned char to /* = ' ' */)
+{
+	static const char spaces[] = " \t\n\v\f\r";
+	for (const char* ch = spaces; *ch; ++ch)
+		Map(*ch, to);
+	return *this;
+}
+
+Fsm& Fsm::Normalize(const InputNormalization& norm)
+{
+	bool sparsed = m_sparsed;
+	if (sparsed)
+		Unsparse();
+
+	// A transition by a byte is replaced with the transition by its normalized form;
+	// special characters are left intact
+	for (auto&& row : m_transitions) {
+		TransitionRow normalized;
+		for (auto&& i : row)
+			if (i.first >= (1 << (sizeof(char)*8)))
+				normalized.insert(i);
+		for (unsigned ch = 0; ch != 1 << (sizeof(char)*8); ++ch) {
+			auto it = row.find(norm[ch]);
+			if (it != row.end())
+				normalized[ch] = it->second;
 		}
+		row.swap(normalized);
+	}
 
-		TVector<bool> unchecked(Size(), true);
-		TVector<bool> useless(Size(), true);
-		TDeque<size_t> queue;
+	if (sparsed)
+		Sparse();
+	return *this;
+}
 
-		// Put all final (or initial) states into queue, marking them useful
-		for (size_t i = 0; i < Size(); ++i)
-			if ((invert && IsFinal(i)) || (!invert && Initial() == i)) {
-				useless[i] = false;
-				queue.push_back(i);
-			}
+namespace {
+	/// Finds strongly connected components of a graph given by adjacency lists
+	/// (a non-recursive version of Tarjan's algorithm). Components are numbered
+	/// in reverse topological order. Returns the number of components.
+	size_t StronglyConnectedComponents(const TVector< TVector<size_t> >& graph, TVector<size_t>& component)
+	{
+		static const size_t None = static_cast<size_t>(-1);
+		size_t size = graph.size();
+		TVector<size_t> index(size, None);
+		TVector<size_t> lowlink(size, 0);
+		TVector<bool> onStack(size, false);
+		TVector<size_t> stack;
+		TVector< ypair<size_t, size_t> > calls; // A vertex and the next edge to visit
+		component.assign(size, None);
+		size_t counter = 0;
+		size_t components = 0;
+
+		for (size_t root = 0; root != size; ++root) {
+			if (index[root] != None)
+				continue;
+			index[root] = lowlink[root] = counter++;
+			stack.push_back(root);
+			onStack[root] = true;
+			calls.push_back(ymake_pair(root, static_cast<size_t>(0)));
+
+			while (!calls.empty()) {
+				size_t v = calls.back().first;
+				if (calls.back().second != graph[v].size()) {
+					size_t w = graph[v][calls.back().second++];
+					if (index[w] == None) {
+						index[w] = lowlink[w] = counter++;
+						stack.push_back(w);
+						onStack[w] = true;
+						calls.push_back(ymake_pair(w, static_cast<size_t>(0)));
+					} else if (onStack[w])
+						lowlink[v] = ymin(lowlink[v], index[w]);
+					continue;
+				}
 
-		// Do the breadth-first search, marking all states
-		// from which already marked states are reachable
-		while (!queue.empty()) {
-			size_t to = queue.front();
-			queue.pop_front();
-
-			// All the states that are connected to this state in the transition matrix are useful
-			const StatesSet& connections = (digraph.m_transitions[to])[0];
-			for (auto&& fr : connections) {
-				// Enqueue the state for further traversal if it hasnt been already checked
-				if (unchecked[fr] && useless[fr]) {
-					useless[fr] = false;
-					queue.push_back(fr);
+				calls.pop_back();
+				if (!calls.empty())
+					lowlink[calls.back().first] = ymin(lowlink[calls.back().first], lowlink[v]);
+				if (lowlink[v] == index[v]) {
+					size_t w;
+					do {
+						w = stack.back();
+						stack.pop_back();
+						onStack[w] = false;
+						component[w] = components;
+					} while (w != v);
+					++components;
 				}
 			}
-
-			// Now we consider this state checked
-			unchecked[to] = false;
 		}
+		return components;
+	}
+
+	/// Marks all states reachable from the marked ones in a graph
+	/// given by adjacency arrays (edges of state i are adj[start[i]] .. adj[start[i+1]]).
+	void MarkReachable(const TVector<size_t>& start, const TVector<size_t>& adj, TVector<bool>& marked)
+	{
+		TVector<size_t> queue;
+		for (size_t i = 0; i != marked.size(); ++i)
+			if (marked[i])
+				queue.push_back(i);
+		for (size_t i = 0; i != queue.size(); ++i)
+			for (size_t e = start[queue[i]]; e != start[queue[i] + 1]; ++e)
+				if (!marked[adj[e]]) {
+					marked[adj[e]] = true;
+					queue.push_back(adj[e]);
+				}
+	}
+}
 
-		for (size_t i = 0; i < Size(); ++i) {
-			if (useless[i]) {
-				res.insert(i);
+TSet<size_t> Fsm::DeadStates() const
+{
+	// Build adjacency arrays of the transition graph and of its inverse;
+	// we only care if the states are connected or not regardless through what letter
+	TVector<size_t> fwdStart(Size() + 1, 0);
+	TVector<size_t> bwdStart(Size() + 1, 0);
+	for (size_t from = 0; from != Size(); ++from)
+		for (auto&& row : m_transitions[from])
+			for (auto&& to : row.second) {
+				++fwdStart[from + 1];
+				++bwdStart[to + 1];
 			}
-		}
+	for (size_t i = 0; i != Size(); ++i) {
+		fwdStart[i + 1] += fwdStart[i];
+		bwdStart[i + 1] += bwdStart[i];
 	}
+	TVector<size_t> fwd(fwdStart.back());
+	TVector<size_t> bwd(bwdStart.back());
+	TVector<size_t> fwdPos(fwdStart.begin(), fwdStart.end() - 1);
+	TVector<size_t> bwdPos(bwdStart.begin(), bwdStart.end() - 1);
+	for (size_t from = 0; from != Size(); ++from)
+		for (auto&& row : m_transitions[from])
+			for (auto&& to : row.second) {
+				fwd[fwdPos[from]++] = to;
+				bwd[bwdPos[to]++] = from;
+			}
+
+	// A state is useful if it is reachable from the initial state
+	// and some final state is reachable from it
+	TVector<bool> reachable(Size(), false);
+	reachable[Initial()] = true;
+	MarkReachable(fwdStart, fwd, reachable);
 
+	TVector<bool> productive(Size(), false);
+	for (auto&& final : m_final)
+		productive[final] = true;
+	MarkReachable(bwdStart, bwd, productive);
+
+	TSet<size_t> res;
+	for (size_t i = 0; i != Size(); ++i)
+		if (!reachable[i] || !productive[i])
+			res.insert(res.end(), i);
 	return res;
 }
 
@@ -696,14 +819,28 @@ void Fsm::RemoveDeadEnds()
 {
 	PIRE_IFDEBUG(Cdbg << "Removing dead ends on:" << Endl << *this << Endl);
 
-	TSet<size_t> dead = DeadStates();
-	// Erase all useless states
-	for (auto&& i : dead) {
+	TSet<size_t> deadStates = DeadStates();
+	TVector<bool> dead(Size(), false);
+	for (auto&& i : deadStates) {
 		PIRE_IFDEBUG(Cdbg << "Removing useless state " << i << Endl);
-		m_transitions[i].clear();
-		for (auto&& j : m_transitions)
-			for (auto&& k : j)
-				k.second.erase(i);
+		dead[i] = true;
+	}
+
+	// Erase all useless states and all transitions leading to them in a single pass
+	if (!deadStates.empty()) {
+		for (size_t state = 0; state != Size(); ++state) {
+			if (dead[state]) {
+				m_transitions[state].clear();
+				continue;
+			}
+			for (auto&& row : m_transitions[state])
+				for (auto i = row.second.begin(); i != row.second.end();) {
+					if (dead[*i])
+						row.second.erase(i++);
+					else
+						++i;
+				}
+		}
 	}
 	ClearHints();
 
@@ -780,9 +917,78 @@ void Fsm::ShortCutEpsilon(size_t from, size_t thru, TVector< TSet<size_t> >& inv
 	}
 }
 
-// Removes all Epsilon-connections by iterating though states and merging each Epsilon-connection
-// effects from 'to' state into 'from' state
+// Removes all Epsilon-connections by merging transitions, finality and tags
+// of all states epsilon-reachable from each state into that state
 void Fsm::RemoveEpsilons()
+{
+	if (!outputs.empty()) {
+		// Outputs depend on the particular epsilon paths taken,
+		// so fall back to merging state pairs one by one
+		RemoveEpsilonsWithOutputs();
+		return;
+	}
+
+	// States of a strongly connected component of the epsilon graph share
+	// their epsilon closure. Components are numbered in reverse topological order,
+	// so closures of all components reachable from the current one are already known.
+	TVector< TVector<size_t> > eps(Size());
+	for (size_t from = 0; from != Size(); ++from)
+		for (auto&& to : Destinations(from, Epsilon))
+			if (to != from)
+				eps[from].push_back(to);
+	TVector<size_t> component;
+	size_t count = StronglyConnectedComponents(eps, component);
+	TVector< TVector<size_t> > members(count);
+	for (size_t state = 0; state != Size(); ++state)
+		members[component[state]].push_back(state);
+
+	static const size_t None = static_cast<size_t>(-1);
+	TVector<size_t> seen(count, None);
+	for (size_t c = 0; c != count; ++c) {
+		// Sources of transitions to be merged: members of the component
+		// and one (already merged) state of each component directly reachable from it
+		TVector<size_t> sources(members[c]);
+		for (auto&& state : members[c])
+			for (auto&& to : eps[state])
+				if (component[to] != c && seen[component[to]] != c) {
+					seen[component[to]] = c;
+					sources.push_back(members[component[to]].front());
+				}
+		if (sources.size() == 1)
+			continue;
+
+		TransitionRow merged;
+		bool final = false;
+		unsigned long tag = 0;
+		for (auto&& source : sources) {
+			for (auto&& row : m_transitions[source])
+				if (row.first != Epsilon)
+					merged[row.first].insert(row.second.begin(), row.second.end());
+			final = final || IsFinal(source);
+			tag |= Tag(source);
+		}
+		for (auto&& state : members[c]) {
+			if (state != members[c].back())
+				m_transitions[state] = merged;
+			else
+				m_transitions[state].swap(merged);
+			if (final)
+				SetFinal(state, true);
+			if (tag)
+				SetTag(state, tag);
+		}
+	}
+
+	PIRE_IFDEBUG(Cdbg << "=== After epsilons merged\n" << *this << Endl);
+
+	Unsparse();
+	for (auto&& i : m_transitions)
+		i.erase(Epsilon);
+	Sparse();
+	ClearHints();
+}
+
+void Fsm::RemoveEpsilonsWithOutputs()
 {
 	Unsparse();
 
@@ -1015,7 +1221,6 @@ private:
 
 bool Fsm::Determine(size_t maxsize /* = 0 */)
 {
-	static const unsigned MaxSize = 200000;
 	if (determined)
 		return true;
 
@@ -1023,14 +1228,154 @@ bool Fsm::Determine(size_t maxsize /* = 0 */)
 	
 	RemoveEpsilons();
 	PIRE_IFDEBUG(Cdbg << "=== After all epsilons removed" << Endl << *this << Endl);
+	PIRE_PROBE2(determine_begin, Size(), maxsize);
 	
 	Impl::FsmDetermineTask task(*this);
-	if (Pire::Impl::Determine(task, maxsize ? maxsize : MaxSize)) {
+	if (Pire::Impl::Determine(task, maxsize ? maxsize : DefaultMaxSize)) {
 		task.Output().Swap(*this);
 		PIRE_IFDEBUG(Cdbg << "=== Determined ===" << Endl << *this << Endl);
+		PIRE_PROBE2(determine_end, Size(), 1);
 		return true;
-	} else
+	} else {
+		PIRE_PROBE2(determine_end, Size(), 0);
 		return false;
+	}
+}
+
+const size_t Fsm::DefaultMaxSize;
+
+namespace {
+	/// Returns the length of the longest path from the initial state, given lengths of all edges.
+	/// Loops (strongly connected components) add nothing to the length: going around one
+	/// revisits the same states instead of reaching new ones.
+	size_t LongestPath(const TVector< TVector<size_t> >& graph, const TVector< TVector<size_t> >& lengths, size_t initial)
+	{
+		TVector<size_t> component;
+		size_t count = StronglyConnectedComponents(graph, component);
+		TVector< TVector<size_t> > members(count);
+		for (size_t state = 0; state != graph.size(); ++state)
+			members[component[state]].push_back(state);
+
+		static const size_t Unreachable = static_cast<size_t>(-1);
+		TVector<size_t> dist(count, Unreachable);
+		dist[component[initial]] = 0;
+		size_t longest = 0;
+		// Components are numbered in reverse topological order, hence we go from the end
+		for (size_t c = count; c--;) {
+			if (dist[c] == Unreachable)
+				continue;
+			size_t through = dist[c];
+			longest = ymax(longest, through);
+			for (auto&& from : members[c])
+				for (size_t i = 0; i != graph[from].size(); ++i) {
+					size_t to = component[graph[from][i]];
+					if (to != c && (dist[to] == Unreachable || dist[to] < through + lengths[from][i]))
+						dist[to] = through + lengths[from][i];
+				}
+		}
+		return longest;
+	}
+}
+
+Fsm::SizeEstimate Fsm::EstimateDeterminedSize(size_t sampleSize /* = 0 */) const
+{
+	static const size_t DefaultSampleSize = 1000;
+	SizeEstimate estimate;
+	if (determined) {
+		estimate.States = estimate.MinStates = Size();
+		estimate.Confidence = 1;
+		return estimate;
+	}
+
+	Fsm fsm(*this);
+	fsm.RemoveEpsilons();
+	Impl::FsmDetermineTask task(fsm);
+	typedef Impl::FsmDetermineTask::State State;
+
+	// Run the subset construction layer by layer, until we run out of the sample
+	if (!sampleSize)
+		sampleSize = DefaultSampleSize;
+	TSet<State> seen;
+	TVector<State> layer(1, task.Initial());
+	TVector<State> next;
+	TVector<size_t> layers; // Sizes of completely discovered layers
+	seen.insert(layer.front());
+	bool exhausted = false;
+	while (!layer.empty() && !exhausted) {
+		layers.push_back(layer.size());
+		next.clear();
+		for (auto st = layer.begin(), se = layer.end(); st != se && !exhausted; ++st) {
+			if (!task.IsRequired(*st))
+				continue;
+			for (auto&& letter : task.Letters()) {
+				State ns = task.Next(*st, letter.first);
+				if (seen.insert(ns).second) {
+					next.push_back(ns);
+					if (seen.size() > sampleSize) {
+						exhausted = true;
+						break;
+					}
+				}
+			}
+		}
+		layer.swap(next);
+	}
+
+	if (!exhausted) {
+		estimate.States = estimate.MinStates = seen.size();
+		estimate.Confidence = 1;
+		return estimate;
+	}
+
+	// Extrapolate the growth of the last layers up to the expected depth of the determined FSM
+	size_t window = ymin<size_t>(3, layers.size() - 1);
+	double growth = 1;
+	double minGrowth = 1;
+	double maxGrowth = 1;
+	if (window) {
+		growth = pow(static_cast<double>(layers.back()) / layers[layers.size() - 1 - window], 1.0 / window);
+		minGrowth = maxGrowth = static_cast<double>(layers.back()) / layers[layers.size() - 2];
+		for (size_t i = layers.size() - window; i != layers.size(); ++i) {
+			double g = static_cast<double>(layers[i]) / layers[i - 1];
+			minGrowth = ymin(minGrowth, g);
+			maxGrowth = ymax(maxGrowth, g);
+		}
+	}
+
+	// Every letter, BeginMark included, makes a new layer, except for EndMark,
+	// after which nothing is read
+	TVector< TVector<size_t> > graph(fsm.Size());
+	TVector< TVector<size_t> > lengths(fsm.Size());
+	for (size_t from = 0; from != fsm.Size(); ++from)
+		for (auto&& row : fsm.m_transitions[from])
+			if (row.first != EndMark)
+				for (auto&& to : row.second) {
+					graph[from].push_back(to);
+					lengths[from].push_back(1);
+				}
+	size_t depth = LongestPath(graph, lengths, fsm.initial);
+	size_t remaining = depth >= layers.size() ? depth - layers.size() + 1 : 1;
+
+	static const double Huge = 1e18;
+	double predicted = seen.size();
+	double layerSize = layers.back();
+	for (size_t i = 0; i != remaining && predicted < Huge; ++i) {
+		layerSize *= growth;
+		predicted += layerSize;
+	}
+	// Subset construction cannot produce more states than there are subsets
+	if (fsm.Size() < 60)
+		predicted = ymin(predicted, ldexp(1.0, fsm.Size()));
+	predicted = ymin(ymax(predicted, static_cast<double>(seen.size())), Huge);
+
+	estimate.States = static_cast<size_t>(predicted);
+	// The growth may as well stop right after the sample (e.g. at a letter narrowing the next
+	// repetition), so the conservative figure lies halfway, on a log scale, between the two
+	estimate.MinStates = static_cast<size_t>(sqrt(predicted * seen.size()));
+	// The steadier the growth, and the larger part of the depth has been sampled,
+	// the more we trust the extrapolation, but it is never exact
+	estimate.Confidence = 0.9 * minGrowth / maxGrowth * layers.size() / (layers.size() + remaining);
+	return estimate;
 }
 
 namespace Impl {
@@ -1152,10 +1497,12 @@ void Fsm::Minimize()
 	// Minimization algorithm is only applicable to a determined FSM.
 	Y_ASSERT(determined);
 
+	PIRE_PROBE1(minimize_begin, Size());
 	Impl::FsmMinimizeTask task{*this};
 	if (Pire::Impl::Minimize(task)) {
 		task.Output().Swap(*this);
 	}
+	PIRE_PROBE1(minimize_end, Size());
 }
 
 Fsm& Fsm::Canonize(size_t maxSize /* = 0 */)
@@ -28,6 +28,7 @@
 #include "stub/stl.h"
 #include "partition.h"
 #include "defs.h"
+#include "probes.h"
 
 namespace Pire {
 
@@ -37,6 +38,28 @@ namespace Pire {
 		class HalfFinalDetermineTask;
 	}
 
+	/**
+	 * A byte-to-byte substitution applied to the scanned text,
+	 * such as case folding (see Fsm::Normalize()). Identity by default.
+	 * Each substitution is applied to the result of the previous ones.
+	 */
+	class InputNormalization {
+	public:
+		InputNormalization();
+
+		/// Makes every byte currently translated to @p from translate to @p to instead
+		InputNormalization& Map(unsigned char from, unsigned char to);
+
+		InputNormalization& Lowercase();                      ///< ASCII A-Z to a-z
+		InputNormalization& Digits(unsigned char to = '0');     ///< ASCII 0-9 to a single digit
+		InputNormalization& Whitespace(unsigned char to = ' '); ///< ASCII whitespace to a single character
+
+		unsigned char operator[](unsigned char c) const { return m_map[c]; }
+
+	private:
+		unsigned char m_map[1 << (sizeof(char)*8)];
+	};
+
 	/// A Flying Spaghetti Monster... no, just a Finite State Machine.
 	class Fsm {
 	public:		
@@ -106,6 +129,12 @@ namespace Pire {
 		/// Creates an FSM which matches reversed strings matched by current FSM.
 		Fsm& Reverse();
 
+		/// Makes the FSM treat each input byte as if it were replaced according to @p norm
+		/// (so patterns should be written in the normalized form). This costs nothing
+		/// at scan time, since normalization is built into the transitions of compiled
+		/// scanners and saved along with them. Returns *this.
+		Fsm& Normalize(const InputNormalization& norm);
+
 		/// Returns a set of states from which no final states are reachable or that are not reachable from the start state.
 		TSet<size_t> DeadStates() const;
 
@@ -192,6 +221,30 @@ namespace Pire {
 		/// return value: successful?
 		bool Determine(size_t maxsize = 0);
 		bool IsDetermined() const { return determined; }
+
+		/// Maximum number of states Determine() produces unless told otherwise.
+		static const size_t DefaultMaxSize = 200000;
+
+		/// A rough prediction of the determined FSM size.
+		struct SizeEstimate {
+			size_t States;     ///< Predicted number of states
+			size_t MinStates;  ///< A conservative prediction, which the real size rarely falls below
+			double Confidence; ///< How much States can be trusted, from 0 (a wild guess) to 1 (exact count)
+
+			SizeEstimate(): States(0), MinStates(0), Confidence(0) {}
+
+			/// Checks whether determination is certain enough to exceed the given limit
+			/// to give up on it beforehand
+			bool Exceeds(size_t limit) const { return MinStates > limit; }
+		};
+
+		/// Predicts the number of states Determine() would produce, without actually determining the FSM.
+		/// Runs the subset construction until @p sampleSize states are discovered; if it finishes,
+		/// the count is exact. Otherwise, growth of the last BFS layers is extrapolated to
+		/// the depth of the FSM (the longest path between its loops, which is where
+		/// counted repetitions make subsets multiply). This overestimates patterns whose
+		/// repetitions get narrower further on, hence Exceeds() only relies on MinStates.
+		SizeEstimate EstimateDeterminedSize(size_t sampleSize = 0) const;
 		void SetIsDetermined(bool det) { determined = det; }
 
 		/// Minimizes amount of states in the regexp.
@@ -236,6 +289,7 @@ namespace Pire {
 		
 		void ShortCutEpsilon(size_t from, size_t thru, TVector< TSet<size_t> >& inveps); ///< internal
 		void MergeEpsilonConnection(size_t from, size_t to); ///< internal
+		void RemoveEpsilonsWithOutputs(); ///< internal
 
 		TSet<size_t> TerminalStates() const;
 		
@@ -273,7 +327,10 @@ namespace Pire {
 	template<class Scanner>
 	inline Scanner Fsm::Compile(size_t distance)
 	{
-		return Scanner(*this, distance);
+		PIRE_PROBE1(compile_begin, Size());
+		Scanner scanner(*this, distance);
+		PIRE_PROBE1(compile_end, scanner.Size());
+		return scanner;
 	}
 
 	yostream& operator << (yostream&, const Fsm&);
@@ -0,0 +1,161 @@
+/*
+ * hits.h -- counting how often each regexp of a scanner matches
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_HITS_H
+#define PIRE_HITS_H
+
+#include <atomic>
+#include <thread>
+#include "align.h"
+#include "defs.h"
+#include "platform.h"
+#include "stub/stl.h"
+#include "stub/noncopyable.h"
+
+namespace Pire {
+
+namespace Impl {
+	/// A small number identifying the calling thread, assigned on first use
+	inline size_t ThreadShard()
+	{
+		static std::atomic<size_t> next(0);
+		static thread_local size_t shard = next.fetch_add(1, std::memory_order_relaxed);
+		return shard;
+	}
+}
+
+/**
+ * Per-regexp hit counters for a (usually glued) scanner.
+ *
+ * Record() is supposed to be called with the final state of each scan;
+ * every regexp accepted in that state gets its counter incremented.
+ * Counters are sharded by thread, each shard occupying its own cache lines,
+ * and are summed up by Counts(). By default there are as many shards as
+ * hardware threads; threads beyond that share shards with other ones.
+ *
+ * Only every @p sampleRate-th call of Record() in a shard is actually
+ * counted (and the counts are scaled back on export). The decision is made
+ * on a countdown kept in the shard itself, so calls which are not sampled
+ * only touch the cache line of their own shard. Threads sharing a shard
+ * may race on the countdown, which makes sampling slightly irregular.
+ *
+ * The scanner must outlive this object.
+ */
+template<class Scanner>
+class RegexpHits: private NonCopyable {
+public:
+	typedef typename Scanner::State State;
+
+	/// Number of shards used if the number of hardware threads is unknown
+	static const size_t DefaultShards = 16;
+
+	explicit RegexpHits(const Scanner& sc, size_t sampleRate = 1, size_t shards = 0)
+		: m_scanner(&sc)
+		, m_sampleRate(sampleRate ? sampleRate : 1)
+		, m_shards(shards ? shards : std::thread::hardware_concurrency())
+		, m_stride(Impl::AlignUp(sc.RegexpsCount() + HitsOffset, CacheLine / sizeof(Counter)))
+	{
+		if (!m_shards)
+			m_shards = DefaultShards;
+		// Each shard is the scan counter and the sample countdown
+		// followed by hit counters, padded to whole cache lines
+		m_buffer.reset(new Counter[m_shards * m_stride + CacheLine / sizeof(Counter)]());
+		m_counters = Impl::AlignUp(m_buffer.get(), CacheLine);
+	}
+
+	size_t SampleRate() const { return m_sampleRate; }
+
+	/// Accounts a scan which has finished in the given state
+	PIRE_FORCED_INLINE
+	void Record(const State& st)
+	{
+		Counter* shard = m_counters + (Impl::ThreadShard() % m_shards) * m_stride;
+		if (m_sampleRate != 1) {
+			// Not a read-modify-write: the shard is normally used by a single thread
+			ui64 countdown = shard[CountdownOffset].load(std::memory_order_relaxed);
+			if (countdown) {
+				shard[CountdownOffset].store(countdown - 1, std::memory_order_relaxed);
+				return;
+			}
+			shard[CountdownOffset].store(m_sampleRate - 1, std::memory_order_relaxed);
+		}
+		shard[ScansOffset].fetch_add(m_sampleRate, std::memory_order_relaxed);
+		for (auto regexps = m_scanner->AcceptedRegexps(st); regexps.first != regexps.second; ++regexps.first)
+			shard[*regexps.first + HitsOffset].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/// Number of scans recorded so far (estimated, if sampled)
+	ui64 Scans() const
+	{
+		ui64 scans = 0;
+		for (size_t i = 0; i != m_shards; ++i)
+			scans += m_counters[i * m_stride + ScansOffset].load(std::memory_order_relaxed);
+		return scans;
+	}
+
+	/// Returns the (estimated, if sampled) number of hits of each regexp
+	TVector<ui64> Counts() const
+	{
+		TVector<ui64> counts(m_scanner->RegexpsCount(), 0);
+		for (size_t i = 0; i != m_shards; ++i)
+			for (size_t id = 0; id != counts.size(); ++id)
+				counts[id] += m_counters[i * m_stride + id + HitsOffset].load(std::memory_order_relaxed) * m_sampleRate;
+		return counts;
+	}
+
+	/// Indices of regexps which have not been hit at all
+	TVector<size_t> NeverHit() const
+	{
+		TVector<ui64> counts = Counts();
+		TVector<size_t> ids;
+		for (size_t i = 0; i != counts.size(); ++i)
+			if (!counts[i])
+				ids.push_back(i);
+		return ids;
+	}
+
+	void Reset()
+	{
+		for (size_t i = 0; i != m_shards * m_stride; ++i)
+			m_counters[i].store(0, std::memory_order_relaxed);
+	}
+
+private:
+	typedef std::atomic<ui64> Counter;
+	static const size_t CacheLine = 64;
+	enum { ScansOffset = 0, CountdownOffset = 1, HitsOffset = 2 };
+
+	const Scanner* m_scanner;
+	size_t m_sampleRate;
+	size_t m_shards;
+	size_t m_stride; ///< Number of counters per shard
+	std::unique_ptr<Counter[]> m_buffer;
+	Counter* m_counters; ///< Cache line aligned start of m_buffer
+};
+
+template<class Scanner>
+const size_t RegexpHits<Scanner>::DefaultShards;
+
+}
+
+#endif
@@ -0,0 +1,223 @@
+/*
+ * incremental.h -- rescanning of edited texts
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_INCREMENTAL_H
+#define PIRE_INCREMENTAL_H
+
+#include "defs.h"
+#include "run.h"
+#include "stub/stl.h"
+
+namespace Pire {
+
+namespace Impl {
+	/// Bytes to scan between attempts to merge runs that have synchronized
+	const size_t TransferMergeInterval = 64;
+
+	/**
+	 * Calculates the transfer function of a chunk, i.e. the index of the state
+	 * the scanner ends up in after the chunk for each state index it could have
+	 * started the chunk in. An empty vector stands for the identity mapping.
+	 * Instead of running the scanner from each state separately
+	 * we only keep track of distinct states reached so far:
+	 * runs from different initial states usually converge quickly.
+	 */
+	template<class Scanner>
+	TVector<ui32> ScanTransfer(const Scanner& sc, const char* begin, const char* end)
+	{
+		if (begin == end)
+			return TVector<ui32>();
+
+		static const ui32 Unset = static_cast<ui32>(-1);
+		size_t size = sc.Size();
+		TVector<typename Scanner::State> runs(size);
+		TVector<ui32> owner(size);        // initial state index -> index in runs
+		TVector<ui32> seen(size, Unset);  // state index -> index in merged runs
+		TVector<ui32> remap;
+		for (size_t i = 0; i != size; ++i) {
+			runs[i] = sc.IndexToState(i);
+			owner[i] = i;
+		}
+
+		while (begin != end) {
+			const char* stop = begin + ymin<size_t>(end - begin, TransferMergeInterval);
+			for (auto&& st : runs)
+				Pire::Run(sc, st, begin, stop);
+			begin = stop;
+
+			if (runs.size() == 1)
+				continue;
+			remap.resize(runs.size());
+			size_t merged = 0;
+			for (size_t i = 0; i != runs.size(); ++i) {
+				ui32& idx = seen[sc.StateIndex(runs[i])];
+				if (idx == Unset) {
+					idx = merged;
+					runs[merged++] = runs[i];
+				}
+				remap[i] = idx;
+			}
+			for (size_t i = 0; i != merged; ++i)
+				seen[sc.StateIndex(runs[i])] = Unset;
+			if (merged != runs.size()) {
+				runs.resize(merged);
+				for (auto&& o : owner)
+					o = remap[o];
+			}
+		}
+
+		for (auto&& o : owner)
+			o = sc.StateIndex(runs[o]);
+		return owner;
+	}
+}
+
+/**
+ * Matches a text which is being edited, without rescanning all of it after each edit.
+ *
+ * The text is split into chunks. For each chunk the runner remembers its transfer
+ * function, i.e. which state the scanner ends up in after the chunk for every state
+ * it could have started the chunk in. Transfer functions are composed pairwise
+ * in a segment tree, so replacing the text of a chunk costs one scan of the new text
+ * and O(log n) compositions, where n is the number of chunks.
+ *
+ * The text itself is not stored; the caller is responsible for knowing
+ * chunk boundaries. A chunk may be replaced with a text of any length
+ * (including an empty one), so insertions and deletions are handled
+ * by replacing the chunk(s) they touch.
+ *
+ * The scanner must provide Size(), StateIndex() and IndexToState()
+ * (Pire::Scanner and its variations do) and must outlive the runner.
+ * Memory consumption is about 8 * Size() bytes per chunk.
+ */
+template<class Scanner>
+class IncrementalRunner {
+public:
+	/// Maps a state index before a chunk to the state index after it.
+	/// An empty vector stands for the identity mapping.
+	typedef TVector<ui32> Transfer;
+
+	static const size_t DefaultChunkSize = 4096;
+
+	explicit IncrementalRunner(const Scanner& sc): m_sc(&sc), m_count(0), m_tree(2) {}
+
+	/// Replaces the whole text, splitting it into chunks of the given size
+	void Assign(const char* begin, const char* end, size_t chunkSize = DefaultChunkSize)
+	{
+		Y_ASSERT(chunkSize);
+		m_count = (end - begin + chunkSize - 1) / chunkSize;
+		m_tree.assign(2 * Capacity(m_count), Transfer());
+		size_t cap = m_tree.size() / 2;
+		for (size_t i = 0; i != m_count; ++i, begin += chunkSize)
+			m_tree[cap + i] = Scan(begin, ymin(begin + chunkSize, end));
+		for (size_t node = cap - 1; node; --node)
+			Update(node);
+	}
+
+	size_t ChunksCount() const { return m_count; }
+
+	/// Replaces the text of the given chunk
+	void Replace(size_t chunk, const char* begin, const char* end)
+	{
+		Y_ASSERT(chunk < m_count);
+		size_t node = m_tree.size() / 2 + chunk;
+		m_tree[node] = Scan(begin, end);
+		for (node /= 2; node; node /= 2)
+			Update(node);
+	}
+
+	/// Appends a new chunk to the end of the text
+	void Append(const char* begin, const char* end)
+	{
+		if (m_count == m_tree.size() / 2) {
+			// Grow the tree twice; amortized this costs O(1) compositions per chunk
+			size_t cap = m_tree.size() / 2;
+			TVector<Transfer> tree(4 * cap);
+			for (size_t i = 0; i != m_count; ++i)
+				tree[2 * cap + i].swap(m_tree[cap + i]);
+			m_tree.swap(tree);
+			for (size_t node = 2 * cap - 1; node; --node)
+				Update(node);
+		}
+		++m_count;
+		Replace(m_count - 1, begin, end);
+	}
+
+	/// Returns the state the scanner would reach if run through the whole text,
+	/// surrounded with BeginMark and EndMark.
+	typename Scanner::State State() const
+	{
+		typename Scanner::State st;
+		m_sc->Initialize(st);
+		Pire::Step(*m_sc, st, BeginMark);
+		const Transfer& root = m_tree[1];
+		if (!root.empty())
+			st = m_sc->IndexToState(root[m_sc->StateIndex(st)]);
+		Pire::Step(*m_sc, st, EndMark);
+		return st;
+	}
+
+	bool Final() const { return m_sc->Final(State()); }
+
+	ypair<const size_t*, const size_t*> AcceptedRegexps() const { return m_sc->AcceptedRegexps(State()); }
+
+private:
+	const Scanner* m_sc;
+	size_t m_count;
+
+	/// Node i has children 2i and 2i+1; leaves start at m_tree.size() / 2
+	TVector<Transfer> m_tree;
+
+	static size_t Capacity(size_t count)
+	{
+		size_t cap = 1;
+		while (cap < count)
+			cap *= 2;
+		return cap;
+	}
+
+	void Update(size_t node)
+	{
+		const Transfer& lhs = m_tree[2 * node];
+		const Transfer& rhs = m_tree[2 * node + 1];
+		Transfer& res = m_tree[node];
+		if (lhs.empty())
+			res = rhs;
+		else if (rhs.empty())
+			res = lhs;
+		else {
+			res.resize(lhs.size());
+			for (size_t i = 0; i != lhs.size(); ++i)
+				res[i] = rhs[lhs[i]];
+		}
+	}
+
+	Transfer Scan(const char* begin, const char* end) const { return Impl::ScanTransfer(*m_sc, begin, end); }
+};
+
+template<class Scanner>
+const size_t IncrementalRunner<Scanner>::DefaultChunkSize;
+
+}
+
+#endif
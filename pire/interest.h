@@ -0,0 +1,244 @@
+/*
+ * interest.h -- stopping a scan once the regexps of interest are decided
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_INTEREST_H
+#define PIRE_INTEREST_H
+
+#include "defs.h"
+#include "run.h"
+#include "vbitset.h"
+#include "stub/stl.h"
+
+namespace Pire {
+
+/**
+ * For each state of a scanner, the set of regexps which can still be accepted,
+ * either in that state or in any state reachable from it, and the set of
+ * regexps which are certain, i.e. accepted in that state and in every state
+ * reachable from it (so no continuation of the text can unaccept them).
+ *
+ * States having equal sets share them, so memory consumption is proportional
+ * to the number of distinct sets, which is usually far less than the number
+ * of states. The scanner must outlive this object.
+ */
+template<class Scanner>
+class PossibleRegexps {
+public:
+	typedef typename Scanner::State State;
+
+	explicit PossibleRegexps(const Scanner& sc)
+		: m_scanner(&sc)
+		, m_possibleIndex(sc.Size(), 0)
+		, m_certainIndex(sc.Size(), 0)
+	{
+		// Enumerate reachable states and invert transitions between them
+		static const ui32 Unvisited = static_cast<ui32>(-1);
+		TVector<ui32> order(sc.Size(), Unvisited);
+		TVector< TVector<ui32> > preds;
+		State st;
+		sc.Initialize(st);
+		order[sc.StateIndex(st)] = 0;
+		m_states.push_back(st);
+		preds.push_back(TVector<ui32>());
+		for (size_t i = 0; i != m_states.size(); ++i) {
+			for (Char c = 0; c != MaxCharUnaligned; ++c) {
+				if (c == Epsilon)
+					continue;
+				State next = m_states[i];
+				Step(sc, next, c);
+				ui32& idx = order[sc.StateIndex(next)];
+				if (idx == Unvisited) {
+					idx = m_states.size();
+					m_states.push_back(next);
+					preds.push_back(TVector<ui32>());
+				}
+				if (preds[idx].empty() || preds[idx].back() != i)
+					preds[idx].push_back(i);
+			}
+		}
+
+		const size_t words = (sc.RegexpsCount() + 63) / 64;
+		TVector<ui64> accepted(m_states.size() * words, 0);
+		for (size_t i = 0; i != m_states.size(); ++i)
+			for (auto regexps = sc.AcceptedRegexps(m_states[i]); regexps.first != regexps.second; ++regexps.first)
+				accepted[i * words + *regexps.first / 64] |= ui64(1) << (*regexps.first % 64);
+
+		// A regexp is possible if it is accepted here or possible in some successor,
+		// and certain if it is accepted here and certain in every successor
+		TVector<ui64> possible = accepted;
+		Propagate(possible, words, preds, false);
+		TVector<ui64>& certain = accepted;
+		Propagate(certain, words, preds, true);
+
+		// Share equal sets
+		TMap<TVector<ui64>, size_t> sets;
+		for (size_t i = 0; i != m_states.size(); ++i) {
+			m_possibleIndex[sc.StateIndex(m_states[i])] = Intern(sets, possible, i, words);
+			m_certainIndex[sc.StateIndex(m_states[i])] = Intern(sets, certain, i, words);
+		}
+	}
+
+	const Scanner& GetScanner() const { return *m_scanner; }
+
+	/// Number of distinct sets of possible or certain regexps
+	size_t SetsCount() const { return m_sets.size(); }
+
+	/// Returns the sorted list of regexps which can still be accepted from the given state
+	const TVector<size_t>& Possible(const State& st) const { return m_sets[m_possibleIndex[m_scanner->StateIndex(st)]]; }
+
+	/// Checks whether the given regexp can still be accepted from the given state
+	bool Possible(const State& st, size_t regexp) const { return Contains(Possible(st), regexp); }
+
+	/// Returns the sorted list of regexps accepted in the given state and in all states reachable from it
+	const TVector<size_t>& Certain(const State& st) const { return m_sets[m_certainIndex[m_scanner->StateIndex(st)]]; }
+
+	/// Checks whether the given regexp stays accepted whatever follows the given state
+	bool Certain(const State& st, size_t regexp) const { return Contains(Certain(st), regexp); }
+
+	/// All states reachable from the initial one
+	const TVector<State>& States() const { return m_states; }
+
+private:
+	const Scanner* m_scanner;
+	TVector<State> m_states;
+	TVector<size_t> m_possibleIndex;   ///< State index -> index in m_sets
+	TVector<size_t> m_certainIndex;    ///< State index -> index in m_sets
+	TVector< TVector<size_t> > m_sets; ///< Distinct sets of regexps
+
+	/// Merges each state's bits with the bits of its successors (by union or
+	/// by intersection) until nothing changes
+	static void Propagate(TVector<ui64>& bits, size_t words, const TVector< TVector<ui32> >& preds, bool intersect)
+	{
+		const size_t count = preds.size();
+		TVector<ui32> queue;
+		TVector<bool> queued(count, true);
+		for (size_t i = 0; i != count; ++i)
+			queue.push_back(i);
+		while (!queue.empty()) {
+			size_t to = queue.back();
+			queue.pop_back();
+			queued[to] = false;
+			for (auto&& from : preds[to]) {
+				bool changed = false;
+				for (size_t w = 0; w != words; ++w) {
+					ui64 merged = intersect
+						? bits[from * words + w] & bits[to * words + w]
+						: bits[from * words + w] | bits[to * words + w];
+					changed = changed || merged != bits[from * words + w];
+					bits[from * words + w] = merged;
+				}
+				if (changed && !queued[from]) {
+					queued[from] = true;
+					queue.push_back(from);
+				}
+			}
+		}
+	}
+
+	size_t Intern(TMap<TVector<ui64>, size_t>& sets, const TVector<ui64>& bits, size_t state, size_t words)
+	{
+		TVector<ui64> set(bits.begin() + state * words, bits.begin() + (state + 1) * words);
+		auto ins = sets.insert(ymake_pair(set, m_sets.size()));
+		if (ins.second) {
+			m_sets.push_back(TVector<size_t>());
+			for (size_t id = 0; id != m_scanner->RegexpsCount(); ++id)
+				if (set[id / 64] & (ui64(1) << (id % 64)))
+					m_sets.back().push_back(id);
+		}
+		return ins.first->second;
+	}
+
+	static bool Contains(const TVector<size_t>& set, size_t regexp) { return std::binary_search(set.begin(), set.end(), regexp); }
+};
+
+/**
+ * A subset of regexps of a scanner some caller is interested in.
+ * A state decides the subset if each of its regexps either cannot be
+ * accepted anymore or stays accepted whatever follows (end of text
+ * included), so the rest of the text does not matter to that caller.
+ */
+template<class Scanner>
+class RegexpInterest {
+public:
+	typedef typename Scanner::State State;
+
+	/// Interesting regexps are those having their bits in @p mask set
+	RegexpInterest(const PossibleRegexps<Scanner>& possible, const BitSet& mask)
+		: m_scanner(&possible.GetScanner())
+		, m_decided(m_scanner->Size(), false)
+	{
+		for (auto&& st : possible.States()) {
+			const TVector<size_t>& set = possible.Possible(st);
+			bool decided = true;
+			// A regexp is undecided if it is possible but not certain yet
+			for (auto id = set.begin(); decided && id != set.end(); ++id)
+				if (*id < mask.Size() && mask.Test(*id) && !possible.Certain(st, *id))
+					decided = false;
+			m_decided[m_scanner->StateIndex(st)] = decided;
+		}
+	}
+
+	bool Decided(const State& st) const { return m_decided[m_scanner->StateIndex(st)]; }
+
+private:
+	const Scanner* m_scanner;
+	TVector<bool> m_decided; ///< State index -> whether the state decides the subset
+};
+
+namespace Impl {
+	template<class Scanner>
+	struct DecidedPred {
+		DecidedPred(const RegexpInterest<Scanner>& interest, const char*& pos): m_interest(&interest), m_pos(&pos) {}
+
+		PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
+		Action operator()(const Scanner&, const typename Scanner::State& st, const char* pos) const
+		{
+			if (!m_interest->Decided(st))
+				return Continue;
+			*m_pos = pos;
+			return Stop;
+		}
+	private:
+		const RegexpInterest<Scanner>* m_interest;
+		const char** m_pos;
+	};
+}
+
+/**
+ * Runs the scanner through the given memory range, stopping as soon as
+ * the state decides all regexps of @p interest. Returns the position
+ * the scan has stopped at (or @p end if it has not).
+ */
+template<class Scanner>
+const char* RunUntilDecided(const Scanner& sc, const RegexpInterest<Scanner>& interest, typename Scanner::State& st, const char* begin, const char* end)
+{
+	if (interest.Decided(st))
+		return begin;
+	const char* pos = end;
+	Impl::DoRun(sc, st, begin, end, Impl::DecidedPred<Scanner>(interest, pos));
+	return pos;
+}
+
+}
+
+#endif
@@ -0,0 +1,267 @@
+/*
+ * pattern_set.h -- deduplication of patterns before agglutination
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_PATTERN_SET_H
+#define PIRE_PATTERN_SET_H
+
+#include "defs.h"
+#include "run.h"
+#include "stub/stl.h"
+#include "stub/defaults.h"
+
+namespace Pire {
+
+namespace Impl {
+
+	inline bool IsScannerLetter(Char c) { return c != Epsilon; }
+
+	/**
+	 * Calculates a hash of the scanner's automaton which does not depend
+	 * on the numbering of its states and on its letter classes.
+	 * Scanners are built from minimized FSMs, so scanners recognizing
+	 * the same language always have the same hash.
+	 */
+	template<class Scanner>
+	ui64 CanonicalHash(const Scanner& sc)
+	{
+		static const ui32 Unvisited = static_cast<ui32>(-1);
+		TVector<ui32> order(sc.Size(), Unvisited);
+		TVector<typename Scanner::State> queue;
+		typename Scanner::State st;
+		sc.Initialize(st);
+		order[sc.StateIndex(st)] = 0;
+		queue.push_back(st);
+
+		ui64 hash = 14695981039346656037ULL;
+		for (size_t i = 0; i != queue.size(); ++i) {
+			hash = (hash ^ (sc.Final(queue[i]) ? 1 : 0)) * 1099511628211ULL;
+			for (Char c = 0; c != MaxCharUnaligned; ++c) {
+				if (!IsScannerLetter(c))
+					continue;
+				typename Scanner::State next = queue[i];
+				Pire::Step(sc, next, c);
+				ui32& idx = order[sc.StateIndex(next)];
+				if (idx == Unvisited) {
+					idx = queue.size();
+					queue.push_back(next);
+				}
+				hash = (hash ^ idx) * 1099511628211ULL;
+			}
+		}
+		return hash;
+	}
+
+	/**
+	 * Runs two scanners simultaneously through all possible inputs and
+	 * checks that @p pred holds for every reachable pair of their states.
+	 * Returns false if it does not, or if more than @p maxSize pairs
+	 * have been visited (zero means no limit).
+	 */
+	template<class Scanner, class Pred>
+	bool ForAllStatePairs(const Scanner& lhs, const Scanner& rhs, Pred pred, size_t maxSize = 0)
+	{
+		typedef ypair<typename Scanner::State, typename Scanner::State> StatePair;
+		TSet< ypair<size_t, size_t> > visited;
+		TVector<StatePair> queue;
+		StatePair init;
+		lhs.Initialize(init.first);
+		rhs.Initialize(init.second);
+		visited.insert(ymake_pair(lhs.StateIndex(init.first), rhs.StateIndex(init.second)));
+		queue.push_back(init);
+
+		for (size_t i = 0; i != queue.size(); ++i) {
+			if (!pred(lhs, queue[i].first, rhs, queue[i].second))
+				return false;
+			for (Char c = 0; c != MaxCharUnaligned; ++c) {
+				if (!IsScannerLetter(c))
+					continue;
+				StatePair next = queue[i];
+				Pire::Step(lhs, next.first, c);
+				Pire::Step(rhs, next.second, c);
+				if (visited.insert(ymake_pair(lhs.StateIndex(next.first), rhs.StateIndex(next.second))).second) {
+					if (maxSize && visited.size() > maxSize)
+						return false;
+					queue.push_back(next);
+				}
+			}
+		}
+		return true;
+	}
+
+	struct SameFinality {
+		template<class Scanner>
+		bool operator()(const Scanner& lhs, typename Scanner::State l, const Scanner& rhs, typename Scanner::State r) const
+		{
+			return lhs.Final(l) == rhs.Final(r);
+		}
+	};
+
+	struct FinalityImplied {
+		template<class Scanner>
+		bool operator()(const Scanner& lhs, typename Scanner::State l, const Scanner& rhs, typename Scanner::State r) const
+		{
+			return !lhs.Final(l) || rhs.Final(r);
+		}
+	};
+}
+
+/// Checks whether two scanners accept the same language.
+template<class Scanner>
+bool Equivalent(const Scanner& lhs, const Scanner& rhs)
+{
+	return Impl::ForAllStatePairs(lhs, rhs, Impl::SameFinality());
+}
+
+/// Checks whether each string accepted by @p lhs is accepted by @p rhs as well.
+/// Returns false if this cannot be determined within @p maxSize state pairs.
+template<class Scanner>
+bool Included(const Scanner& lhs, const Scanner& rhs, size_t maxSize = 0)
+{
+	return Impl::ForAllStatePairs(lhs, rhs, Impl::FinalityImplied(), maxSize);
+}
+
+/**
+ * A set of single-regexp scanners to be glued together, which
+ * keeps only one copy of each distinct pattern.
+ *
+ * Patterns are numbered in order of addition. Equivalent patterns
+ * (i.e. accepting the same strings, however they were written) share
+ * a single regexp in the glued scanner; GluedIndex() and Patterns()
+ * translate between the two numberings.
+ *
+ * Optionally, patterns whose language is included into another
+ * pattern's one (like `foo.*bar' and `foo.*') can be pruned as well.
+ * This is only meaningful if the caller is interested in whether any
+ * pattern matched: a pruned pattern matches only if the pattern it
+ * has been pruned in favour of matches, but not vice versa.
+ */
+template<class Scanner>
+class PatternSet {
+public:
+	/// Adds a pattern, returning its id.
+	size_t Add(const Scanner& sc)
+	{
+		Y_ASSERT(sc.RegexpsCount() == 1);
+		TVector<size_t>& bucket = m_buckets[Impl::CanonicalHash(sc)];
+		for (auto&& distinct : bucket) {
+			if (Equivalent(m_distinct[distinct], sc)) {
+				m_owner.push_back(distinct);
+				return m_owner.size() - 1;
+			}
+		}
+		bucket.push_back(m_distinct.size());
+		m_owner.push_back(m_distinct.size());
+		m_distinct.push_back(sc);
+		m_subsumedBy.push_back(m_subsumedBy.size());
+		m_glued.clear();
+		return m_owner.size() - 1;
+	}
+
+	/// Total number of patterns added
+	size_t Size() const { return m_owner.size(); }
+
+	/// Number of patterns which will actually be glued
+	size_t GluedCount() const { return Numbering().size() - std::count(Numbering().begin(), Numbering().end(), NotGlued); }
+
+	/**
+	 * Prunes patterns whose languages are included into the languages of other patterns.
+	 * Each check is limited to @p maxSize state pairs; if the limit is exceeded,
+	 * the pattern is conservatively kept.
+	 */
+	void PruneSubsumed(size_t maxSize = 0)
+	{
+		for (size_t i = 0; i != m_distinct.size(); ++i)
+			for (size_t j = 0; j != m_distinct.size() && m_subsumedBy[i] == i; ++j)
+				if (i != j && m_subsumedBy[j] == j && Included(m_distinct[i], m_distinct[j], maxSize))
+					m_subsumedBy[i] = j;
+		// Inclusion is a strict partial order on distinct patterns, so there are no cycles
+		for (size_t i = 0; i != m_distinct.size(); ++i)
+			while (m_subsumedBy[m_subsumedBy[i]] != m_subsumedBy[i])
+				m_subsumedBy[i] = m_subsumedBy[m_subsumedBy[i]];
+		m_glued.clear();
+	}
+
+	/// Checks whether the pattern was pruned by PruneSubsumed()
+	bool Subsumed(size_t id) const { return m_subsumedBy[m_owner[id]] != m_owner[id]; }
+
+	/// Returns the index of the regexp in the glued scanner, which accepts the pattern
+	size_t GluedIndex(size_t id) const { return Numbering()[m_subsumedBy[m_owner[id]]]; }
+
+	/// Returns ids of all patterns equivalent to the given regexp of the glued scanner
+	TVector<size_t> Patterns(size_t gluedIndex) const
+	{
+		TVector<size_t> ids;
+		for (size_t id = 0; id != m_owner.size(); ++id)
+			if (!Subsumed(id) && GluedIndex(id) == gluedIndex)
+				ids.push_back(id);
+		return ids;
+	}
+
+	/**
+	 * Glues all distinct patterns together.
+	 * Returns an empty scanner in case of failure (see Scanner::Glue()).
+	 */
+	Scanner Glue(size_t maxSize = 0) const
+	{
+		Scanner sc;
+		bool first = true;
+		for (size_t i = 0; i != m_distinct.size(); ++i) {
+			if (m_subsumedBy[i] != i)
+				continue;
+			if (first)
+				sc = m_distinct[i];
+			else if ((sc = Scanner::Glue(sc, m_distinct[i], maxSize)).Empty())
+				return sc;
+			first = false;
+		}
+		return sc;
+	}
+
+private:
+	static const size_t NotGlued = static_cast<size_t>(-1);
+
+	TMap< ui64, TVector<size_t> > m_buckets; ///< Canonical hash -> indices in m_distinct
+	TVector<Scanner> m_distinct;             ///< Pairwise non-equivalent patterns
+	TVector<size_t> m_owner;                 ///< Pattern id -> index in m_distinct
+	TVector<size_t> m_subsumedBy;            ///< Index in m_distinct -> index of the including pattern
+	mutable TVector<size_t> m_glued;         ///< Index in m_distinct -> index in the glued scanner
+
+	const TVector<size_t>& Numbering() const
+	{
+		if (m_glued.size() != m_distinct.size()) {
+			m_glued.assign(m_distinct.size(), NotGlued);
+			size_t next = 0;
+			for (size_t i = 0; i != m_distinct.size(); ++i)
+				if (m_subsumedBy[i] == i)
+					m_glued[i] = next++;
+		}
+		return m_glued;
+	}
+};
+
+template<class Scanner>
+const size_t PatternSet<Scanner>::NotGlued;
+
+}
+
+#endif
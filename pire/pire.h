@@ -35,5 +35,16 @@
 #include "scanners/simple.h"
 #include "scanners/slow.h"
 #include "scanners/pair.h"
+#include "scanners/comb.h"
+#include "scanners/compact.h"
+#include "scanners/external_glue.h"
+#include "scanners/dispatch.h"
+#include "scanners/any.h"
+
+#include "incremental.h"
+#include "pattern_set.h"
+#include "interest.h"
+#include "hits.h"
+#include "scan_pool.h"
 
 #endif
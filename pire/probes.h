@@ -0,0 +1,70 @@
+/*
+ * probes.h -- static tracepoints for profiling live processes
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_PROBES_H
+#define PIRE_PROBES_H
+
+#include "defs.h"
+
+/*
+ * If PIRE_ENABLE_PROBES is defined (./configure --enable-probes),
+ * Pire places SystemTap-compatible (USDT) probes of provider `pire'
+ * into its compile, glue and load paths:
+ *
+ *   determine_begin(states, maxSize), determine_end(states, succeeded)
+ *   minimize_begin(states),           minimize_end(states)
+ *   compile_begin(fsmStates),         compile_end(scannerStates)
+ *   glue_begin(lhsStates, rhsStates), glue_end(states)
+ *   load(scannerType, states, bytes), mmap(scannerType, states, bytes)
+ *
+ * load() reports the size of the tables read from the stream, mmap()
+ * the size of the mapped image. GlueToStream() reports zero states
+ * in glue_end() if it gives up.
+ *
+ * PIRE_ENABLE_RUN_PROBES (./configure --enable-run-probes) additionally adds
+ * run_begin(scanner, bytes) and run_end(scanner, bytes) to each Run() call.
+ *
+ * Each probe compiles to a single nop which perf or bpftrace patch
+ * when attached (e.g. `bpftrace -e "usdt:./a.out:pire:glue_end { ... }"`).
+ * Without the defines, probes expand to nothing and their arguments
+ * are not evaluated.
+ */
+
+#ifdef PIRE_ENABLE_PROBES
+#	include <sys/sdt.h>
+#	define PIRE_PROBE1(name, a)       DTRACE_PROBE1(pire, name, a)
+#	define PIRE_PROBE2(name, a, b)    DTRACE_PROBE2(pire, name, a, b)
+#	define PIRE_PROBE3(name, a, b, c) DTRACE_PROBE3(pire, name, a, b, c)
+#else
+#	define PIRE_PROBE1(name, a)
+#	define PIRE_PROBE2(name, a, b)
+#	define PIRE_PROBE3(name, a, b, c)
+#endif
+
+#if defined(PIRE_ENABLE_PROBES) && defined(PIRE_ENABLE_RUN_PROBES)
+#	define PIRE_RUN_PROBE2(name, a, b) PIRE_PROBE2(name, a, b)
+#else
+#	define PIRE_RUN_PROBE2(name, a, b)
+#endif
+
+#endif
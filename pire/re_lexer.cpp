@@ -26,6 +26,9 @@
 #include "stub/singleton.h"
 #include <stdexcept>
 #include "re_lexer.h"
+
+namespace Pire { namespace Impl { class ParserArena; } }
+// The generated parser header declares yyparse() as taking a ParserArena
 #include "re_parser.h"
 #include "read_unicode.h"
 #include "fsm.h"
@@ -182,7 +185,7 @@ Term Lexer::Lex()
 		type = '$';
 	else if (type == TokenTypes::End)
 		type = 0;
-	return Term(type, t.Value());
+	return Term(type, std::move(t.Value()));
 }
 
 void Lexer::Parenthesized(Fsm& fsm)
@@ -191,6 +194,14 @@ void Lexer::Parenthesized(Fsm& fsm)
 		(*i)->Parenthesized(fsm);
 }
 
+bool Lexer::HooksParenthesized() const
+{
+	for (auto&& feature : m_features)
+		if (feature->HooksParenthesized())
+			return true;
+	return false;
+}
+
 wchar32 Feature::CorrectChar(wchar32 c, const char* controls)
 {
 	bool ctrl = (strchr(controls, c & 0xFF) != 0);
@@ -285,6 +296,7 @@ namespace {
 
 	class RepetitionCountReader: public Feature {
 	public:
+		bool HooksParenthesized() const { return false; }
 		bool Accepts(wchar32 c) const { return c == '{' || c == (Control | '{') || c == (Control | '}'); }
 
 		Term Lex()
@@ -321,6 +333,7 @@ namespace {
 
 	class CaseInsensitiveImpl: public Feature {
 	public:
+		bool HooksParenthesized() const { return false; }
 		void Alter(Term& t)
 		{
 			if (t.Value().IsA<Term::CharacterRange>()) {
@@ -340,6 +353,7 @@ namespace {
 	};
 	class AndNotSupportImpl: public Feature {
 	public:
+		bool HooksParenthesized() const { return false; }
 		bool Accepts(wchar32 c) const
 		{
 			return c == '&' || c == '~' || c == (Control | '&') || c == (Control | '~');
@@ -378,9 +392,11 @@ void Lexer::InstallDefaultFeatures()
 
 Fsm Lexer::Parse()
 {
-	if (!Impl::yre_parse(*this))
-		return m_retval.As<Fsm>();
-	else {
+	if (!Impl::yre_parse(*this)) {
+		Fsm ret;
+		ret.Swap(m_retval.As<Fsm>());
+		return ret;
+	} else {
 		Error("Syntax error in regexp");
 		return Fsm(); // Make compiler happy
 	}
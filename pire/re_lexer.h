@@ -86,6 +86,7 @@ public:
 	Term(int type): m_type(type) {}
 	template<class T> Term(int type, T t): m_type(type), m_value(t) {}
 	Term(int type, const Any& value): m_type(type), m_value(value) {}
+	Term(int type, Any&& value): m_type(type), m_value(std::move(value)) {}
 
 	static Term Character(wchar32 c);
 	static Term Repetition(int lower, int upper);
@@ -95,6 +96,7 @@ public:
 
 	int Type() const  { return m_type; }
 	const Any& Value() const { return m_value; }
+	Any& Value() { return m_value; }
 private:
 	int m_type;
 	Any m_value;
@@ -110,16 +112,19 @@ public:
 	// One-size-fits-all constructor set.
 	Lexer()
 		: m_encoding(&Encodings::Latin1())
+		, m_shareSubexpressions(false)
 	{ InstallDefaultFeatures(); }
 
 	explicit Lexer(const char* str)
 		: m_encoding(&Encodings::Latin1())
+		, m_shareSubexpressions(false)
 	{
 		InstallDefaultFeatures();
 		Assign(str, str + strlen(str));
 	}
 	template<class T> explicit Lexer(const T& t)
 		: m_encoding(&Encodings::Latin1())
+		, m_shareSubexpressions(false)
 	{
 		InstallDefaultFeatures();
 		Assign(t.begin(), t.end());
@@ -127,6 +132,7 @@ public:
 
 	template<class Iter> Lexer(Iter begin, Iter end)
 		: m_encoding(&Encodings::Latin1())
+		, m_shareSubexpressions(false)
 	{
 		InstallDefaultFeatures();
 		Assign(begin, end);
@@ -156,7 +162,15 @@ public:
 
 	Fsm Parse();
 
+	/// Makes Parse() build each distinct subexpression only once and copy it
+	/// wherever it repeats. Pays off for patterns with many repeated parts;
+	/// has no effect if any installed feature hooks parenthesized subexpressions.
+	Lexer& SetSubexpressionSharing(bool share = true) { m_shareSubexpressions = share; return *this; }
+	bool SubexpressionSharing() const { return m_shareSubexpressions; }
+
 	void Parenthesized(Fsm& fsm);
+	/// Whether any of installed features alters parenthesized subexpressions
+	bool HooksParenthesized() const;
 
 private:
 	Term DoLex();
@@ -174,6 +188,7 @@ private:
 	TVector<std::unique_ptr<Feature>> m_features;
 	Any m_retval;
 	ystring m_errmsg;
+	bool m_shareSubexpressions;
 
 	friend class Feature;
 
@@ -206,6 +221,10 @@ public:
 	/// has a chance to hack it somehow if it wants (its the way to implement
 	/// those perl-style (?@#$%:..) clauses).
 	virtual void Parenthesized(Fsm&) {}
+	/// Features not overriding Parenthesized() may return false here, telling
+	/// the parser that the FSM of a subexpression depends on the subexpression
+	/// only, so repeated ones can be built only once (see Lexer::SetSubexpressionSharing()).
+	virtual bool HooksParenthesized() const { return true; }
 
 	using Ptr = std::unique_ptr<Feature>;
 
@@ -35,37 +35,203 @@
 #endif
 
 #include <stdexcept>
+#include <tuple>
 
 #include "fsm.h"
 #include "re_lexer.h"
 #include "any.h"
 #include "stub/stl.h"
 
-#define YYSTYPE Any*
-#define YYSTYPE_IS_TRIVIAL 0
+namespace Pire {
+namespace Impl {
+
+	enum ExpressionKind {
+		ExprEmpty,
+		ExprLetters,
+		ExprDot,
+		ExprBegin,
+		ExprEnd,
+		ExprConcatenation,
+		ExprAlternative,
+		ExprConjunction,
+		ExprNegation,
+		ExprRepetition
+	};
+
+	/**
+	 * Parsed subexpressions, each distinct one stored only once,
+	 * so a subexpression repeated throughout a pattern is built only once
+	 * and then copied. Nodes are numbered in order of creation,
+	 * hence operands always precede expressions using them.
+	 */
+	class ExpressionDag {
+	public:
+		static const size_t None = static_cast<size_t>(-1);
+
+		struct Node {
+			ExpressionKind kind;
+			size_t lhs;
+			size_t rhs;
+			int lower;                            ///< Repetition count
+			int upper;
+			const Term::CharacterRange* letters;
+			size_t uses;                          ///< Number of references from other nodes
+		};
+
+		size_t Leaf(const Term& term)
+		{
+			const Any& value = term.Value();
+			if (value.IsA<Term::DotTag>())
+				return Intern(ExprDot);
+			else if (value.IsA<Term::BeginTag>())
+				return Intern(ExprBegin);
+			else if (value.IsA<Term::EndTag>())
+				return Intern(ExprEnd);
+
+			auto ins = m_letters.insert(ymake_pair(value.As<Term::CharacterRange>(), m_nodes.size()));
+			if (ins.second) {
+				Node node = { ExprLetters, None, None, 0, 0, &ins.first->first, 0 };
+				m_nodes.push_back(node);
+			}
+			return ins.first->second;
+		}
+
+		size_t Intern(ExpressionKind kind, size_t lhs = None, size_t rhs = None, int lower = 0, int upper = 0)
+		{
+			auto ins = m_index.insert(ymake_pair(Key(kind, lhs, rhs, lower, upper), m_nodes.size()));
+			if (ins.second) {
+				Node node = { kind, lhs, rhs, lower, upper, nullptr, 0 };
+				m_nodes.push_back(node);
+				if (lhs != None)
+					++m_nodes[lhs].uses;
+				if (rhs != None)
+					++m_nodes[rhs].uses;
+			}
+			return ins.first->second;
+		}
+
+		size_t Size() const { return m_nodes.size(); }
+		const Node& operator[](size_t i) const { return m_nodes[i]; }
+
+	private:
+		typedef std::tuple<int, size_t, size_t, int, int> Key;
+
+		TVector<Node> m_nodes;
+		TMap<Key, size_t> m_index;
+		TMap<Term::CharacterRange, size_t> m_letters;
+	};
+
+	const size_t ExpressionDag::None;
+
+	/// A semantic value of the parser: either a terminal produced
+	/// by the lexer or an FSM built from terminals (or, if subexpressions
+	/// are shared, its node in ExpressionDag).
+	struct ParserValue {
+		Term term;
+		Fsm fsm;
+		bool isFsm;
+		bool isEmpty; ///< An empty concatenation whose FSM has not been built yet
+		size_t node;
+
+		ParserValue(): term(0), isFsm(false), isEmpty(false), node(ExpressionDag::None) {}
+	};
+
+	/// Owns all semantic values of a single parse. Values are recycled
+	/// as soon as the parser is done with them, so the number of allocations
+	/// is bounded by the number of values alive simultaneously rather
+	/// than by the length of the pattern.
+	class ParserArena {
+	public:
+		/// Subexpressions are only shared if asked for (see Lexer::SetSubexpressionSharing())
+		/// and if building them does not depend on the parse order (see Feature::HooksParenthesized())
+		explicit ParserArena(bool shareSubexpressions): m_share(shareSubexpressions) {}
+
+		bool SharesSubexpressions() const { return m_share; }
+		const ExpressionDag& Dag() const { return m_dag; }
+		ExpressionDag& Dag() { return m_dag; }
+
+		size_t NodeOf(ParserValue* v)
+		{
+			if (v->node == ExpressionDag::None)
+				v->node = m_dag.Leaf(v->term);
+			return v->node;
+		}
+
+		ParserValue* Acquire()
+		{
+			if (m_free.empty()) {
+				m_values.emplace_back(new ParserValue);
+				m_free.push_back(m_values.back().get());
+			}
+			ParserValue* v = m_free.back();
+			m_free.pop_back();
+			v->isFsm = false;
+			v->isEmpty = false;
+			v->node = ExpressionDag::None;
+			return v;
+		}
+
+		/// An empty concatenation. Its FSM is only built if needed:
+		/// usually the first item of the concatenation replaces it.
+		ParserValue* AcquireFsm()
+		{
+			ParserValue* v = Acquire();
+			if (m_share)
+				v->node = m_dag.Intern(ExprEmpty);
+			else
+				v->isEmpty = true;
+			return v;
+		}
+
+		void Release(ParserValue* v)
+		{
+			if (v)
+				m_free.push_back(v);
+		}
+
+	private:
+		TVector<std::unique_ptr<ParserValue>> m_values;
+		TVector<ParserValue*> m_free;
+		bool m_share;
+		ExpressionDag m_dag;
+	};
+}
+}
+
+#define YYSTYPE Pire::Impl::ParserValue*
+#define YYSTYPE_IS_TRIVIAL 1
 
 namespace {
 
 using namespace Pire;
 using Pire::Fsm;
 using Pire::Encoding;
+using Pire::Impl::ParserArena;
+using Pire::Impl::ParserValue;
+using Pire::Impl::ExpressionDag;
 
-int  yylex(YYSTYPE*, Lexer&);
+int  yylex(YYSTYPE*, Lexer&, ParserArena&);
 void yyerror(const char*);
-void yyerror(Pire::Lexer&, const char*);
+void yyerror(Pire::Lexer&, ParserArena&, const char*);
 
-Fsm& ConvertToFSM(const Encoding& encoding, Any* any);
+Fsm& ConvertToFSM(const Encoding& encoding, ParserValue* value);
 void AppendRange(const Encoding& encoding, Fsm& a, const Term::CharacterRange& cr);
+ParserValue* Combine(Pire::Lexer& rlex, ParserArena& arena, Pire::Impl::ExpressionKind kind, ParserValue* a, ParserValue* b);
+ParserValue* Negate(Pire::Lexer& rlex, ParserArena& arena, ParserValue* a);
+ParserValue* Repeat(Pire::Lexer& rlex, ParserArena& arena, ParserValue* a, const Term::RepetitionCount& repc);
+Fsm Build(const Encoding& encoding, const ExpressionDag& dag, size_t root);
 
 #ifdef YYBYACC
-#define YYPARSE_PARAM ,Pire::Lexer& rlex /* Yes, the leading comma is really needed here */
-#define YYLEX_PARAM rlex
+#define YYPARSE_PARAM ,Pire::Lexer& rlex, ParserArena& arena /* Yes, the leading comma is really needed here */
+#define YYLEX_PARAM rlex, arena
 #endif
 
 %}
 
 %lex-param {Pire::Lexer& rlex}
+%lex-param {Pire::Impl::ParserArena& arena}
 %parse-param {Pire::Lexer& rlex}
+%parse-param {Pire::Impl::ParserArena& arena}
 %pure_parser
 
 // Terminal declarations
@@ -75,79 +241,48 @@ void AppendRange(const Encoding& encoding, Fsm& a, const Term::CharacterRange& c
 %term YRE_AND
 %term YRE_NOT
 
-%destructor { delete $$; } <>
+%destructor { arena.Release($$); } <>
 
 %%
 
 regexp
 	: alternative
 		{
-			ConvertToFSM(rlex.Encoding(), $1);
-			DoSwap(rlex.Retval(), *$1);
-			delete $1;
+			Any ret = Fsm();
+			if (arena.SharesSubexpressions()) {
+				Fsm fsm = Build(rlex.Encoding(), arena.Dag(), arena.NodeOf($1));
+				ret.As<Fsm>().Swap(fsm);
+			} else
+				ret.As<Fsm>().Swap(ConvertToFSM(rlex.Encoding(), $1));
+			rlex.Retval().Swap(ret);
+			arena.Release($1);
 			$$ = nullptr;
 		}
 	;
 
 alternative
 	: conjunction
-	| alternative '|' conjunction { ConvertToFSM(rlex.Encoding(), ($$ = $1)) |= ConvertToFSM(rlex.Encoding(), $3); delete $2; delete $3; }
+	| alternative '|' conjunction { $$ = Combine(rlex, arena, Pire::Impl::ExprAlternative, $1, $3); arena.Release($2); }
 	;
 
 conjunction
 	: negation
-	| conjunction YRE_AND negation { ConvertToFSM(rlex.Encoding(), ($$ = $1)) &= ConvertToFSM(rlex.Encoding(), $3); delete $2; delete $3; }
+	| conjunction YRE_AND negation { $$ = Combine(rlex, arena, Pire::Impl::ExprConjunction, $1, $3); arena.Release($2); }
 	;
 
 negation
 	: concatenation
-	| YRE_NOT concatenation { ConvertToFSM(rlex.Encoding(), ($$ = $2)).Complement(); delete $1; }
+	| YRE_NOT concatenation { $$ = Negate(rlex, arena, $2); arena.Release($1); }
 	;
 
 concatenation
-	: { $$ = new Any(Fsm()); }
-	| concatenation iteration
-		{
-			Fsm& a = ConvertToFSM(rlex.Encoding(), ($$ = $1));
-			if ($2->IsA<Term::CharacterRange>() && !$2->As<Term::CharacterRange>().second)
-				AppendRange(rlex.Encoding(), a, $2->As<Term::CharacterRange>());
-			else if ($2->IsA<Term::DotTag>())
-				rlex.Encoding().AppendDot(a);
-			else
-				a += ConvertToFSM(rlex.Encoding(), $2);
-			delete $2;
-		}
+	: { $$ = arena.AcquireFsm(); }
+	| concatenation iteration { $$ = Combine(rlex, arena, Pire::Impl::ExprConcatenation, $1, $2); }
 	;
 
 iteration
 	: term
-	| term YRE_COUNT
-		{
-			Fsm& orig = ConvertToFSM(rlex.Encoding(), $1);
-			$$ = new Any(orig);
-			Fsm& cur = $$->As<Fsm>();
-			const Term::RepetitionCount& repc = $2->As<Term::RepetitionCount>();
-
-
-			if (repc.first == 0 && repc.second == 1) {
-				Fsm empty;
-				cur |= empty;
-			} else if (repc.first == 0 && repc.second == Inf) {
-				cur.Iterate();
-			} else if (repc.first == 1 && repc.second == Inf) {
-				cur += *cur;
-			} else {
-				cur *= repc.first;
-				if (repc.second == Inf) {
-					cur += *orig;
-				} else if (repc.second != repc.first) {
-					cur += (orig | Fsm()) * (repc.second - repc.first);
-				}
-			}
-			rlex.Parenthesized($$->As<Fsm>());
-			delete $1;
-			delete $2;
-		}
+	| term YRE_COUNT { $$ = Repeat(rlex, arena, $1, $2->term.Value().As<Term::RepetitionCount>()); arena.Release($2); }
 	;
 
 term
@@ -155,20 +290,29 @@ term
 	| YRE_DOT
 	| '^'
 	| '$'
-	| '(' alternative ')'      { $$ = $2; rlex.Parenthesized($$->As<Fsm>()); delete $1; delete $3; }
+	| '(' alternative ')'
+		{
+			$$ = $2;
+			if (!arena.SharesSubexpressions())
+				rlex.Parenthesized(ConvertToFSM(rlex.Encoding(), $$));
+			arena.Release($1);
+			arena.Release($3);
+		}
 	;
 
 %%
 
-int yylex(YYSTYPE* lval, Pire::Lexer& rlex)
+int yylex(YYSTYPE* lval, Pire::Lexer& rlex, ParserArena& arena)
 {
 	try {
 		Pire::Term term = rlex.Lex();
-		if (!term.Value().Empty())
-			*lval = new Any(term.Value());
-		else
+		int type = term.Type();
+		if (!term.Value().Empty()) {
+			*lval = arena.Acquire();
+			(*lval)->term = std::move(term);
+		} else
 			*lval = nullptr;
-		return term.Type();
+		return type;
 	} catch (Pire::Error &e) {
 		rlex.SetErrMsg(e.what());
 		return 0;
@@ -179,7 +323,7 @@ void yyerror(const char* str)
 {
 }
 
-void yyerror(Pire::Lexer& rlex, const char* str)
+void yyerror(Pire::Lexer& rlex, ParserArena&, const char* str)
 {
 	if (!rlex.ErrMsg().empty())
 		rlex.SetErrMsg(ystring("Regexp parse error: ").append(str));
@@ -212,50 +356,219 @@ void AppendRange(const Encoding& encoding, Fsm& a, const Term::CharacterRange& c
 		a.AppendStrings(strings);
 }
 
-Fsm& ConvertToFSM(const Encoding& encoding, Any* any)
+Fsm LettersToFSM(const Encoding& encoding, const Term::CharacterRange& cr)
 {
-	if (any->IsA<Fsm>())
-		return any->As<Fsm>();
+	Fsm a;
+	AppendRange(encoding, a, cr);
+	if (cr.second) {
+		Fsm x;
+		encoding.AppendDot(x);
+		x.Complement();
+		a |= x;
+		a.Complement();
+		a.RemoveDeadEnds();
+	}
+	return a;
+}
 
-	Any ret = Fsm();
-	Fsm& a = ret.As<Fsm>();
+Fsm& ConvertToFSM(const Encoding& encoding, ParserValue* value)
+{
+	if (value->isFsm)
+		return value->fsm;
 
-	if (any->IsA<Term::DotTag>()) {
+	Fsm a;
+	const Any& any = value->term.Value();
+
+	if (value->isEmpty) {
+		// An empty concatenation accepts the empty string, just like a fresh Fsm
+	} else if (any.IsA<Term::DotTag>()) {
 		encoding.AppendDot(a);
-	} else if (any->IsA<Term::BeginTag>()) {
+	} else if (any.IsA<Term::BeginTag>()) {
 		a.AppendSpecial(BeginMark);
-	} else if (any->IsA<Term::EndTag>()) {
+	} else if (any.IsA<Term::EndTag>()) {
 		a.AppendSpecial(EndMark);
 	} else {
-		Term::CharacterRange cr = any->As<Term::CharacterRange>();
-		AppendRange(encoding, a, cr);
-		if (cr.second) {
-			Fsm x;
-			encoding.AppendDot(x);
-			x.Complement();
-			a |= x;
-			a.Complement();
-			a.RemoveDeadEnds();
+		a = LettersToFSM(encoding, any.As<Term::CharacterRange>());
+	}
+	value->fsm.Swap(a);
+	value->isFsm = true;
+	value->isEmpty = false;
+	return value->fsm;
+}
+
+void RepeatFSM(Fsm& cur, const Term::RepetitionCount& repc)
+{
+	if (repc.first == 0 && repc.second == 1) {
+		Fsm empty;
+		cur |= empty;
+	} else if (repc.first == 0 && repc.second == Inf) {
+		cur.Iterate();
+	} else if (repc.first == 1 && repc.second == Inf) {
+		cur += *cur;
+	} else {
+		Fsm orig(cur);
+		cur *= repc.first;
+		if (repc.second == Inf) {
+			cur += *orig;
+		} else if (repc.second != repc.first) {
+			cur += (orig | Fsm()) * (repc.second - repc.first);
 		}
 	}
-	any->Swap(ret);
+}
+
+ParserValue* Combine(Pire::Lexer& rlex, ParserArena& arena, Pire::Impl::ExpressionKind kind, ParserValue* a, ParserValue* b)
+{
+	if (arena.SharesSubexpressions()) {
+		size_t lhs = arena.NodeOf(a);
+		a->node = arena.Dag().Intern(kind, lhs, arena.NodeOf(b));
+	} else if (kind == Pire::Impl::ExprConcatenation && a->isEmpty) {
+		// Nothing to concatenate with: the item itself becomes the concatenation
+		a->fsm.Swap(ConvertToFSM(rlex.Encoding(), b));
+		a->isFsm = true;
+		a->isEmpty = false;
+	} else {
+		Fsm& fsm = ConvertToFSM(rlex.Encoding(), a);
+		const Any& value = b->term.Value();
+		if (kind == Pire::Impl::ExprAlternative)
+			fsm |= ConvertToFSM(rlex.Encoding(), b);
+		else if (kind == Pire::Impl::ExprConjunction)
+			fsm &= ConvertToFSM(rlex.Encoding(), b);
+		else if (!b->isFsm && value.IsA<Term::CharacterRange>() && !value.As<Term::CharacterRange>().second)
+			AppendRange(rlex.Encoding(), fsm, value.As<Term::CharacterRange>());
+		else if (!b->isFsm && value.IsA<Term::DotTag>())
+			rlex.Encoding().AppendDot(fsm);
+		else
+			fsm += ConvertToFSM(rlex.Encoding(), b);
+	}
+	arena.Release(b);
+	return a;
+}
+
+ParserValue* Negate(Pire::Lexer& rlex, ParserArena& arena, ParserValue* a)
+{
+	if (arena.SharesSubexpressions())
+		a->node = arena.Dag().Intern(Pire::Impl::ExprNegation, arena.NodeOf(a));
+	else
+		ConvertToFSM(rlex.Encoding(), a).Complement();
+	return a;
+}
+
+ParserValue* Repeat(Pire::Lexer& rlex, ParserArena& arena, ParserValue* a, const Term::RepetitionCount& repc)
+{
+	if (arena.SharesSubexpressions())
+		a->node = arena.Dag().Intern(Pire::Impl::ExprRepetition, arena.NodeOf(a), ExpressionDag::None, repc.first, repc.second);
+	else {
+		Fsm& fsm = ConvertToFSM(rlex.Encoding(), a);
+		RepeatFSM(fsm, repc);
+		rlex.Parenthesized(fsm);
+	}
 	return a;
 }
 
+/// Builds the FSM of the @p root expression, building each of its distinct subexpressions only once
+Fsm Build(const Encoding& encoding, const ExpressionDag& dag, size_t root)
+{
+	// A node is built once all its operands are, and dropped after its last use
+	TVector<size_t> pending(dag.Size());
+	for (size_t i = 0; i != dag.Size(); ++i)
+		pending[i] = dag[i].uses;
+	++pending[root];
+	TVector<Fsm> built(root + 1);
+
+	// Letters and dots appended to a concatenation directly need no FSM of their own
+	auto appended = [&](size_t i) {
+		return (dag[i].kind == Pire::Impl::ExprLetters && !dag[i].letters->second) || dag[i].kind == Pire::Impl::ExprDot;
+	};
+	TVector<size_t> standalone(pending);
+	for (size_t i = 0; i <= root; ++i)
+		if (dag[i].kind == Pire::Impl::ExprConcatenation && appended(dag[i].rhs))
+			--standalone[dag[i].rhs];
+
+	auto take = [&](size_t i, Fsm& fsm) {
+		if (--pending[i])
+			fsm = built[i];
+		else
+			fsm.Swap(built[i]);
+	};
+	auto drop = [&](size_t i) {
+		if (!--pending[i])
+			Fsm().Swap(built[i]);
+	};
+
+	for (size_t i = 0; i <= root; ++i) {
+		if (!pending[i] || !standalone[i])
+			continue;
+		const ExpressionDag::Node& node = dag[i];
+		Fsm& fsm = built[i];
+		switch (node.kind) {
+		case Pire::Impl::ExprEmpty:
+			break;
+		case Pire::Impl::ExprLetters:
+			fsm = LettersToFSM(encoding, *node.letters);
+			break;
+		case Pire::Impl::ExprDot:
+			encoding.AppendDot(fsm);
+			break;
+		case Pire::Impl::ExprBegin:
+			fsm.AppendSpecial(BeginMark);
+			break;
+		case Pire::Impl::ExprEnd:
+			fsm.AppendSpecial(EndMark);
+			break;
+		case Pire::Impl::ExprConcatenation:
+			take(node.lhs, fsm);
+			if (!appended(node.rhs))
+				fsm += built[node.rhs];
+			else if (dag[node.rhs].kind == Pire::Impl::ExprLetters)
+				AppendRange(encoding, fsm, *dag[node.rhs].letters);
+			else
+				encoding.AppendDot(fsm);
+			drop(node.rhs);
+			break;
+		case Pire::Impl::ExprAlternative:
+			take(node.lhs, fsm);
+			fsm |= built[node.rhs];
+			drop(node.rhs);
+			break;
+		case Pire::Impl::ExprConjunction:
+			take(node.lhs, fsm);
+			fsm &= built[node.rhs];
+			drop(node.rhs);
+			break;
+		case Pire::Impl::ExprNegation:
+			take(node.lhs, fsm);
+			fsm.Complement();
+			break;
+		case Pire::Impl::ExprRepetition:
+			take(node.lhs, fsm);
+			RepeatFSM(fsm, Term::RepetitionCount(node.lower, node.upper));
+			break;
+		}
+	}
+	Fsm ret;
+	ret.Swap(built[root]);
+	return ret;
+}
+
 } // namespace
 
 #if defined(PPP) && !defined(HAVE_CONFIG_H)
 // Workaround for some braindamaged byaccs which cannot decide what yyparse() should look like 
-static int yyparse(void*, Pire::Lexer& rlex);
+static int yyparse(void*, Pire::Lexer& rlex, Pire::Impl::ParserArena& arena);
 
 namespace Pire {
 	namespace Impl {
 		int yre_parse(Pire::Lexer& rlex)
 		{
-			int rc = yyparse(0, rlex);
-
-			if (!rlex.ErrMsg().empty())
-				throw Error(rlex.ErrMsg());
+			ParserArena arena(rlex.SubexpressionSharing() && !rlex.HooksParenthesized());
+			int rc = yyparse(0, rlex, arena);
+
+			if (!rlex.ErrMsg().empty()) {
+				// Leave the lexer ready for the next pattern
+				ystring msg;
+				msg.swap(rlex.ErrMsg());
+				throw Error(msg);
+			}
 			return rc;
 		}
 	}
@@ -265,10 +578,15 @@ namespace Pire {
 	namespace Impl {
 		int yre_parse(Pire::Lexer& rlex)
 		{
-			int rc = yyparse(rlex);
-
-			if (!rlex.ErrMsg().empty())
-				throw Error(rlex.ErrMsg());
+			ParserArena arena(rlex.SubexpressionSharing() && !rlex.HooksParenthesized());
+			int rc = yyparse(rlex, arena);
+
+			if (!rlex.ErrMsg().empty()) {
+				// Leave the lexer ready for the next pattern
+				ystring msg;
+				msg.swap(rlex.ErrMsg());
+				throw Error(msg);
+			}
 			return rc;
 		}
 	}
@@ -30,6 +30,7 @@
 namespace Pire {
 	class UnicodeReader : public Feature {
 	public:
+		bool HooksParenthesized() const { return false; }
 		wchar32 ReadUnicodeCharacter();
 
 	private:
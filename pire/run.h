@@ -24,11 +24,13 @@
 #ifndef PIRE_RE_SCANNER_H
 #define PIRE_RE_SCANNER_H
 
+#include <chrono>
 #include "defs.h"
 #include "stub/stl.h"
 #include "stub/memstreams.h"
 #include "scanners/pair.h"
 #include "platform.h"
+#include "probes.h"
 
 namespace Pire {
 
@@ -271,7 +273,43 @@ namespace Impl {
 template<class Scanner>
 void Run(const Scanner& sc, typename Scanner::State& st, const char* begin, const char* end)
 {
+	PIRE_RUN_PROBE2(run_begin, &sc, end - begin);
 	Impl::DoRun(sc, st, begin, end, Impl::RunPred<Scanner>());
+	PIRE_RUN_PROBE2(run_end, &sc, end - begin);
+}
+
+/**
+ * Feeds a chunk of text to each of @p count flows, whose packed states
+ * (see Scanner::PackState()) are stored contiguously in @p states,
+ * Scanner::PackedStateSize() words per flow. Several flows are stepped
+ * in turn, so their memory accesses overlap instead of stalling one by one.
+ */
+template<class Scanner>
+void RunFlows(const Scanner& sc, ui32* states, const ypair<const char*, const char*>* chunks, size_t count)
+{
+	static const size_t Lanes = 4;
+	const size_t stride = sc.PackedStateSize();
+	typename Scanner::State st[Lanes];
+	const char* pos[Lanes];
+	const char* end[Lanes];
+	for (size_t first = 0; first < count; first += Lanes) {
+		const size_t lanes = ymin(Lanes, count - first);
+		for (size_t i = 0; i != lanes; ++i) {
+			sc.UnpackState(states + (first + i) * stride, st[i]);
+			pos[i] = chunks[first + i].first;
+			end[i] = chunks[first + i].second;
+		}
+		for (bool busy = true; busy;) {
+			busy = false;
+			for (size_t i = 0; i != lanes; ++i)
+				if (pos[i] != end[i]) {
+					Step(sc, st[i], static_cast<unsigned char>(*pos[i]++));
+					busy = true;
+				}
+		}
+		for (size_t i = 0; i != lanes; ++i)
+			sc.PackState(st[i], states + (first + i) * stride);
+	}
 }
 
 template<class Scanner>
@@ -391,6 +429,149 @@ RunHelper<Scanner> Runner(const Scanner& sc) { return RunHelper<Scanner>(sc); }
 template<class Scanner>
 RunHelper<Scanner> Runner(const Scanner& sc, typename Scanner::State st) { return RunHelper<Scanner>(sc, st); }
 
+/**
+ * A run which can be suspended and resumed, so that scanning a huge text
+ * does not block the calling thread (e.g. an event loop) for too long.
+ *
+ * Each call to Advance() scans a slice of the text with the usual Run()
+ * and returns. Slices end at word boundaries where possible, so each of them
+ * (except perhaps the first one) is scanned on the aligned fast path.
+ */
+template<class Scanner>
+class RunCursor {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	static const size_t DefaultSlice = 64 * 1024;
+
+	RunCursor(const Scanner& sc, typename Scanner::State st, const char* begin, const char* end)
+		: Sc(&sc), St(st), Pos(begin), End(end) {}
+	RunCursor(const Scanner& sc, const char* begin, const char* end)
+		: Sc(&sc), Pos(begin), End(end) { Sc->Initialize(St); }
+
+	bool Done() const { return Pos == End; }
+	const char* Position() const { return Pos; }
+	const typename Scanner::State& State() const { return St; }
+
+	/// Feeds a character to the scanner, e.g. BeginMark before the first slice or EndMark after the last one
+	RunCursor<Scanner>& Step(Char letter) { Pire::Step(*Sc, St, letter); return *this; }
+
+	/// Scans at most @p budget bytes, returning the number of bytes actually scanned
+	/// (so a zero budget scans nothing)
+	size_t Advance(size_t budget)
+	{
+		const char* stop = End;
+		if (static_cast<size_t>(End - Pos) > budget) {
+			stop = Pos + budget;
+			const char* aligned = reinterpret_cast<const char*>(reinterpret_cast<uintptr_t>(stop) & ~(sizeof(size_t) - 1));
+			if (aligned > Pos)
+				stop = aligned;
+		}
+		Pire::Run(*Sc, St, Pos, stop);
+		size_t scanned = stop - Pos;
+		Pos = stop;
+		return scanned;
+	}
+
+	/**
+	 * Scans slices of @p slice bytes until either the text ends or @p deadline
+	 * passes (at least one slice is scanned anyway). Returns true if the text has ended.
+	 * A zero slice stands for DefaultSlice.
+	 */
+	bool AdvanceUntil(Clock::time_point deadline, size_t slice = DefaultSlice)
+	{
+		if (!slice)
+			slice = DefaultSlice;
+		do
+			Advance(slice);
+		while (!Done() && Clock::now() < deadline);
+		return Done();
+	}
+
+	/// Scans the rest of the text, calling @p yield() between slices of @p slice bytes
+	/// (DefaultSlice if zero)
+	template<class Yield>
+	void Run(size_t slice, Yield yield)
+	{
+		if (!slice)
+			slice = DefaultSlice;
+		for (Advance(slice); !Done(); Advance(slice))
+			yield();
+	}
+
+private:
+	const Scanner* Sc;
+	typename Scanner::State St;
+	const char* Pos;
+	const char* End;
+};
+
+template<class Scanner>
+const size_t RunCursor<Scanner>::DefaultSlice;
+
+
+/// Tiles small enough for a tile and the scanners' hot rows to stay in L2 cache
+const size_t DefaultTileSize = 64 * 1024;
+
+namespace Impl {
+	inline void RunTile(const char*, const char*) {}
+
+	template<class Runner, class... Runners>
+	inline void RunTile(const char* begin, const char* end, Runner& runner, Runners&... runners)
+	{
+		runner.Run(begin, end);
+		RunTile(begin, end, runners...);
+	}
+
+	/// Cuts a tile of about @p tileSize bytes, ending at a cache line boundary where possible
+	inline const char* TileEnd(const char* begin, const char* end, size_t tileSize)
+	{
+		if (static_cast<size_t>(end - begin) <= tileSize)
+			return end;
+		const char* stop = reinterpret_cast<const char*>(reinterpret_cast<uintptr_t>(begin + tileSize) & ~static_cast<uintptr_t>(63));
+		return stop > begin ? stop : begin + tileSize;
+	}
+}
+
+/**
+ * Runs a number of scanners over the same text, one tile at a time:
+ * each scanner scans a tile with the usual Run() before the next tile
+ * is touched. So a big text is fetched from memory once rather than once
+ * per scanner, while each scanner still runs its own inlined loop
+ * (unlike ScannerPair, which steps both scanners on each byte).
+ * Tiles end at cache line boundaries, so all of them but the first
+ * are scanned on the aligned fast path.
+ *
+ * Usage:
+ *   auto r1 = Runner(sc1).Begin();
+ *   auto r2 = Runner(sc2).Begin();
+ *   RunTiled(begin, end, DefaultTileSize, r1, r2);
+ *   if (r1.End()) ...
+ */
+template<class... Runners>
+void RunTiled(const char* begin, const char* end, size_t tileSize, Runners&... runners)
+{
+	Y_ASSERT(tileSize);
+	while (begin != end) {
+		const char* stop = Impl::TileEnd(begin, end, tileSize);
+		Impl::RunTile(begin, stop, runners...);
+		begin = stop;
+	}
+}
+
+/// The same for a range of runners (e.g. a vector of RunHelper's)
+template<class Iter>
+void RunTiledRange(const char* begin, const char* end, size_t tileSize, Iter first, Iter last)
+{
+	Y_ASSERT(tileSize);
+	while (begin != end) {
+		const char* stop = Impl::TileEnd(begin, end, tileSize);
+		for (Iter runner = first; runner != last; ++runner)
+			runner->Run(begin, stop);
+		begin = stop;
+	}
+}
+
 
 /// Provided for testing purposes and convinience
 template<class Scanner>
@@ -0,0 +1,125 @@
+/*
+ * scan_pool.cpp -- scanning documents on a pool of worker threads
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#include "scan_pool.h"
+
+namespace Pire {
+
+namespace {
+	// The pool and the worker the current thread belongs to, if any
+	thread_local const ScanPool* g_currentPool = 0;
+	thread_local size_t g_currentWorker = 0;
+}
+
+const size_t ScanPool::DefaultChunkSize;
+
+ScanPool::ScanPool(size_t threads, size_t chunkSize)
+	: m_chunkSize(chunkSize ? chunkSize : DefaultChunkSize)
+	, m_next(0)
+	, m_queued(0)
+	, m_idle(0)
+	, m_stop(false)
+{
+	if (!threads)
+		threads = ymax<size_t>(std::thread::hardware_concurrency(), 1);
+	m_workers.resize(threads);
+	for (auto&& worker : m_workers)
+		worker.reset(new Worker);
+	for (size_t i = 0; i != threads; ++i)
+		m_workers[i]->thread = std::thread([this, i]() { Work(i); });
+}
+
+ScanPool::~ScanPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(m_sleepLock);
+		m_stop = true;
+	}
+	m_wakeup.notify_all();
+	for (auto&& worker : m_workers)
+		worker->thread.join();
+}
+
+void ScanPool::Push(Task task)
+{
+	size_t idx = (g_currentPool == this)
+		? g_currentWorker
+		: m_next.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+	Worker& worker = *m_workers[idx];
+	{
+		// Count the task before anyone can pop it, so that m_queued never wraps around
+		std::lock_guard<std::mutex> guard(worker.lock);
+		++m_queued;
+		worker.tasks.push_back(std::move(task));
+	}
+	{
+		// A worker which has just seen no queued tasks gets to wait before we notify it
+		std::lock_guard<std::mutex> guard(m_sleepLock);
+	}
+	m_wakeup.notify_one();
+}
+
+bool ScanPool::Pop(size_t self, Task& task)
+{
+	// Own tasks are taken from the back (the most recently pushed, likely still in cache),
+	// stolen ones from the front (the oldest, usually the biggest pieces of work).
+	for (size_t i = 0; i != m_workers.size(); ++i) {
+		Worker& worker = *m_workers[(self + i) % m_workers.size()];
+		std::lock_guard<std::mutex> guard(worker.lock);
+		if (worker.tasks.empty())
+			continue;
+		if (i == 0) {
+			task = std::move(worker.tasks.back());
+			worker.tasks.pop_back();
+		} else {
+			task = std::move(worker.tasks.front());
+			worker.tasks.pop_front();
+		}
+		--m_queued;
+		return true;
+	}
+	return false;
+}
+
+void ScanPool::Work(size_t self)
+{
+	g_currentPool = this;
+	g_currentWorker = self;
+	Task task;
+	for (;;) {
+		if (Pop(self, task)) {
+			task();
+			task = Task();
+			continue;
+		}
+		// Queued tasks might be in the middle of being pushed or popped; retry then
+		std::unique_lock<std::mutex> guard(m_sleepLock);
+		++m_idle;
+		m_wakeup.wait(guard, [this]() { return m_queued.load() || m_stop; });
+		--m_idle;
+		if (m_stop && !m_queued.load())
+			return;
+	}
+}
+
+}
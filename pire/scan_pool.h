@@ -0,0 +1,219 @@
+/*
+ * scan_pool.h -- scanning documents on a pool of worker threads
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_SCAN_POOL_H
+#define PIRE_SCAN_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include "defs.h"
+#include "run.h"
+#include "incremental.h"
+#include "stub/stl.h"
+#include "stub/noncopyable.h"
+
+namespace Pire {
+
+namespace Impl {
+	/// Whether a scanner can scan chunks of a text independently (see ScanTransfer())
+	template<class Scanner, class = void>
+	struct CanScanChunks: public std::false_type {};
+
+	template<class Scanner>
+	struct CanScanChunks<Scanner, decltype(
+		void(std::declval<const Scanner&>().IndexToState(0)),
+		void(std::declval<const Scanner&>().StateIndex(std::declval<typename Scanner::State>())))
+	>: public std::true_type {};
+}
+
+/**
+ * A pool of worker threads scanning documents.
+ *
+ * Each job is a (scanner, document) pair; the result of a job is the state
+ * the scanner ends up in after the document surrounded with BeginMark and
+ * EndMark (exactly what Pire::Runner(sc).Begin().Run(text).End().State()
+ * would return), delivered either to a callback or through a future.
+ * Scanning a document with a number of scanners is a number of jobs
+ * sharing the document.
+ *
+ * Each worker has its own deque of tasks; idle workers steal tasks from
+ * the others, so a few huge documents do not leave the rest of the pool idle.
+ *
+ * Documents longer than twice the chunk size are scanned chunk by chunk,
+ * and once some worker runs out of tasks, the rest of the document is split
+ * into chunk tasks, provided the scanner can compute transfer functions
+ * of chunks (Pire::Scanner and SimpleScanner can). The chunks are scanned
+ * independently and their results are composed when the last chunk is done.
+ * Splitting costs extra work: a chunk is scanned once per distinct state
+ * which runs from all possible initial states do not converge to
+ * (see IncrementalRunner), e.g. once per combination of already matched
+ * regexps for a glued scanner of surrounded regexps. That is why documents
+ * are only split when there are idle workers, and the chunk size
+ * is increased for scanners with many states.
+ *
+ * Scanners and documents must stay alive until their jobs are done.
+ * Callbacks are called on worker threads and must not throw.
+ * The destructor waits for all submitted jobs to finish.
+ */
+class ScanPool: private NonCopyable {
+public:
+	static const size_t DefaultChunkSize = 1 << 20;
+
+	/// Creates a pool of @p threads workers (one per core if zero)
+	explicit ScanPool(size_t threads = 0, size_t chunkSize = DefaultChunkSize);
+	~ScanPool();
+
+	size_t ThreadsCount() const { return m_workers.size(); }
+	size_t ChunkSize() const { return m_chunkSize; }
+
+	/// Scans the text, passing the resulting state to @p callback
+	template<class Scanner, class Callback>
+	void Scan(const Scanner& sc, const char* begin, const char* end, Callback callback)
+	{
+		Push([this, &sc, begin, end, callback]() mutable {
+			this->Run(sc, begin, end, callback, Impl::CanScanChunks<Scanner>());
+		});
+	}
+
+	/// Scans the text, returning the future resulting state
+	template<class Scanner>
+	std::future<typename Scanner::State> Scan(const Scanner& sc, const char* begin, const char* end)
+	{
+		typedef typename Scanner::State State;
+		std::shared_ptr< std::promise<State> > promise(new std::promise<State>);
+		std::future<State> future = promise->get_future();
+		Scan(sc, begin, end, [promise](const State& st) { promise->set_value(st); });
+		return future;
+	}
+
+	template<class Scanner>
+	std::future<typename Scanner::State> Scan(const Scanner& sc, const ystring& text)
+	{
+		return Scan(sc, text.c_str(), text.c_str() + text.size());
+	}
+
+private:
+	typedef std::function<void()> Task;
+
+	struct Worker {
+		std::mutex lock;
+		std::deque<Task> tasks;
+		std::thread thread;
+	};
+
+	size_t m_chunkSize;
+	TVector< std::unique_ptr<Worker> > m_workers;
+	std::atomic<size_t> m_next;
+
+	// Idle workers sleep until m_queued becomes positive.
+	// It only changes under the lock of the worker owning the task, so it never
+	// drops below the number of tasks in the deques.
+	std::mutex m_sleepLock;
+	std::condition_variable m_wakeup;
+	std::atomic<size_t> m_queued;
+	std::atomic<size_t> m_idle;
+	bool m_stop;
+
+	/// Queues a task, to the current worker's deque if called from a worker
+	void Push(Task task);
+	bool Pop(size_t self, Task& task);
+	void Work(size_t self);
+
+	template<class Scanner, class Callback>
+	void Run(const Scanner& sc, const char* begin, const char* end, Callback& callback, std::false_type)
+	{
+		callback(Runner(sc).Begin().Run(begin, end).End().State());
+	}
+
+	template<class Scanner, class Callback>
+	struct ChunkedJob {
+		const Scanner* sc;
+		Callback callback;
+		size_t start;
+		TVector< TVector<ui32> > transfers;
+		std::atomic<size_t> left;
+
+		ChunkedJob(const Scanner& s, const Callback& cb, size_t st, size_t chunks)
+			: sc(&s), callback(cb), start(st), transfers(chunks), left(chunks) {}
+
+		void Finish()
+		{
+			size_t idx = start;
+			for (auto&& transfer : transfers)
+				if (!transfer.empty())
+					idx = transfer[idx];
+			typename Scanner::State st = sc->IndexToState(idx);
+			Pire::Step(*sc, st, EndMark);
+			callback(st);
+		}
+	};
+
+	template<class Scanner, class Callback>
+	void Run(const Scanner& sc, const char* begin, const char* end, Callback& callback, std::true_type)
+	{
+		// The first merge interval runs the scanner from each of its states
+		size_t chunkSize = ymax(m_chunkSize, 4 * Impl::TransferMergeInterval * sc.Size());
+
+		typename Scanner::State st;
+		sc.Initialize(st);
+		Pire::Step(sc, st, BeginMark);
+		for (; static_cast<size_t>(end - begin) > 2 * chunkSize; begin += chunkSize) {
+			if (m_idle.load(std::memory_order_relaxed)) {
+				Split(sc, st, begin, end, chunkSize, callback);
+				return;
+			}
+			Pire::Run(sc, st, begin, begin + chunkSize);
+		}
+		Pire::Run(sc, st, begin, end);
+		Pire::Step(sc, st, EndMark);
+		callback(st);
+	}
+
+	/// Queues chunks of the rest of the text, which the scanner enters in state @p st
+	template<class Scanner, class Callback>
+	void Split(const Scanner& sc, typename Scanner::State st, const char* begin, const char* end, size_t chunkSize, Callback& callback)
+	{
+		typedef ChunkedJob<Scanner, Callback> Job;
+		size_t chunks = (end - begin + chunkSize - 1) / chunkSize;
+		std::shared_ptr<Job> job(new Job(sc, callback, sc.StateIndex(st), chunks));
+		for (size_t i = 0; i != chunks; ++i) {
+			const char* b = begin + i * chunkSize;
+			const char* e = ymin(b + chunkSize, end);
+			Push([job, i, b, e]() {
+				job->transfers[i] = Impl::ScanTransfer(*job->sc, b, e);
+				if (job->left.fetch_sub(1, std::memory_order_acq_rel) == 1)
+					job->Finish();
+			});
+		}
+	}
+};
+
+}
+
+#endif
@@ -27,7 +27,9 @@
 #include "scanners/slow.h"
 #include "scanners/simple.h"
 #include "scanners/loaded.h"
+#include "scanners/comb.h"
 #include "align.h"
+#include "probes.h"
 #include "scanners/loaded.h"
 
 namespace Pire {
@@ -60,12 +62,45 @@ void SimpleScanner::Load(yistream* s)
 	if (empty) {
 		sc.Alias(Null());
 	} else {
-		sc.m_buffer = BufferType(new char[sc.BufSize()]);
+		sc.m_buffer = BufferType(sc.BufSize());
 		Impl::AlignedLoadArray(s, sc.m_buffer.get(), sc.BufSize());
 		sc.Markup(sc.m_buffer.get());
 		sc.m.initial += reinterpret_cast<size_t>(sc.m_transitions);
 	}
 	Swap(sc);
+	PIRE_PROBE3(load, ScannerIOTypes::SimpleScanner, Size(), Empty() ? 0 : BufSize());
+}
+
+void CombScanner::Save(yostream* s) const
+{
+	SavePodType(s, Header(ScannerIOTypes::CombScanner, sizeof(m)));
+	Impl::AlignSave(s, sizeof(Header));
+	SavePodType(s, m);
+	Impl::AlignSave(s, sizeof(m));
+	SavePodType(s, Empty());
+	Impl::AlignSave(s, sizeof(Empty()));
+	if (!Empty())
+		Impl::AlignedSaveArray(s, reinterpret_cast<const char*>(m_letters), BufSize());
+}
+
+void CombScanner::Load(yistream* s)
+{
+	CombScanner sc;
+	Impl::ValidateHeader(s, ScannerIOTypes::CombScanner, sizeof(sc.m));
+	LoadPodType(s, sc.m);
+	Impl::AlignLoad(s, sizeof(sc.m));
+	bool empty;
+	LoadPodType(s, empty);
+	Impl::AlignLoad(s, sizeof(empty));
+	if (empty) {
+		sc.Alias(Null());
+	} else {
+		sc.m_buffer = BufferType(sc.BufSize() + sizeof(size_t));
+		sc.Markup(Impl::AlignUp(sc.m_buffer.get(), sizeof(size_t)));
+		Impl::AlignedLoadArray(s, reinterpret_cast<char*>(sc.m_letters), sc.BufSize());
+	}
+	Swap(sc);
+	PIRE_PROBE3(load, ScannerIOTypes::CombScanner, Size(), Empty() ? 0 : BufSize());
 }
 
 void SlowScanner::Save(yostream* s) const
@@ -106,6 +141,10 @@ void SlowScanner::Save(yostream* s) const
 				}
 			Impl::AlignSave(s, pos);
 		}
+		if (m.regexpsCount > 1) {
+			Impl::AlignedSaveArray(s, m_acceptPos, m.statesCount + 1);
+			Impl::AlignedSaveArray(s, m_accept, m_acceptPos[m.statesCount]);
+		}
 	}
 }
 
@@ -119,6 +158,8 @@ void SlowScanner::Load(yistream* s)
 	LoadPodType(s, empty);
 	Impl::AlignLoad(s, sizeof(empty));
 	sc.need_actions = need_actions;
+	size_t size = 0;
+	size_t actSize = 0;
 	if (empty) {
 		sc.Alias(Null());
 	} else {
@@ -148,14 +189,12 @@ void SlowScanner::Load(yistream* s)
 		}
 		Impl::AlignLoad(s, (m_vec.size() + 1) * sizeof(size_t));
 
-		size_t size = 0;
 		for (auto&& i : sc.m_vec)
 			if (!i.empty()) {
 				LoadPodArray(s, &(i)[0], i.size());
 				size += sizeof(unsigned) * i.size();
 			}
 		Impl::AlignLoad(s, size);
-		size_t actSize = 0;
 		if (sc.need_actions) {
 			for (auto&& i : sc.m_actionsvec) {
 				if (!i.empty()) {
@@ -165,8 +204,18 @@ void SlowScanner::Load(yistream* s)
 			}
 			Impl::AlignLoad(s, actSize);
 		}
+		if (sc.m.regexpsCount > 1) {
+			sc.alloc(sc.m_acceptPos, sc.m.statesCount + 1);
+			Impl::AlignedLoadArray(s, sc.m_acceptPos, sc.m.statesCount + 1);
+			sc.alloc(sc.m_accept, sc.m_acceptPos[sc.m.statesCount]);
+			Impl::AlignedLoadArray(s, sc.m_accept, sc.m_acceptPos[sc.m.statesCount]);
+		}
 	}
 	Swap(sc);
+	PIRE_PROBE3(load, ScannerIOTypes::SlowScanner, Size(), Empty() ? 0
+		: sizeof(*m_letters) * MaxChar + sizeof(*m_finals) * m.statesCount
+		+ (m_vec.size() + 1) * sizeof(size_t) + size + actSize
+		+ (m.regexpsCount > 1 ? sizeof(*m_acceptPos) * (m.statesCount + 1) + sizeof(*m_accept) * m_acceptPos[m.statesCount] : 0));
 }
 
 void LoadedScanner::Save(yostream* s) const {
@@ -201,7 +250,7 @@ void LoadedScanner::Load(yistream* s, ui32* type)
 	}
 	LoadPodType(s, sc.m);
 	Impl::AlignLoad(s, sizeof(sc.m));
-	sc.m_buffer = BufferType(new char[sc.BufSize()]);
+	sc.m_buffer = BufferType(sc.BufSize());
 	sc.Markup(sc.m_buffer.get());
 	Impl::AlignedLoadArray(s, sc.m_letters, MaxChar);
 	Impl::AlignedLoadArray(s, sc.m_jumps, sc.m.statesCount * sc.m.lettersCount);
@@ -212,6 +261,7 @@ void LoadedScanner::Load(yistream* s, ui32* type)
 	Impl::AlignedLoadArray(s, sc.m_tags, sc.m.statesCount);
 	sc.m.initial += reinterpret_cast<size_t>(sc.m_jumps);
 	Swap(sc);
+	PIRE_PROBE3(load, header.Type, Size(), BufSize());
 }
 
 }
@@ -0,0 +1,211 @@
+/*
+ * any.h -- a holder for a scanner of any type
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_SCANNERS_ANY_H
+#define PIRE_SCANNERS_ANY_H
+
+#include <typeinfo>
+#include <type_traits>
+#include "../stub/stl.h"
+#include "../defs.h"
+#include "../run.h"
+
+namespace Pire {
+
+namespace Impl {
+	template<class Scanner>
+	inline auto AppendAcceptedRegexps(const Scanner& sc, typename Scanner::State& st, TVector<size_t>& ids, int)
+		-> decltype(sc.AcceptedRegexps(st), void())
+	{
+		for (auto regexps = sc.AcceptedRegexps(st); regexps.first != regexps.second; ++regexps.first)
+			ids.push_back(*regexps.first);
+	}
+
+	/// Scanners which cannot tell which regexps they accept are treated as having a single one
+	template<class Scanner>
+	inline void AppendAcceptedRegexps(const Scanner& sc, typename Scanner::State& st, TVector<size_t>& ids, long)
+	{
+		if (sc.Final(st))
+			ids.push_back(0);
+	}
+}
+
+/**
+ * A value holding a compiled scanner of any type, for collections of
+ * scanners of different types.
+ *
+ * Unlike a virtual Next(), which costs an indirect call per byte,
+ * each method dispatches only once per call into the usual inlined
+ * run loop of the concrete scanner, so the scan itself runs at full speed.
+ * Type-specific functionality is available through As<Scanner>().
+ */
+class AnyScanner {
+public:
+	AnyScanner() = default;
+
+	AnyScanner(const AnyScanner& any)
+	{
+		if (any.h)
+			h = any.h->Duplicate();
+	}
+
+	AnyScanner(AnyScanner&& any) noexcept
+		: h(std::move(any.h))
+	{
+	}
+
+	AnyScanner& operator= (AnyScanner any)
+	{
+		any.Swap(*this);
+		return *this;
+	}
+
+	template<class Scanner, class = typename std::enable_if<!std::is_same<typename std::decay<Scanner>::type, AnyScanner>::value>::type>
+	AnyScanner(const Scanner& sc)
+		: h(new Holder<Scanner>(sc))
+	{
+	}
+
+	void Swap(AnyScanner& a) noexcept { DoSwap(h, a.h); }
+
+	/// Whether there is no scanner at all, or the scanner is empty
+	bool Empty() const { return !h || h->Empty(); }
+
+	template<class Scanner>
+	bool IsA() const { return h && h->IsA(typeid(Scanner)); }
+
+	template<class Scanner>
+	const Scanner& As() const
+	{
+		if (!IsA<Scanner>())
+			throw Error("type mismatch");
+		return *reinterpret_cast<const Scanner*>(h->Ptr());
+	}
+
+	size_t Size() const { return h ? h->Size() : 0; }
+	size_t RegexpsCount() const { return h ? h->RegexpsCount() : 0; }
+
+	bool Matches(const char* begin, const char* end) const { return h && h->Matches(begin, end); }
+	bool Matches(const ystring& str) const { return Matches(str.c_str(), str.c_str() + str.size()); }
+
+	/// Checks a number of texts at once, storing the results into @p results
+	void Matches(const ypair<const char*, const char*>* texts, size_t count, bool* results) const
+	{
+		if (h)
+			h->Matches(texts, count, results);
+		else
+			std::fill(results, results + count, false);
+	}
+
+	/// Runs the scanner through the whole text (marks included) and appends the regexps it accepts to @p ids
+	void AcceptedRegexps(const char* begin, const char* end, TVector<size_t>& ids) const
+	{
+		if (h)
+			h->AcceptedRegexps(begin, end, ids);
+	}
+
+	/// See Pire::LongestPrefix()
+	const char* LongestPrefix(const char* begin, const char* end, bool throughBeginMark = false, bool throughEndMark = false) const
+	{
+		return h ? h->LongestPrefix(begin, end, throughBeginMark, throughEndMark) : 0;
+	}
+
+	/// See Pire::ShortestPrefix()
+	const char* ShortestPrefix(const char* begin, const char* end, bool throughBeginMark = false, bool throughEndMark = false) const
+	{
+		return h ? h->ShortestPrefix(begin, end, throughBeginMark, throughEndMark) : 0;
+	}
+
+private:
+	struct AbstractHolder {
+		virtual ~AbstractHolder() {}
+		virtual std::unique_ptr<AbstractHolder> Duplicate() const = 0;
+		virtual bool IsA(const std::type_info& id) const = 0;
+		virtual const void* Ptr() const = 0;
+
+		virtual bool Empty() const = 0;
+		virtual size_t Size() const = 0;
+		virtual size_t RegexpsCount() const = 0;
+		virtual bool Matches(const char* begin, const char* end) const = 0;
+		virtual void Matches(const ypair<const char*, const char*>* texts, size_t count, bool* results) const = 0;
+		virtual void AcceptedRegexps(const char* begin, const char* end, TVector<size_t>& ids) const = 0;
+		virtual const char* LongestPrefix(const char* begin, const char* end, bool throughBeginMark, bool throughEndMark) const = 0;
+		virtual const char* ShortestPrefix(const char* begin, const char* end, bool throughBeginMark, bool throughEndMark) const = 0;
+	};
+
+	template<class Scanner>
+	struct Holder: public AbstractHolder {
+		Holder(const Scanner& sc): d(sc) {}
+
+		std::unique_ptr<AbstractHolder> Duplicate() const { return std::unique_ptr<AbstractHolder>(new Holder<Scanner>(d)); }
+		bool IsA(const std::type_info& id) const { return id == typeid(Scanner); }
+		const void* Ptr() const { return &d; }
+
+		bool Empty() const { return d.Empty(); }
+		size_t Size() const { return d.Size(); }
+		size_t RegexpsCount() const { return d.RegexpsCount(); }
+
+		bool Matches(const char* begin, const char* end) const { return Pire::Matches(d, begin, end); }
+
+		void Matches(const ypair<const char*, const char*>* texts, size_t count, bool* results) const
+		{
+			for (size_t i = 0; i != count; ++i)
+				results[i] = Pire::Matches(d, texts[i].first, texts[i].second);
+		}
+
+		void AcceptedRegexps(const char* begin, const char* end, TVector<size_t>& ids) const
+		{
+			typename Scanner::State st;
+			d.Initialize(st);
+			Step(d, st, BeginMark);
+			Run(d, st, begin, end);
+			Step(d, st, EndMark);
+			Impl::AppendAcceptedRegexps(d, st, ids, 0);
+		}
+
+		const char* LongestPrefix(const char* begin, const char* end, bool throughBeginMark, bool throughEndMark) const
+		{
+			return Pire::LongestPrefix(d, begin, end, throughBeginMark, throughEndMark);
+		}
+
+		const char* ShortestPrefix(const char* begin, const char* end, bool throughBeginMark, bool throughEndMark) const
+		{
+			return Pire::ShortestPrefix(d, begin, end, throughBeginMark, throughEndMark);
+		}
+
+	private:
+		Scanner d;
+	};
+
+	std::unique_ptr<AbstractHolder> h;
+};
+
+}
+
+namespace std {
+	inline void swap(Pire::AnyScanner& a, Pire::AnyScanner& b) {
+		a.Swap(b);
+	}
+}
+
+#endif
@@ -0,0 +1,409 @@
+/*
+ * comb.h -- a scanner with a compressed transition table
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_SCANNERS_COMB_H
+#define PIRE_SCANNERS_COMB_H
+
+#include <string.h>
+#include "common.h"
+#include "multi.h"
+#include "../stub/stl.h"
+#include "../stub/defaults.h"
+#include "../stub/saveload.h"
+#include "../probes.h"
+
+namespace Pire {
+
+/**
+ * A scanner storing its transition table in a compressed form,
+ * suitable for huge glued scanners, most states of which send
+ * almost all letters to the same state.
+ *
+ * Each state has a default transition; transitions differing from
+ * the default one are packed into a single array of cells using
+ * row displacement (the "comb vector" scheme): a transition of state S
+ * on letter L is stored in the cell (base(S) + L), provided that
+ * the cell is marked as owned by S. Hence a step costs a single extra
+ * comparison compared to the Scanner.
+ *
+ * Rows of the states listed as hot at construction time are stored
+ * in full, so the comparison always succeeds for them.
+ *
+ * The scanner is built from an already compiled (and possibly glued)
+ * Scanner and preserves its state numbering and regexp numbering.
+ */
+class CombScanner {
+public:
+	typedef ui16        Letter;
+	typedef ui32        Action;
+	typedef ui8         Tag;
+	typedef size_t      State;
+
+	enum {
+		FinalFlag = 1,
+		DeadFlag  = 2
+	};
+
+	CombScanner() { Alias(Null()); }
+
+	explicit CombScanner(Fsm& fsm, size_t distance = 0)
+	{
+		Build(Pire::Scanner(fsm, distance), TVector<size_t>());
+	}
+
+	template<class Relocation, class Shortcutting>
+	explicit CombScanner(const Impl::Scanner<Relocation, Shortcutting>& sc, const TVector<size_t>& hotStates = TVector<size_t>())
+	{
+		if (sc.Empty())
+			Alias(Null());
+		else
+			Build(sc, hotStates);
+	}
+
+	size_t Size() const { return m.statesCount; }
+	bool Empty() const { return m_cells == Null().m_cells; }
+
+	size_t RegexpsCount() const { return Empty() ? 0 : m.regexpsCount; }
+	size_t LettersCount() const { return m.lettersCount; }
+
+	/// Number of cells in the packed transition table
+	size_t CombSize() const { return m.combSize; }
+
+	bool Final(const State& state) const { return (m_flags[state] & FinalFlag) != 0; }
+	bool Dead(const State& state) const { return (m_flags[state] & DeadFlag) != 0; }
+
+	ypair<const size_t*, const size_t*> AcceptedRegexps(const State& state) const
+	{
+		const size_t* b = m_final + m_finalIndex[state];
+		const size_t* e = b;
+		while (*e != End)
+			++e;
+		return ymake_pair(b, e);
+	}
+
+	void Initialize(State& state) const { state = m.initial; }
+
+	Action Next(State& state, Char c) const
+	{
+		const Row& row = m_rows[state];
+		const Cell& cell = m_cells[row.Base + m_letters[c]];
+		state = (cell.Owner == state) ? cell.Next : row.Default;
+		return 0;
+	}
+
+	void TakeAction(State&, Action) const {}
+
+	size_t StateIndex(State s) const { return s; }
+
+	/// Copies share the buffer of an in-memory scanner (or the memory of an mmap()-ed one)
+	CombScanner(const CombScanner& s): m(s.m)
+	{
+		Alias(s);
+		m_buffer = s.m_buffer;
+	}
+
+	/// Returns a copy of the scanner having a private buffer, which can be safely modified
+	CombScanner Clone() const
+	{
+		CombScanner s(*this);
+		if (!Empty()) {
+			s.m_buffer = BufferType(BufSize() + sizeof(size_t));
+			s.Markup(Impl::AlignUp(s.m_buffer.get(), sizeof(size_t)));
+			memcpy(s.m_letters, m_letters, BufSize());
+		}
+		return s;
+	}
+
+	CombScanner(CombScanner&& s)
+	{
+		Alias(Null());
+		Swap(s);
+	}
+
+	void Swap(CombScanner& s)
+	{
+		DoSwap(m_buffer, s.m_buffer);
+		DoSwap(m.statesCount, s.m.statesCount);
+		DoSwap(m.lettersCount, s.m.lettersCount);
+		DoSwap(m.regexpsCount, s.m.regexpsCount);
+		DoSwap(m.initial, s.m.initial);
+		DoSwap(m.combSize, s.m.combSize);
+		DoSwap(m.finalTableSize, s.m.finalTableSize);
+		DoSwap(m_letters, s.m_letters);
+		DoSwap(m_final, s.m_final);
+		DoSwap(m_finalIndex, s.m_finalIndex);
+		DoSwap(m_flags, s.m_flags);
+		DoSwap(m_rows, s.m_rows);
+		DoSwap(m_cells, s.m_cells);
+	}
+
+	CombScanner& operator = (const CombScanner& s) { CombScanner(s).Swap(*this); return *this; }
+
+	/*
+	 * Constructs the scanner from mmap()-ed memory range, returning a pointer
+	 * to unconsumed part of the buffer.
+	 */
+	const void* Mmap(const void* ptr, size_t size)
+	{
+		Impl::CheckAlign(ptr);
+		CombScanner s;
+
+		const size_t* p = reinterpret_cast<const size_t*>(ptr);
+		Impl::ValidateHeader(p, size, ScannerIOTypes::CombScanner, sizeof(m));
+		if (size < sizeof(s.m))
+			throw Error("EOF reached while mapping Pire::CombScanner");
+
+		memcpy(&s.m, p, sizeof(s.m));
+		Impl::AdvancePtr(p, size, sizeof(s.m));
+		Impl::AlignPtr(p, size);
+
+		bool empty = *((const bool*) p);
+		Impl::AdvancePtr(p, size, sizeof(empty));
+		Impl::AlignPtr(p, size);
+
+		if (empty)
+			s.Alias(Null());
+		else {
+			if (size < s.BufSize())
+				throw Error("EOF reached while mapping Pire::CombScanner");
+			s.Markup(const_cast<size_t*>(p));
+			Impl::AdvancePtr(p, size, s.BufSize());
+		}
+		Swap(s);
+		PIRE_PROBE3(mmap, ScannerIOTypes::CombScanner, Size(), reinterpret_cast<const char*>(p) - reinterpret_cast<const char*>(ptr));
+		return Impl::AlignPtr(p, size);
+	}
+
+	// Returns the size of the memory buffer used (or required) by scanner.
+	size_t BufSize() const
+	{
+		return Impl::AlignUp(MaxChar * sizeof(Letter), sizeof(size_t))  // Letters translation table
+			+ m.finalTableSize * sizeof(size_t)                   // Final table
+			+ Impl::AlignUp(m.statesCount * sizeof(ui32), sizeof(size_t)) // Final index
+			+ Impl::AlignUp(m.statesCount * sizeof(Tag), sizeof(size_t))  // Flags
+			+ m.statesCount * sizeof(Row)                         // Bases and default transitions
+			+ m.combSize * sizeof(Cell);                          // Packed transitions
+	}
+
+	void Save(yostream*) const;
+	void Load(yistream*);
+
+private:
+	static const size_t End = static_cast<size_t>(-1);
+	static const ui32 NoOwner = static_cast<ui32>(-1);
+
+	struct Row {
+		ui32 Base;
+		ui32 Default;
+	};
+
+	struct Cell {
+		ui32 Owner;
+		ui32 Next;
+	};
+
+	struct Locals {
+		ui32 statesCount;
+		ui32 lettersCount;
+		ui32 regexpsCount;
+		ui32 initial;
+		ui32 combSize;
+		ui32 finalTableSize;
+	} m;
+
+	using BufferType = Impl::SharedArray<char>;
+	BufferType m_buffer;
+
+	Letter* m_letters;
+	size_t* m_final;
+	ui32* m_finalIndex;
+	Tag* m_flags;
+	Row* m_rows;
+	Cell* m_cells;
+
+	// Only used to force Null() call during static initialization, when Null()::n can be
+	// initialized safely by compilers that don't support thread safe static local vars
+	// initialization
+	static const CombScanner* m_null;
+
+	inline static const CombScanner& Null()
+	{
+		static const CombScanner n = Fsm::MakeFalse().Compile<CombScanner>();
+		return n;
+	}
+
+	void Alias(const CombScanner& s)
+	{
+		m = s.m;
+		m_buffer.reset();
+		m_letters = s.m_letters;
+		m_final = s.m_final;
+		m_finalIndex = s.m_finalIndex;
+		m_flags = s.m_flags;
+		m_rows = s.m_rows;
+		m_cells = s.m_cells;
+	}
+
+	/*
+	 * Initializes pointers depending on buffer start, states count and comb size
+	 */
+	void Markup(void* ptr)
+	{
+		Impl::CheckAlign(ptr, sizeof(size_t));
+		char* p = reinterpret_cast<char*>(ptr);
+		m_letters = reinterpret_cast<Letter*>(p);
+		p += Impl::AlignUp(MaxChar * sizeof(Letter), sizeof(size_t));
+		m_final = reinterpret_cast<size_t*>(p);
+		p += m.finalTableSize * sizeof(size_t);
+		m_finalIndex = reinterpret_cast<ui32*>(p);
+		p += Impl::AlignUp(m.statesCount * sizeof(ui32), sizeof(size_t));
+		m_flags = reinterpret_cast<Tag*>(p);
+		p += Impl::AlignUp(m.statesCount * sizeof(Tag), sizeof(size_t));
+		m_rows = reinterpret_cast<Row*>(p);
+		p += m.statesCount * sizeof(Row);
+		m_cells = reinterpret_cast<Cell*>(p);
+	}
+
+	template<class Scanner>
+	void Build(const Scanner& sc, const TVector<size_t>& hotStates)
+	{
+		memset(&m, 0, sizeof(m));
+		m.statesCount = sc.Size();
+		m.regexpsCount = sc.RegexpsCount();
+
+		// Number letter classes of the original scanner
+		TVector<Letter> letters(MaxChar, 0);
+		TVector<Char> representatives;
+		TMap<Char, Letter> classes;
+		for (Char c = 0; c != MaxCharUnaligned; ++c) {
+			if (c == Epsilon)
+				continue;
+			auto cls = classes.insert(ymake_pair(sc.Translate(c), static_cast<Letter>(classes.size())));
+			if (cls.second)
+				representatives.push_back(c);
+			letters[c] = cls.first->second;
+		}
+		m.lettersCount = representatives.size();
+
+		// Calculate default transitions and exceptions for each state
+		TVector<bool> hot(m.statesCount, false);
+		for (auto&& st : hotStates)
+			hot[st] = true;
+		TVector<ui32> defaults(m.statesCount);
+		TVector< TVector< ypair<Letter, ui32> > > exceptions(m.statesCount);
+		TVector<ui32> row(m.lettersCount);
+		TVector<ui32> sorted;
+		for (size_t st = 0; st != m.statesCount; ++st) {
+			for (size_t l = 0; l != m.lettersCount; ++l) {
+				typename Scanner::State next = sc.IndexToState(st);
+				sc.Next(next, representatives[l]);
+				row[l] = sc.StateIndex(next);
+			}
+			sorted = row;
+			std::sort(sorted.begin(), sorted.end());
+			size_t best = 0;
+			for (size_t i = 0, j; i != sorted.size(); i = j) {
+				for (j = i; j != sorted.size() && sorted[j] == sorted[i]; ++j) {}
+				if (j - i > best) {
+					best = j - i;
+					defaults[st] = sorted[i];
+				}
+			}
+			for (size_t l = 0; l != m.lettersCount; ++l)
+				if (hot[st] || row[l] != defaults[st])
+					exceptions[st].push_back(ymake_pair(static_cast<Letter>(l), row[l]));
+		}
+
+		// Pack exceptions, placing the densest rows first (first fit)
+		TVector<size_t> order(m.statesCount);
+		for (size_t st = 0; st != m.statesCount; ++st)
+			order[st] = st;
+		std::stable_sort(order.begin(), order.end(), [&exceptions](size_t a, size_t b) { return exceptions[a].size() > exceptions[b].size(); });
+		TVector<ui32> bases(m.statesCount, 0);
+		TVector<Cell> cells;
+		size_t firstFree = 0;
+		for (auto&& st : order) {
+			const TVector< ypair<Letter, ui32> >& ex = exceptions[st];
+			if (ex.empty())
+				break;
+			size_t base = firstFree > ex.front().first ? firstFree - ex.front().first : 0;
+			for (;; ++base) {
+				bool fits = true;
+				for (auto&& e : ex)
+					if (base + e.first < cells.size() && cells[base + e.first].Owner != NoOwner) {
+						fits = false;
+						break;
+					}
+				if (fits)
+					break;
+			}
+			Cell free = { NoOwner, 0 };
+			if (cells.size() < base + m.lettersCount)
+				cells.resize(base + m.lettersCount, free);
+			for (auto&& e : ex) {
+				cells[base + e.first].Owner = st;
+				cells[base + e.first].Next = e.second;
+			}
+			bases[st] = base;
+			while (firstFree < cells.size() && cells[firstFree].Owner != NoOwner)
+				++firstFree;
+		}
+		Cell free = { NoOwner, 0 };
+		if (cells.size() < m.lettersCount)
+			cells.resize(m.lettersCount, free);
+		m.combSize = cells.size();
+
+		// Gather final sets
+		TVector<size_t> finals;
+		TVector<ui32> finalIndex(m.statesCount);
+		for (size_t st = 0; st != m.statesCount; ++st) {
+			finalIndex[st] = finals.size();
+			ypair<const size_t*, const size_t*> accepted = sc.AcceptedRegexps(sc.IndexToState(st));
+			finals.insert(finals.end(), accepted.first, accepted.second);
+			finals.push_back(static_cast<size_t>(End));
+		}
+		m.finalTableSize = finals.size();
+
+		typename Scanner::State initial;
+		sc.Initialize(initial);
+		m.initial = sc.StateIndex(initial);
+
+		m_buffer = BufferType(BufSize() + sizeof(size_t));
+		memset(m_buffer.get(), 0, BufSize() + sizeof(size_t));
+		Markup(Impl::AlignUp(m_buffer.get(), sizeof(size_t)));
+		memcpy(m_letters, &letters[0], MaxChar * sizeof(Letter));
+		memcpy(m_final, &finals[0], finals.size() * sizeof(size_t));
+		memcpy(m_finalIndex, &finalIndex[0], m.statesCount * sizeof(ui32));
+		memcpy(m_cells, &cells[0], cells.size() * sizeof(Cell));
+		for (size_t st = 0; st != m.statesCount; ++st) {
+			typename Scanner::State state = sc.IndexToState(st);
+			m_flags[st] = (sc.Final(state) ? FinalFlag : 0) | (sc.Dead(state) ? DeadFlag : 0);
+			m_rows[st].Base = bases[st];
+			m_rows[st].Default = defaults[st];
+		}
+	}
+};
+
+}
+
+#endif
@@ -24,6 +24,7 @@
 #define PIRE_SCANNERS_COMMON_H_INCLUDED
 
 #include <stdlib.h>
+#include <memory>
 #include "../align.h"
 #include "../stub/defaults.h"
 #include "../defs.h"
@@ -38,6 +39,8 @@ namespace Pire {
 			SlowScanner = 3,
 			LoadedScanner = 4,
 			NoGlueLimitCountingScanner = 5,
+			CombScanner = 6,
+			CompactSimpleScanner = 7,
 		};
 	}
 
@@ -78,6 +81,31 @@ namespace Pire {
 	};
 
 	namespace Impl {
+		/**
+		 * A reference-counted array holding the tables of an in-memory scanner.
+		 * Copies of a scanner share the same array, so copying is cheap
+		 * regardless of scanner size; a scanner must not be modified
+		 * once it has been copied (use Clone() to get a private copy).
+		 */
+		template<class T>
+		class SharedArray {
+		public:
+			SharedArray() {}
+			explicit SharedArray(size_t size): m_ptr(new T[size], std::default_delete<T[]>()) {}
+
+			T* get() const { return m_ptr.get(); }
+			T& operator[](size_t i) const { return m_ptr.get()[i]; }
+			explicit operator bool() const { return m_ptr != nullptr; }
+
+			/// Checks whether the array is owned by more than one scanner
+			bool Shared() const { return m_ptr.use_count() > 1; }
+
+			void reset() { m_ptr.reset(); }
+
+		private:
+			std::shared_ptr<T> m_ptr;
+		};
+
 		inline const void* AdvancePtr(const size_t*& ptr, size_t& size, size_t delta)
 		{
 			ptr = (const size_t*) ((const char*) ptr + delta);
@@ -0,0 +1,319 @@
+/*
+ * compact.h -- a compact variant of the SimpleScanner
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_SCANNERS_COMPACT_H
+#define PIRE_SCANNERS_COMPACT_H
+
+#include <string.h>
+#include "common.h"
+#include "../approx_matching.h"
+#include "../fsm.h"
+#include "../stub/stl.h"
+#include "../stub/defaults.h"
+#include "../stub/saveload.h"
+
+namespace Pire {
+
+namespace Impl {
+
+/**
+ * Like the SimpleScanner, makes a step with a single load and without
+ * a letter translation table, but stores @p Cell-sized offsets of
+ * the next row instead of size_t ones: a row takes about 1 KB for 32-bit
+ * cells and about 512 bytes for 16-bit ones, instead of 2 KB.
+ *
+ * Columns for Epsilon, BeginMark and EndMark, as well as final and dead
+ * flags, live in the tail of each row, so Next() does not branch. Rows are
+ * padded to an odd number of cache lines: with a power-of-two row size,
+ * the same column of all rows would compete for a few cache sets.
+ *
+ * Offsets must fit into a cell, which limits a scanner with 16-bit cells
+ * to a couple hundred states; the constructor throws if the FSM is too large
+ * (see Fits()).
+ */
+template<class Cell>
+class CompactSimpleScanner {
+public:
+	typedef ui16        Letter;
+	typedef ui32        Action;
+	typedef ui8         Tag;
+	typedef size_t      State;
+
+	enum {
+		FinalFlag = 1,
+		DeadFlag  = 2
+	};
+
+	CompactSimpleScanner() { Alias(Null()); }
+
+	explicit CompactSimpleScanner(Fsm& fsm, size_t distance = 0);
+
+	/// Whether a scanner of that many states can be built
+	static bool Fits(size_t statesCount)
+	{
+		return !statesCount || (statesCount - 1) <= static_cast<size_t>(static_cast<Cell>(-1)) / RowCells;
+	}
+
+	size_t Size() const { return m.statesCount; }
+	bool Empty() const { return m_rows == Null().m_rows; }
+
+	size_t RegexpsCount() const { return Empty() ? 0 : 1; }
+	size_t LettersCount() const { return MaxChar; }
+
+	bool Final(const State& state) const { return (m_rows[state + FlagsColumn] & FinalFlag) != 0; }
+	bool Dead(const State& state) const { return (m_rows[state + FlagsColumn] & DeadFlag) != 0; }
+
+	ypair<const size_t*, const size_t*> AcceptedRegexps(const State& s) const
+	{
+		static const size_t accept[1] = { 0 };
+		return ymake_pair(accept, accept + (Final(s) ? 1 : 0));
+	}
+
+	void Initialize(State& state) const { state = m.initial; }
+
+	/// Handles one character
+	Action Next(State& state, Char c) const
+	{
+		state = m_rows[state + c];
+		return 0;
+	}
+
+	bool TakeAction(State&, Action) const { return false; }
+
+	size_t StateIndex(State s) const { return s / RowCells; }
+	State IndexToState(size_t stateIndex) const { return stateIndex * RowCells; }
+
+	/// Packed states take this many 32-bit words (see Scanner::PackState())
+	size_t PackedStateSize() const { return 1; }
+	void PackState(const State& s, ui32* packed) const { *packed = static_cast<ui32>(StateIndex(s)); }
+	void UnpackState(const ui32* packed, State& s) const { s = IndexToState(*packed); }
+
+	/// Copies share the buffer of an in-memory scanner (or the memory of an mmap()-ed one)
+	CompactSimpleScanner(const CompactSimpleScanner& s)
+	{
+		Alias(s);
+		m_buffer = s.m_buffer;
+	}
+
+	/// Returns a copy of the scanner having a private buffer, which can be safely modified
+	CompactSimpleScanner Clone() const
+	{
+		CompactSimpleScanner s(*this);
+		if (!Empty()) {
+			s.Allocate();
+			memcpy(s.m_rows, m_rows, BufSize());
+		}
+		return s;
+	}
+
+	void Swap(CompactSimpleScanner& s)
+	{
+		DoSwap(m_buffer, s.m_buffer);
+		DoSwap(m.statesCount, s.m.statesCount);
+		DoSwap(m.initial, s.m.initial);
+		DoSwap(m.cellSize, s.m.cellSize);
+		DoSwap(m_rows, s.m_rows);
+	}
+
+	CompactSimpleScanner& operator = (const CompactSimpleScanner& s) { CompactSimpleScanner(s).Swap(*this); return *this; }
+
+	/*
+	 * Constructs the scanner from mmap()-ed memory range, returning a pointer
+	 * to unconsumed part of the buffer.
+	 */
+	const void* Mmap(const void* ptr, size_t size)
+	{
+		CheckAlign(ptr);
+		CompactSimpleScanner s;
+
+		const size_t* p = reinterpret_cast<const size_t*>(ptr);
+		ValidateHeader(p, size, ScannerIOTypes::CompactSimpleScanner, sizeof(m));
+		if (size < sizeof(s.m))
+			throw Error("EOF reached while mapping Pire::CompactSimpleScanner");
+
+		memcpy(&s.m, p, sizeof(s.m));
+		if (s.m.cellSize != sizeof(Cell))
+			throw Error("Serialized CompactSimpleScanner has different cell size");
+		AdvancePtr(p, size, sizeof(s.m));
+		AlignPtr(p, size);
+
+		bool empty = *((const bool*) p);
+		AdvancePtr(p, size, sizeof(empty));
+		AlignPtr(p, size);
+
+		if (empty)
+			s.Alias(Null());
+		else {
+			if (size < s.BufSize())
+				throw Error("EOF reached while mapping Pire::CompactSimpleScanner");
+			s.m_rows = reinterpret_cast<Cell*>(const_cast<size_t*>(p));
+			AdvancePtr(p, size, s.BufSize());
+		}
+		Swap(s);
+		return AlignPtr(p, size);
+	}
+
+	// Returns the size of the memory buffer used (or required) by scanner.
+	size_t BufSize() const
+	{
+		return m.statesCount * RowCells * sizeof(Cell);
+	}
+
+	void Save(yostream* s) const
+	{
+		SavePodType(s, Header(ScannerIOTypes::CompactSimpleScanner, sizeof(m)));
+		AlignSave(s, sizeof(Header));
+		SavePodType(s, m);
+		AlignSave(s, sizeof(m));
+		SavePodType(s, Empty());
+		AlignSave(s, sizeof(Empty()));
+		if (!Empty())
+			AlignedSaveArray(s, m_rows, m.statesCount * RowCells);
+	}
+
+	void Load(yistream* s)
+	{
+		CompactSimpleScanner sc;
+		ValidateHeader(s, ScannerIOTypes::CompactSimpleScanner, sizeof(sc.m));
+		LoadPodType(s, sc.m);
+		AlignLoad(s, sizeof(sc.m));
+		if (sc.m.cellSize != sizeof(Cell))
+			throw Error("Serialized CompactSimpleScanner has different cell size");
+		bool empty;
+		LoadPodType(s, empty);
+		AlignLoad(s, sizeof(empty));
+		if (empty)
+			sc.Alias(Null());
+		else {
+			sc.Allocate();
+			AlignedLoadArray(s, sc.m_rows, sc.m.statesCount * RowCells);
+		}
+		Swap(sc);
+	}
+
+private:
+	static const size_t CacheLine = 64;
+	static const size_t FlagsColumn = MaxChar;
+
+	/// Columns for all letters and the flags, rounded up to an odd number of cache lines
+	static const size_t RowLines = ((MaxChar + 1) * sizeof(Cell) + CacheLine - 1) / CacheLine;
+	static const size_t RowCells = (RowLines | 1) * CacheLine / sizeof(Cell);
+
+	struct Locals {
+		ui32 statesCount;
+		ui32 initial;
+		ui32 cellSize;
+	} m;
+
+	using BufferType = SharedArray<char>;
+	BufferType m_buffer;
+
+	Cell* m_rows;
+
+	static const CompactSimpleScanner& Null()
+	{
+		static const CompactSimpleScanner n = Fsm::MakeFalse().Compile<CompactSimpleScanner>();
+		return n;
+	}
+
+	void Alias(const CompactSimpleScanner& s)
+	{
+		m = s.m;
+		m_buffer.reset();
+		m_rows = s.m_rows;
+	}
+
+	/// Allocates a private buffer with rows aligned to cache lines
+	void Allocate()
+	{
+		m_buffer = BufferType(BufSize() + CacheLine);
+		m_rows = reinterpret_cast<Cell*>(AlignUp(m_buffer.get(), CacheLine));
+	}
+
+	void SetJump(size_t from, Char c, size_t to)
+	{
+		Y_ASSERT(m_buffer && !m_buffer.Shared());
+		Y_ASSERT(from < m.statesCount && to < m.statesCount);
+		Y_ASSERT(c < MaxChar);
+		m_rows[from * RowCells + c] = static_cast<Cell>(to * RowCells);
+	}
+};
+
+template<class Cell>
+inline CompactSimpleScanner<Cell>::CompactSimpleScanner(Fsm& fsm, size_t distance)
+{
+	if (distance)
+		fsm = CreateApproxFsm(fsm, distance);
+	fsm.Canonize();
+	if (!Fits(fsm.Size()))
+		throw Error("Too many states for CompactSimpleScanner cells");
+
+	memset(&m, 0, sizeof(m));
+	m.statesCount = fsm.Size();
+	m.initial = fsm.Initial() * RowCells;
+	m.cellSize = sizeof(Cell);
+	Allocate();
+	memset(m_rows, 0, BufSize());
+
+	// Like in the SimpleScanner, missing transitions keep the state
+	TSet<size_t> dead = fsm.DeadStates();
+	for (size_t state = 0; state != m.statesCount; ++state) {
+		for (Char c = 0; c != MaxChar; ++c)
+			SetJump(state, c, state);
+		m_rows[state * RowCells + FlagsColumn] = (fsm.IsFinal(state) ? FinalFlag : 0) | (dead.count(state) ? DeadFlag : 0);
+	}
+
+	for (size_t from = 0; from != fsm.Size(); ++from)
+		for (auto&& i : fsm.Letters()) {
+			const auto& tos = fsm.Destinations(from, i.first);
+			if (tos.empty())
+				continue;
+			for (auto&& l : i.second.second)
+				for (auto&& to : tos)
+					SetJump(from, l, to);
+		}
+}
+
+template<class Cell>
+const size_t CompactSimpleScanner<Cell>::CacheLine;
+
+template<class Cell>
+const size_t CompactSimpleScanner<Cell>::FlagsColumn;
+
+template<class Cell>
+const size_t CompactSimpleScanner<Cell>::RowLines;
+
+template<class Cell>
+const size_t CompactSimpleScanner<Cell>::RowCells;
+
+}
+
+/// About 1 KB per state
+typedef Impl::CompactSimpleScanner<ui32> CompactSimpleScanner;
+
+/// About 512 bytes per state, up to 228 states
+typedef Impl::CompactSimpleScanner<ui16> CompactSimpleScanner16;
+
+}
+
+#endif
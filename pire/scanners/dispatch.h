@@ -0,0 +1,250 @@
+/*
+ * dispatch.h -- a set of scanners selected by the first bytes of input
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_SCANNERS_DISPATCH_H
+#define PIRE_SCANNERS_DISPATCH_H
+
+#include "../stub/stl.h"
+#include "../defs.h"
+#include "../run.h"
+
+namespace Pire {
+
+/**
+ * A set of regexps split into groups by the first bytes of input
+ * they may match, providing the interface of a single scanner.
+ *
+ * Gluing many patterns anchored at distinct prefixes (like URL hosts
+ * or log source tags) produces a huge product automaton, although
+ * any given text may only match patterns sharing its first bytes.
+ * The dispatcher glues each such group separately and selects the group
+ * through a 256- or 65536-way table once the first @p prefixLen bytes
+ * have been read (they are buffered in the state until then).
+ *
+ * A pattern is put into every group it is not dead after, so unanchored
+ * patterns (as well as surrounded ones, which never die) end up
+ * in all groups; patterns which may match inputs shorter
+ * than the prefix are additionally glued into a scanner running until
+ * the group is known. Regexps are numbered as if all the patterns were
+ * glued in order of appearance.
+ */
+template<class Scanner>
+class PrefixDispatcher {
+public:
+	typedef typename Scanner::Action Action;
+
+	static const size_t MaxPrefixLen = 2;
+
+	struct State {
+		size_t group;                  ///< Index of the selected group, or zero if not known yet
+		typename Scanner::State inner; ///< State of the group's scanner
+		size_t bytes;                  ///< Number of bytes read so far, up to the prefix length
+		size_t buffered;               ///< Number of characters read so far, up to the prefix length
+		Char prefix[MaxPrefixLen + 2]; ///< Characters read, including BeginMark
+		mutable TVector<size_t> accepted;
+	};
+
+	PrefixDispatcher(): m_prefixLen(1), m_regexpsCount(0), m_groups(1), m_table(1 << (sizeof(char)*8), 0) {}
+
+	/**
+	 * Groups the patterns by their first @p prefixLen bytes (either one or two)
+	 * and glues each group. Throws an exception if a group cannot be glued
+	 * within @p maxSize states (see Scanner::Glue()).
+	 */
+	explicit PrefixDispatcher(const TVector<Scanner>& patterns, size_t prefixLen = 1, size_t maxSize = 0)
+		: m_prefixLen(prefixLen)
+		, m_regexpsCount(0)
+	{
+		if (!prefixLen || prefixLen > MaxPrefixLen)
+			throw Error("Unsupported dispatch prefix length");
+
+		TVector<size_t> offsets;
+		for (auto&& pattern : patterns) {
+			offsets.push_back(m_regexpsCount);
+			m_regexpsCount += pattern.RegexpsCount();
+		}
+
+		// Patterns may be run with or without BeginMark, so both initial states are tracked
+		Live live;
+		for (size_t i = 0; i != patterns.size(); ++i) {
+			typename Scanner::State st;
+			patterns[i].Initialize(st);
+			live.push_back(ymake_pair(i, st));
+			Step(patterns[i], st, BeginMark);
+			live.push_back(ymake_pair(i, st));
+		}
+
+		TMap<TVector<size_t>, size_t> groups;
+		TVector< TVector<size_t> > members(1);
+		m_table.assign(static_cast<size_t>(1) << (8 * prefixLen), 0);
+		Partition(patterns, live, 0, 0, groups, members);
+
+		m_groups.resize(members.size());
+		for (size_t i = 0; i != members.size(); ++i) {
+			Group& group = m_groups[i];
+			for (auto&& member : members[i]) {
+				if (group.ids.empty())
+					group.scanner = patterns[member];
+				else if ((group.scanner = Scanner::Glue(group.scanner, patterns[member], maxSize)).Empty())
+					throw Error("Patterns sharing a prefix are too complicated to be glued");
+				for (size_t id = 0; id != patterns[member].RegexpsCount(); ++id)
+					group.ids.push_back(offsets[member] + id);
+			}
+		}
+	}
+
+	size_t RegexpsCount() const { return m_regexpsCount; }
+	size_t PrefixLen() const { return m_prefixLen; }
+
+	/// Number of glued groups, including the one for inputs shorter than the prefix
+	size_t GroupsCount() const { return m_groups.size(); }
+	const Scanner& GroupScanner(size_t group) const { return m_groups[group].scanner; }
+
+	void Initialize(State& state) const
+	{
+		state.group = 0;
+		state.bytes = 0;
+		state.buffered = 0;
+		m_groups[0].scanner.Initialize(state.inner);
+	}
+
+	Action Next(State& state, Char c) const
+	{
+		if (PIRE_LIKELY(state.group))
+			return m_groups[state.group].scanner.Next(state.inner, c);
+
+		Y_ASSERT(state.buffered < sizeof(state.prefix) / sizeof(*state.prefix));
+		state.prefix[state.buffered++] = c;
+		if (c < MaxByte && ++state.bytes == m_prefixLen) {
+			size_t key = 0;
+			for (size_t i = 0; i != state.buffered; ++i)
+				if (state.prefix[i] < MaxByte)
+					key = (key << 8) | state.prefix[i];
+			state.group = m_table[key];
+
+			// Replay the prefix on the scanner of the group
+			const Scanner& scanner = m_groups[state.group].scanner;
+			scanner.Initialize(state.inner);
+			for (size_t i = 0; i + 1 != state.buffered; ++i)
+				Step(scanner, state.inner, state.prefix[i]);
+			return scanner.Next(state.inner, c);
+		}
+		return m_groups[0].scanner.Next(state.inner, c);
+	}
+
+	void TakeAction(State& state, Action a) const
+	{
+		m_groups[state.group].scanner.TakeAction(state.inner, a);
+	}
+
+	bool Final(const State& state) const
+	{
+		return m_groups[state.group].scanner.Final(state.inner);
+	}
+
+	bool Dead(const State& state) const
+	{
+		return state.group && m_groups[state.group].scanner.Dead(state.inner);
+	}
+
+	ypair<const size_t*, const size_t*> AcceptedRegexps(const State& state) const
+	{
+		const Group& group = m_groups[state.group];
+		ypair<const size_t*, const size_t*> local = group.scanner.AcceptedRegexps(state.inner);
+		state.accepted.clear();
+		for (; local.first != local.second; ++local.first)
+			state.accepted.push_back(group.ids[*local.first]);
+		return ymake_pair<const size_t*, const size_t*>(state.accepted.data(), state.accepted.data() + state.accepted.size());
+	}
+
+	ypair<size_t, size_t> StateIndex(const State& state) const
+	{
+		return ymake_pair(state.group, m_groups[state.group].scanner.StateIndex(state.inner));
+	}
+
+private:
+	static const Char MaxByte = 1 << (sizeof(char)*8);
+
+	struct Group {
+		Scanner scanner;
+		TVector<size_t> ids; ///< Local regexp index -> global one
+	};
+
+	/// Patterns which are not dead yet, along with their states
+	typedef TVector< ypair<size_t, typename Scanner::State> > Live;
+
+	size_t m_prefixLen;
+	size_t m_regexpsCount;
+	TVector<Group> m_groups;  ///< The first group is used until the prefix has been read
+	TVector<ui32> m_table;    ///< Prefix -> index in m_groups
+
+	/// Assigns groups to all prefixes starting with the given @p key of @p depth bytes
+	void Partition(const TVector<Scanner>& patterns, const Live& live, size_t depth, size_t key,
+		TMap<TVector<size_t>, size_t>& groups, TVector< TVector<size_t> >& members)
+	{
+		if (depth == m_prefixLen) {
+			TVector<size_t> alive;
+			for (auto&& i : live)
+				if (alive.empty() || alive.back() != i.first)
+					alive.push_back(i.first);
+			auto ins = groups.insert(ymake_pair(alive, members.size()));
+			if (ins.second)
+				members.push_back(alive);
+			m_table[key] = ins.first->second;
+			return;
+		}
+
+		// Patterns which may match a shorter input go to the first group
+		for (auto&& i : live) {
+			typename Scanner::State end = i.second;
+			Step(patterns[i.first], end, EndMark);
+			if (patterns[i.first].Final(i.second) || patterns[i.first].Final(end))
+				if (std::find(members[0].begin(), members[0].end(), i.first) == members[0].end())
+					members[0].push_back(i.first);
+		}
+
+		Live next;
+		for (Char c = 0; c != MaxByte; ++c) {
+			next.clear();
+			for (auto&& i : live) {
+				typename Scanner::State st = i.second;
+				Step(patterns[i.first], st, c);
+				if (!patterns[i.first].Dead(st))
+					next.push_back(ymake_pair(i.first, st));
+			}
+			Partition(patterns, next, depth + 1, (key << 8) | c, groups, members);
+		}
+		if (depth == 0)
+			std::sort(members[0].begin(), members[0].end());
+	}
+};
+
+template<class Scanner>
+const size_t PrefixDispatcher<Scanner>::MaxPrefixLen;
+
+template<class Scanner>
+const Char PrefixDispatcher<Scanner>::MaxByte;
+
+}
+
+#endif
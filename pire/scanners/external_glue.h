@@ -0,0 +1,361 @@
+/*
+ * external_glue.h -- agglutination of scanners too large to fit in memory
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_SCANNERS_EXTERNAL_GLUE_H
+#define PIRE_SCANNERS_EXTERNAL_GLUE_H
+
+#include <cstdio>
+#include "multi.h"
+#include "../glue.h"
+#include "../partition.h"
+#include "../stub/stl.h"
+#include "../stub/saveload.h"
+#include "../stub/noncopyable.h"
+#include "../probes.h"
+
+namespace Pire {
+namespace Impl {
+
+	/**
+	 * An append-only array of POD values stored in a temporary file.
+	 * Only the block being written and the block being read
+	 * are kept in memory, so sequential access is cheap.
+	 */
+	template<class T>
+	class SpilledArray: private NonCopyable {
+	public:
+		explicit SpilledArray(size_t blockSize)
+			: m_file(std::tmpfile())
+			, m_blockSize(ymax<size_t>(blockSize, 1))
+			, m_flushed(0)
+			, m_cacheStart(0)
+		{
+			if (!m_file)
+				throw Error("Cannot create a temporary file");
+			m_tail.reserve(m_blockSize);
+		}
+
+		~SpilledArray() { fclose(m_file); }
+
+		size_t Size() const { return m_flushed + m_tail.size(); }
+
+		void PushBack(const T& t)
+		{
+			m_tail.push_back(t);
+			if (m_tail.size() == m_blockSize) {
+				if (fseek(m_file, 0, SEEK_END) != 0 || fwrite(&m_tail[0], sizeof(T), m_tail.size(), m_file) != m_tail.size())
+					throw Error("Cannot write to a temporary file");
+				m_flushed += m_tail.size();
+				m_tail.clear();
+			}
+		}
+
+		/// Returns a copy of the i-th element
+		T operator[](size_t i)
+		{
+			Y_ASSERT(i < Size());
+			if (i >= m_flushed)
+				return m_tail[i - m_flushed];
+			if (i < m_cacheStart || i >= m_cacheStart + m_cache.size()) {
+				m_cacheStart = i - i % m_blockSize;
+				m_cache.resize(ymin(m_blockSize, m_flushed - m_cacheStart));
+				if (fseek(m_file, static_cast<long>(m_cacheStart * sizeof(T)), SEEK_SET) != 0
+					|| fread(&m_cache[0], sizeof(T), m_cache.size(), m_file) != m_cache.size())
+					throw Error("Cannot read from a temporary file");
+			}
+			return m_cache[i - m_cacheStart];
+		}
+
+	private:
+		FILE* m_file;
+		size_t m_blockSize;
+		size_t m_flushed;        ///< Number of elements written to the file
+		TVector<T> m_tail;       ///< Elements not written yet
+		size_t m_cacheStart;
+		TVector<T> m_cache;      ///< Last block read from the file
+	};
+
+	/// An open-addressing hash table mapping pairs of state indices to glued state indices
+	class GluedStateIndex {
+	public:
+		GluedStateIndex(): m_table(1024), m_size(0) {}
+
+		/// Returns the index of the pair, inserting it with the given index if it is absent.
+		/// The second member of the result tells whether the pair has been inserted.
+		ypair<ui32, bool> Insert(ui32 first, ui32 second, ui32 index)
+		{
+			Entry& e = Find(m_table, first, second);
+			if (e.index != Empty)
+				return ymake_pair(e.index, false);
+			e.first = first;
+			e.second = second;
+			e.index = index;
+			++m_size;
+			return ymake_pair(index, true);
+		}
+
+		bool Full() const { return m_size * 2 > m_table.size(); }
+
+		/// Grows the table twice, unless it would consume more than @p limit bytes
+		bool Grow(size_t limit)
+		{
+			if (2 * MemoryUsage() > limit)
+				return false;
+			TVector<Entry> table(2 * m_table.size());
+			for (auto&& e : m_table)
+				if (e.index != Empty)
+					Find(table, e.first, e.second) = e;
+			m_table.swap(table);
+			return true;
+		}
+
+		size_t MemoryUsage() const { return m_table.size() * sizeof(Entry); }
+
+	private:
+		static const ui32 Empty = static_cast<ui32>(-1);
+
+		struct Entry {
+			ui32 first;
+			ui32 second;
+			ui32 index;
+
+			Entry(): first(0), second(0), index(Empty) {}
+		};
+
+		TVector<Entry> m_table;
+		size_t m_size;
+
+		static Entry& Find(TVector<Entry>& table, ui32 first, ui32 second)
+		{
+			size_t mask = table.size() - 1;
+			size_t i = ((ui64(first) << 32 | second) * 0x9E3779B97F4A7C15ULL >> 20) & mask;
+			while (table[i].index != Empty && (table[i].first != first || table[i].second != second))
+				i = (i + 1) & mask;
+			return table[i];
+		}
+	};
+
+	struct ExternalGlue {
+		template<class Shortcutting>
+		static bool Glue(const Scanner<Relocatable, Shortcutting>& lhs, const Scanner<Relocatable, Shortcutting>& rhs,
+			yostream* out, size_t memoryBudget, size_t maxSize)
+		{
+			typedef Scanner<Relocatable, Shortcutting> ScannerType;
+			typedef typename ScannerType::Transition Transition;
+			typedef typename ScannerType::Letter Letter;
+			typedef typename ScannerType::ScannerRowHeader RowHeader;
+			typedef ypair<ui32, ui32> GluedState;
+
+			if (lhs.Empty() || rhs.Empty()) {
+				Save(out, lhs.Empty() ? rhs : lhs);
+				return true;
+			}
+			PIRE_PROBE2(glue_begin, lhs.Size(), rhs.Size());
+
+			Partition< Char, LettersEquality<ScannerType> > letters(LettersEquality<ScannerType>(lhs.m_letters, rhs.m_letters));
+			for (unsigned ch = 0; ch < MaxChar; ++ch)
+				if (ch != Epsilon)
+					letters.Append(ch);
+			const size_t lettersCount = letters.Size();
+
+			// Two spilled arrays keep two blocks in memory each; the rest goes to the index
+			const size_t blockBytes = ymax<size_t>(4096, ymin<size_t>(1 << 20, memoryBudget / 16));
+			const size_t indexBudget = memoryBudget > 4 * blockBytes ? memoryBudget - 4 * blockBytes : 0;
+
+			// Enumerate glued states breadth-first, in the same order Impl::Determine() does
+			SpilledArray<GluedState> states(blockBytes / sizeof(GluedState));
+			SpilledArray<ui32> rows(blockBytes / sizeof(ui32)); // Destinations of each state, by letter class index
+			GluedStateIndex index;
+			const GluedState initial(lhs.StateIndex(lhs.m.initial), rhs.StateIndex(rhs.m.initial));
+			states.PushBack(initial);
+			index.Insert(initial.first, initial.second, 0);
+
+			size_t finalTableSize = 0;
+			TVector<ui32> row(lettersCount);
+			for (size_t i = 0; i != states.Size(); ++i) {
+				const GluedState st = states[i];
+				const size_t l = lhs.IndexToState(st.first);
+				const size_t r = rhs.IndexToState(st.second);
+				finalTableSize += RangeLen(lhs.AcceptedRegexps(l)) + RangeLen(rhs.AcceptedRegexps(r));
+				for (auto&& letter : letters) {
+					size_t nl = l, nr = r;
+					lhs.Next(nl, letter.first);
+					rhs.Next(nr, letter.first);
+					const GluedState next(lhs.StateIndex(nl), rhs.StateIndex(nr));
+					ypair<ui32, bool> found = index.Insert(next.first, next.second, states.Size());
+					if (found.second) {
+						if ((maxSize && states.Size() > maxSize) || states.Size() == static_cast<ui32>(-1)) {
+							PIRE_PROBE1(glue_end, 0);
+							return false;
+						}
+						states.PushBack(next);
+						if (index.Full() && !index.Grow(indexBudget)) {
+							PIRE_PROBE1(glue_end, 0);
+							return false;
+						}
+					}
+					row[letter.second.first] = found.first;
+				}
+				for (auto&& dest : row)
+					rows.PushBack(dest);
+			}
+
+			// Only Locals of this scanner are used, for computing the layout
+			ScannerType sc;
+			memset(&sc.m, 0, sizeof(sc.m));
+			sc.m.relocationSignature = Relocatable::Signature;
+			sc.m.shortcuttingSignature = Shortcutting::Signature;
+			sc.m.statesCount = states.Size();
+			sc.m.lettersCount = lettersCount;
+			sc.m.regexpsCount = lhs.RegexpsCount() + rhs.RegexpsCount();
+			sc.m.finalTableSize = finalTableSize + states.Size();
+			sc.m.initial = 0;
+			const size_t rowBytes = sc.RowSize() * sizeof(Transition);
+			if (rowBytes * states.Size() > static_cast<size_t>(std::numeric_limits<i32>::max()))
+				throw Error("Glued scanner is too large for 32-bit transitions");
+
+			SavePodType(out, Pire::Header(ScannerIOTypes::Scanner, sizeof(sc.m)));
+			AlignSave(out, sizeof(Pire::Header));
+			SavePodType(out, sc.m);
+			AlignSave(out, sizeof(sc.m));
+			const bool empty = false;
+			SavePodType(out, empty);
+			AlignSave(out, sizeof(empty));
+
+			// Then goes the buffer, laid out as Scanner::Markup() expects
+
+			TVector<Letter> letterMap(MaxChar, 0);
+			TVector< TVector<char> > letterChars(sc.RowSize());
+			for (auto&& letter : letters)
+				for (auto&& ch : letter.second.second)
+					letterMap[ch] = letter.second.first + ScannerType::HEADER_SIZE;
+			for (unsigned ch = 0; ch != 1 << (sizeof(char)*8); ++ch)
+				letterChars[letterMap[ch]].push_back(ch);
+			SavePodArray(out, &letterMap[0], MaxChar);
+			size_t written = MaxChar * sizeof(Letter);
+
+			TVector<size_t> finals;
+			for (size_t i = 0; i != states.Size(); ++i) {
+				const GluedState st = states[i];
+				finals.clear();
+				Shift(lhs.AcceptedRegexps(lhs.IndexToState(st.first)), 0, std::back_inserter(finals));
+				Shift(rhs.AcceptedRegexps(rhs.IndexToState(st.second)), lhs.RegexpsCount(), std::back_inserter(finals));
+				finals.push_back(static_cast<size_t>(-1));
+				SavePodArray(out, &finals[0], finals.size());
+			}
+			written += sc.m.finalTableSize * sizeof(size_t);
+
+			size_t finalIndex = 0;
+			for (size_t i = 0; i != states.Size(); ++i) {
+				const GluedState st = states[i];
+				SavePodType(out, finalIndex);
+				finalIndex += RangeLen(lhs.AcceptedRegexps(lhs.IndexToState(st.first)))
+					+ RangeLen(rhs.AcceptedRegexps(rhs.IndexToState(st.second))) + 1;
+			}
+			written += states.Size() * sizeof(size_t);
+
+			TVector<Transition> transitions(sc.RowSize());
+			for (size_t i = 0; i != states.Size(); ++i) {
+				std::fill(transitions.begin(), transitions.end(), 0);
+				for (size_t let = 0; let != lettersCount; ++let)
+					transitions[let + ScannerType::HEADER_SIZE] = static_cast<Transition>((rows[i * lettersCount + let] - i) * rowBytes);
+				if (!Shortcutting::SeparateHeaders) {
+					RowHeader header = MakeHeader<ScannerType>(lhs, rhs, states[i], letterChars, lettersCount, rows, i);
+					memcpy(&transitions[0], &header, sizeof(header));
+				}
+				SavePodArray(out, &transitions[0], transitions.size());
+			}
+			written += states.Size() * rowBytes;
+
+			if (Shortcutting::SeparateHeaders) {
+				TVector<char> stride(ScannerType::HEADER_STRIDE, 0);
+				for (size_t i = 0; i != states.Size(); ++i) {
+					RowHeader header = MakeHeader<ScannerType>(lhs, rhs, states[i], letterChars, lettersCount, rows, i);
+					memcpy(&stride[0], &header, sizeof(header));
+					SavePodArray(out, &stride[0], stride.size());
+				}
+				written += states.Size() * ScannerType::HEADER_STRIDE;
+			}
+
+			Y_ASSERT(written <= sc.BufSize());
+			for (; written != sc.BufSize(); ++written)
+				SavePodType(out, '\0');
+			PIRE_PROBE1(glue_end, states.Size());
+			return true;
+		}
+
+	private:
+		template<class Iter>
+		static size_t RangeLen(ypair<Iter, Iter> range)
+		{
+			return std::distance(range.first, range.second);
+		}
+
+		template<class Iter, class OutIter>
+		static void Shift(ypair<Iter, Iter> range, size_t shift, OutIter out)
+		{
+			for (; range.first != range.second; ++range.first, ++out)
+				*out = *range.first + shift;
+		}
+
+		template<class ScannerType>
+		static typename ScannerType::ScannerRowHeader MakeHeader(const ScannerType& lhs, const ScannerType& rhs,
+			ypair<ui32, ui32> st, const TVector< TVector<char> >& letterChars, size_t lettersCount, SpilledArray<ui32>& rows, size_t i)
+		{
+			const size_t l = lhs.IndexToState(st.first);
+			const size_t r = rhs.IndexToState(st.second);
+			typename ScannerType::ScannerRowHeader header = typename ScannerType::ScannerRowHeader();
+			header.Common.Flags = ((lhs.Final(l) || rhs.Final(r)) ? ScannerType::FinalFlag : 0)
+				| ((lhs.Dead(l) && rhs.Dead(r)) ? ScannerType::DeadFlag : 0);
+			ScannerType::BuildShortcuts(header, letterChars, lettersCount, [&rows, i, lettersCount](size_t let) {
+				return rows[i * lettersCount + let - ScannerType::HEADER_SIZE] != i;
+			});
+			return header;
+		}
+	};
+}
+
+/// Memory budget used by GlueToStream() by default
+static const size_t DefaultGlueMemoryBudget = 256 << 20;
+
+/**
+ * Agglutinates two scanners just like Scanner::Glue() does, but writes the result
+ * directly to @p out in the format of Save(), so it can be loaded or mmap()-ed later.
+ *
+ * The glued scanner is never kept in memory: its transition rows and states
+ * are spilled to temporary files (created with tmpfile()) as they are found,
+ * and then streamed to the output. The only structure held in memory is
+ * the index of glued states, taking about 24 bytes per state; if it does not fit
+ * into @p memoryBudget, or the result has more than @p maxSize states
+ * (zero means no limit), the function returns false without writing anything.
+ */
+template<class Shortcutting>
+bool GlueToStream(const Impl::Scanner<Impl::Relocatable, Shortcutting>& lhs, const Impl::Scanner<Impl::Relocatable, Shortcutting>& rhs,
+	yostream* out, size_t memoryBudget = DefaultGlueMemoryBudget, size_t maxSize = 0)
+{
+	return Impl::ExternalGlue::Glue(lhs, rhs, out, memoryBudget, maxSize);
+}
+
+}
+
+#endif
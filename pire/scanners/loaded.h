@@ -29,6 +29,7 @@
 #include "../approx_matching.h"
 #include "../fsm.h"
 #include "../partition.h"
+#include "../probes.h"
 
 #ifdef PIRE_DEBUG
 #include <iostream>
@@ -76,16 +77,28 @@ public:
 protected:
 	LoadedScanner() { Alias(Null()); }
 
+	/// Copies share the buffer of an in-memory scanner (or the memory of an mmap()-ed one)
 	LoadedScanner(const LoadedScanner& s): m(s.m)
 	{
-		if (s.m_buffer) {
-			m_buffer = BufferType(new char [BufSize()]);
-			memcpy(m_buffer.get(), s.m_buffer.get(), BufSize());
-			Markup(m_buffer.get());
-			m.initial = (InternalState)m_jumps + (s.m.initial - (InternalState)s.m_jumps);
-		} else {
-			Alias(s);
-		}
+		Alias(s);
+		m_buffer = s.m_buffer;
+	}
+
+	/// Gives the scanner a private copy of its tables, so it can be safely modified.
+	/// Subclasses use it to implement Clone().
+	void Unshare()
+	{
+		if (Empty())
+			return;
+		LoadedScanner s;
+		memcpy(&s.m, &m, sizeof(m));
+		s.m_buffer = BufferType(BufSize());
+		s.Markup(s.m_buffer.get());
+		memcpy(s.m_letters, m_letters, MaxChar * sizeof(*m_letters));
+		memcpy(s.m_jumps, m_jumps, m.statesCount * m.lettersCount * sizeof(*m_jumps));
+		memcpy(s.m_tags, m_tags, m.statesCount * sizeof(*m_tags));
+		s.m.initial = (InternalState) s.m_jumps + (m.initial - (InternalState) m_jumps);
+		Swap(s);
 	}
 
 	void Swap(LoadedScanner& s)
@@ -147,6 +160,7 @@ public:
 		s.m.initial += reinterpret_cast<size_t>(s.m_jumps);
 		Swap(s);
 
+		PIRE_PROBE3(mmap, header.Type, Size(), reinterpret_cast<const char*>(p) - reinterpret_cast<const char*>(ptr));
 		return (const void*) p;
 	}
 
@@ -161,7 +175,7 @@ public:
 		m.statesCount = states;
 		m.lettersCount = letters.Size();
 		m.regexpsCount = regexpsCount;
-		m_buffer = BufferType(new char[BufSize()]);
+		m_buffer = BufferType(BufSize());
 		memset(m_buffer.get(), 0, BufSize());
 		Markup(m_buffer.get());
 
@@ -186,7 +200,7 @@ public:
 
 	void SetJump(size_t oldState, Char c, size_t newState, Action action)
 	{
-		Y_ASSERT(m_buffer);
+		Y_ASSERT(m_buffer && !m_buffer.Shared());
 		Y_ASSERT(oldState < m.statesCount);
 		Y_ASSERT(newState < m.statesCount);
 
@@ -199,8 +213,8 @@ public:
 
 	Action RemapAction(Action action) { return action; }
 
-	void SetInitial(size_t state) { Y_ASSERT(m_buffer); m.initial = reinterpret_cast<size_t>(m_jumps + state * m.lettersCount); }
-	void SetTag(size_t state, Tag tag) { Y_ASSERT(m_buffer); m_tags[state] = tag; }
+	void SetInitial(size_t state) { Y_ASSERT(m_buffer && !m_buffer.Shared()); m.initial = reinterpret_cast<size_t>(m_jumps + state * m.lettersCount); }
+	void SetTag(size_t state, Tag tag) { Y_ASSERT(m_buffer && !m_buffer.Shared()); m_tags[state] = tag; }
 	void FinishBuild() {}
 
 	size_t StateIdx(InternalState s) const
@@ -208,6 +222,11 @@ public:
 		return (reinterpret_cast<Transition*>(s) - m_jumps) / m.lettersCount;
 	}
 
+	InternalState IdxToState(size_t idx) const
+	{
+		return reinterpret_cast<InternalState>(m_jumps + idx * m.lettersCount);
+	}
+
 	i64 SignExtend(i32 i) const { return i; }
 
 	size_t BufSize() const
@@ -233,7 +252,7 @@ protected:
 		size_t initial;
 	} m;
 
-	using BufferType = std::unique_ptr<char[]>;
+	using BufferType = Impl::SharedArray<char>;
 	BufferType m_buffer;
 
 	Letter* m_letters;
@@ -274,7 +293,7 @@ private:
 	void Alias(const LoadedScanner& s)
 	{
 		memcpy(&m, &s.m, sizeof(m));
-		m_buffer = 0;
+		m_buffer.reset();
 		m_letters = s.m_letters;
 		m_jumps = s.m_jumps;
 		m_tags = s.m_tags;
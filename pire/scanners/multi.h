@@ -32,6 +32,7 @@
 #include "../fsm.h"
 #include "../partition.h"
 #include "../run.h"
+#include "../probes.h"
 #include "../static_assert.h"
 #include "../stub/saveload.h"
 #include "../stub/lexical_cast.h"
@@ -50,6 +51,9 @@ namespace Impl {
 	template<class T>
 	class ScannerGlueTask;
 
+	template<class T>
+	class ScannerProductTask;
+
 	// This strategy allows to mmap() saved representation of a scanner. This is achieved by
 	// storing shifts instead of addresses in the transition table.
 	struct Relocatable {
@@ -193,15 +197,20 @@ public:
 
 	void TakeAction(State&, Action) const {}
 
+	/// Copies share the buffer of an in-memory scanner (or the memory of an mmap()-ed one)
 	Scanner(const Scanner& s): m(s.m)
 	{
-		if (!s.m_buffer) {
-			// Empty or mmap()-ed scanner
-			Alias(s);
-		} else {
-			// In-memory scanner
-			DeepCopy(s);
-		}
+		Alias(s);
+		m_buffer = s.m_buffer;
+	}
+
+	/// Returns a copy of the scanner having a private buffer, which can be safely modified
+	Scanner Clone() const
+	{
+		Scanner s;
+		if (!Empty())
+			s.DeepCopy(*this);
+		return s;
 	}
 
 	Scanner(Scanner&& s)
@@ -210,8 +219,9 @@ public:
 		Swap(s);
 	}
 
-	template<class AnotherRelocation>
-	Scanner(const Scanner<AnotherRelocation, Shortcutting>& s)
+	/// Converts a scanner to another relocation strategy and/or row header layout
+	template<class AnotherRelocation, class AnotherShortcutting>
+	Scanner(const Scanner<AnotherRelocation, AnotherShortcutting>& s)
 	{
 		if (s.Empty())
 			Alias(Null());
@@ -233,6 +243,9 @@ public:
 		DoSwap(m_final, s.m_final);
 		DoSwap(m_finalIndex, s.m_finalIndex);
 		DoSwap(m_transitions, s.m_transitions);
+		DoSwap(m_headers, s.m_headers);
+		DoSwap(m_rowShift, s.m_rowShift);
+		DoSwap(m_rowInverse, s.m_rowInverse);
 	}
 
 	Scanner& operator = (const Scanner& s) { Scanner(s).Swap(*this); return *this; }
@@ -275,6 +288,7 @@ public:
 		}
 
 		Swap(s);
+		PIRE_PROBE3(mmap, ScannerIOTypes::Scanner, Size(), reinterpret_cast<const char*>(p) - reinterpret_cast<const char*>(ptr));
 		return Impl::AlignPtr(p, size);
 	}
 
@@ -283,6 +297,21 @@ public:
 		return (s - reinterpret_cast<size_t>(m_transitions)) / (RowSize() * sizeof(Transition));
 	}
 
+	/// Inverse of StateIndex(): returns the state having the given index
+	State IndexToState(size_t stateIndex) const
+	{
+		return reinterpret_cast<size_t>(m_transitions + stateIndex * RowSize());
+	}
+
+	/// Packed states take this many 32-bit words (see PackState())
+	size_t PackedStateSize() const { return 1; }
+
+	/// Packs the state into PackedStateSize() words. Unlike states, packed states
+	/// do not depend on the scanner's address, so they remain valid after
+	/// the same scanner image has been reloaded (or mapped by another process).
+	void PackState(const State& s, ui32* packed) const { *packed = static_cast<ui32>(StateIndex(s)); }
+	void UnpackState(const ui32* packed, State& s) const { s = IndexToState(*packed); }
+
 	/**
 	 * Agglutinates two scanners together, producing a larger scanner.
 	 * Checkig a string against that scanner effectively checks them against both agglutinated regexps
@@ -293,6 +322,22 @@ public:
 	 */
 	static Scanner Glue(const Scanner& a, const Scanner& b, size_t maxSize = 0);
 
+	/**
+	 * Set operations over compiled (or mmap()-ed) scanners, so they can be
+	 * combined without going back to the patterns they were built from.
+	 *
+	 * Intersect() and Subtract() accept strings accepted by @p a and,
+	 * respectively, either accepted or not accepted by @p b; AcceptedRegexps()
+	 * of the result report regexps of @p a. Complement() accepts strings
+	 * not accepted by @p a (with the result having a single regexp).
+	 *
+	 * Like Glue(), these return a default-constructed scanner if the result
+	 * would exceed @p maxSize states. Complement() of an empty scanner throws.
+	 */
+	static Scanner Intersect(const Scanner& a, const Scanner& b, size_t maxSize = 0);
+	static Scanner Subtract(const Scanner& a, const Scanner& b, size_t maxSize = 0);
+	static Scanner Complement(const Scanner& a, size_t maxSize = 0);
+
 	// Returns the size of the memory buffer used (or required) by scanner.
 	size_t BufSize() const
 	{
@@ -300,15 +345,16 @@ public:
 			MaxChar * sizeof(Letter)                           // Letters translation table
 			+ m.finalTableSize * sizeof(size_t)                // Final table
 			+ m.statesCount * sizeof(size_t)                   // Final index
-			+ RowSize() * m.statesCount * sizeof(Transition),  // Transitions table
+			+ RowSize() * m.statesCount * sizeof(Transition)   // Transitions table
+			+ HEADER_STRIDE * m.statesCount,                   // Row headers, if stored apart
 		sizeof(size_t));
 	}
 
 	void Save(yostream*) const;
 	void Load(yistream*);
 
-	ScannerRowHeader& Header(State s) { return *(ScannerRowHeader*) s; }
-	const ScannerRowHeader& Header(State s) const { return *(const ScannerRowHeader*) s; }
+	ScannerRowHeader& Header(State s) { return *(ScannerRowHeader*) HeaderAddress(s); }
+	const ScannerRowHeader& Header(State s) const { return *(const ScannerRowHeader*) HeaderAddress(s); }
 
 protected:
 
@@ -322,7 +368,7 @@ protected:
 		size_t shortcuttingSignature;
 	} m;
 
-	using BufferType = std::unique_ptr<char[]>;
+	using BufferType = Impl::SharedArray<char>;
 	BufferType m_buffer;
 	Letter* m_letters;
 
@@ -331,6 +377,15 @@ protected:
 
 	Transition* m_transitions;
 
+	/// Row headers, if they are stored apart from transitions (see SplitRowHeaders)
+	char* m_headers;
+
+	/// A transition row offset divided by the row size equals
+	/// (offset >> m_rowShift) * m_rowInverse; this avoids a division
+	/// when looking up a header stored apart from its row.
+	size_t m_rowShift;
+	size_t m_rowInverse;
+
 	// Only used to force Null() call during static initialization, when Null()::n can be
 	// initialized safely by compilers that don't support thread safe static local vars
 	// initialization
@@ -346,9 +401,25 @@ protected:
 	// Returns transition row size in Transition's. Row size_in bytes should be a multiple of sizeof(MaxSizeWord)
 	size_t RowSize() const { return AlignUp(m.lettersCount + HEADER_SIZE, sizeof(MaxSizeWord)/sizeof(Transition)); }
 
-	static const size_t HEADER_SIZE = sizeof(ScannerRowHeader) / sizeof(Transition);
+	/// Size of the row header embedded into each transition row, in Transition's
+	static const size_t HEADER_SIZE = Shortcutting::SeparateHeaders ? 0 : sizeof(ScannerRowHeader) / sizeof(Transition);
 	PIRE_STATIC_ASSERT(sizeof(ScannerRowHeader) % sizeof(Transition) == 0);
 
+	/// Distance between row headers stored apart from transitions, in bytes.
+	/// Keeps exit masks aligned the same way as they are in embedded headers.
+	static const size_t HEADER_STRIDE = Shortcutting::SeparateHeaders
+		? (sizeof(ScannerRowHeader) + sizeof(MaxSizeWord) - 1) / sizeof(MaxSizeWord) * sizeof(MaxSizeWord)
+		: 0;
+
+	size_t HeaderAddress(State s) const
+	{
+		if (!Shortcutting::SeparateHeaders)
+			return s;
+		size_t row = ((s - reinterpret_cast<size_t>(m_transitions)) >> m_rowShift) * m_rowInverse;
+		PIRE_IFDEBUG(Y_ASSERT(row == StateIndex(s)));
+		return reinterpret_cast<size_t>(m_headers + row * HEADER_STRIDE);
+	}
+
 	template<class Eq>
 	void Init(size_t states, const Partition<Char, Eq>& letters, size_t finalStatesCount, size_t startState, size_t regexpsCount = 1)
 	{
@@ -360,7 +431,7 @@ protected:
 		m.regexpsCount = regexpsCount;
 		m.finalTableSize = finalStatesCount + states;
 
-		m_buffer = BufferType(new char[BufSize() + sizeof(size_t)]);
+		m_buffer = BufferType(BufSize() + sizeof(size_t));
 		memset(m_buffer.get(), 0, BufSize() + sizeof(size_t));
 		Markup(AlignUp(m_buffer.get(), sizeof(size_t)));
 
@@ -385,6 +456,15 @@ protected:
 		m_final	      = reinterpret_cast<size_t*>(m_letters + MaxChar);
 		m_finalIndex  = reinterpret_cast<size_t*>(m_final + m.finalTableSize);
 		m_transitions = reinterpret_cast<Transition*>(m_finalIndex + m.statesCount);
+		m_headers     = reinterpret_cast<char*>(m_transitions + RowSize() * m.statesCount);
+
+		// Row size is odd * 2^shift; odd numbers are invertible modulo 2^N
+		size_t odd = RowSize() * sizeof(Transition);
+		for (m_rowShift = 0; !(odd & 1); ++m_rowShift)
+			odd >>= 1;
+		m_rowInverse = odd;
+		for (size_t i = 0; i != 6; ++i)
+			m_rowInverse *= 2 - odd * m_rowInverse;
 	}
 
 	// Makes a shallow ("weak") copy of the given scanner.
@@ -397,20 +477,23 @@ protected:
 		m_final = s.m_final;
 		m_finalIndex = s.m_finalIndex;
 		m_transitions = s.m_transitions;
+		m_headers = s.m_headers;
+		m_rowShift = s.m_rowShift;
+		m_rowInverse = s.m_rowInverse;
 	}
 	
-	template<class AnotherRelocation>
-	void DeepCopy(const Scanner<AnotherRelocation, Shortcutting>& s)
+	template<class AnotherRelocation, class AnotherShortcutting>
+	void DeepCopy(const Scanner<AnotherRelocation, AnotherShortcutting>& s)
 	{
 		// Don't want memory leaks, but we cannot free the buffer because there might be aliased instances
-		Y_ASSERT(m_buffer == nullptr);
+		Y_ASSERT(!m_buffer);
 
 		// Ensure that specializations of Scanner across different Relocations do not touch its Locals
 		PIRE_STATIC_ASSERT(sizeof(m) == sizeof(s.m));
 		memcpy(&m, &s.m, sizeof(s.m));
 		m.relocationSignature = Relocation::Signature;
 		m.shortcuttingSignature = Shortcutting::Signature;
-		m_buffer = BufferType(new char[BufSize() + sizeof(size_t)]);
+		m_buffer = BufferType(BufSize() + sizeof(size_t));
 		std::memset(m_buffer.get(), 0, BufSize() + sizeof(size_t));
 		Markup(AlignUp(m_buffer.get(), sizeof(size_t)));
 
@@ -429,8 +512,8 @@ protected:
 			size_t oldstate = s.IndexToState(st);
 			size_t newstate = IndexToState(st);
 			Header(newstate) = s.Header(oldstate);
-			const typename Scanner<AnotherRelocation, Shortcutting>::Transition* os
-				= reinterpret_cast<const typename Scanner<AnotherRelocation, Shortcutting>::Transition*>(oldstate);
+			const typename Scanner<AnotherRelocation, AnotherShortcutting>::Transition* os
+				= reinterpret_cast<const typename Scanner<AnotherRelocation, AnotherShortcutting>::Transition*>(oldstate);
 			Transition* ns = reinterpret_cast<Transition*>(newstate);
 
 			for (size_t let = 0; let != LettersCount(); ++let) {
@@ -444,14 +527,9 @@ protected:
 	}
 
 
-	size_t IndexToState(size_t stateIndex) const
-	{
-		return reinterpret_cast<size_t>(m_transitions + stateIndex * RowSize());
-	}
-
 	void SetJump(size_t oldState, Char c, size_t newState, unsigned long /*payload*/ = 0)
 	{
-		Y_ASSERT(m_buffer);
+		Y_ASSERT(m_buffer && !m_buffer.Shared());
 		Y_ASSERT(oldState < m.statesCount);
 		Y_ASSERT(newState < m.statesCount);
 
@@ -463,60 +541,71 @@ protected:
 
 	void SetInitial(size_t state)
 	{
-		Y_ASSERT(m_buffer);
+		Y_ASSERT(m_buffer && !m_buffer.Shared());
 		m.initial = IndexToState(state);
 	}
 
 	void SetTag(size_t state, size_t value)
 	{
-		Y_ASSERT(m_buffer);
+		Y_ASSERT(m_buffer && !m_buffer.Shared());
 		Header(IndexToState(state)).Common.Flags = value;
 	}
 
 	// Fill shortcut masks for all the states
 	void BuildShortcuts()
 	{
-		Y_ASSERT(m_buffer);
+		Y_ASSERT(m_buffer && !m_buffer.Shared());
 
 		// Build the mapping from letter classes to characters
 		TVector< TVector<char> > letters(RowSize());
 		for (unsigned ch = 0; ch != 1 << (sizeof(char)*8); ++ch)
 			letters[m_letters[ch]].push_back(ch);
 
-		// Loop through all states in the transition table and
-		// check if it is possible to setup shortcuts
 		for (size_t i = 0; i != Size(); ++i) {
 			State st = IndexToState(i);
-			ScannerRowHeader& header = Header(st);
-			Shortcutting::SetNoExit(header);
-			size_t ind = 0;
-			size_t let = HEADER_SIZE;
-			for (; let != LettersCount() + HEADER_SIZE; ++let) {
-				// Check if the transition is not the same state
-				if (Relocation::Go(st, reinterpret_cast<const Transition*>(st)[let]) != st) {
-					if (ind + letters[let].size() > Shortcutting::ExitMaskCount)
-						break;
-					// For each character setup a mask
-					for (auto&& character : letters[let]) {
-						Shortcutting::SetMask(header, ind, character);
-						++ind;
-					}
+			const Transition* row = reinterpret_cast<const Transition*>(st);
+			BuildShortcuts(Header(st), letters, LettersCount(), [st, row](size_t let) {
+				return Relocation::Go(st, row[let]) != st;
+			});
+		}
+	}
+
+	/**
+	 * Fills shortcut masks of a single state, given the mapping from letter classes
+	 * (including HEADER_SIZE) to characters and a predicate telling
+	 * whether a transition by the letter class leads out of the state.
+	 */
+	template<class LeavesState>
+	static void BuildShortcuts(ScannerRowHeader& header, const TVector< TVector<char> >& letters, size_t lettersCount, LeavesState leaves)
+	{
+		Shortcutting::SetNoExit(header);
+		size_t ind = 0;
+		size_t let = HEADER_SIZE;
+		for (; let != lettersCount + HEADER_SIZE; ++let) {
+			// Check if the transition is not the same state
+			if (leaves(let)) {
+				if (ind + letters[let].size() > Shortcutting::ExitMaskCount)
+					break;
+				// For each character setup a mask
+				for (auto&& character : letters[let]) {
+					Shortcutting::SetMask(header, ind, character);
+					++ind;
 				}
 			}
+		}
 
-			if (let != LettersCount() + HEADER_SIZE) {
-				// Not enough space in ExitMasks, so reset all masks (which leads to bypassing the optimization)
-				Shortcutting::SetNoShortcut(header);
-			}
-			// Fill the rest of the shortcut masks with the last used mask
-			Shortcutting::FinishMasks(header, ind);
+		if (let != lettersCount + HEADER_SIZE) {
+			// Not enough space in ExitMasks, so reset all masks (which leads to bypassing the optimization)
+			Shortcutting::SetNoShortcut(header);
 		}
+		// Fill the rest of the shortcut masks with the last used mask
+		Shortcutting::FinishMasks(header, ind);
 	}
 
 	// Fills final states table and builds shortcuts if possible
 	void FinishBuild()
 	{
-		Y_ASSERT(m_buffer);
+		Y_ASSERT(m_buffer && !m_buffer.Shared());
 		auto finalWriter = m_final;
 		for (size_t state = 0; state != Size(); ++state) {
 			m_finalIndex[state] = finalWriter - m_final;
@@ -542,11 +631,13 @@ protected:
 	typedef State InternalState; // Needed for agglutination
 	friend class ScannerGlueCommon<Scanner>;
 	friend class ScannerGlueTask<Scanner>;
+	friend class ScannerProductTask<Scanner>;
 
 	template<class AnotherRelocation, class AnotherShortcutting>
 	friend class Scanner;
 
     friend struct ScannerSaver;
+	friend struct ExternalGlue;
 
 #ifndef PIRE_DEBUG
 	friend struct AlignedRunner< Scanner<Relocation, Shortcutting> >;
@@ -590,12 +681,13 @@ struct ScannerSaver {
 		if (empty) {
 			sc.Alias(ScannerType::Null());
 		} else {
-			sc.m_buffer = std::unique_ptr<char[]>(new char[sc.BufSize()]);
+			sc.m_buffer = typename ScannerType::BufferType(sc.BufSize());
 			Impl::AlignedLoadArray(s, sc.m_buffer.get(), sc.BufSize());
 			sc.Markup(sc.m_buffer.get());
 			sc.m.initial += reinterpret_cast<size_t>(sc.m_transitions);
 		}
 		scanner.Swap(sc);
+		PIRE_PROBE3(load, ScannerIOTypes::Scanner, scanner.Size(), empty ? 0 : scanner.BufSize());
 	}
 
 	// TODO: implement more effective serialization
@@ -688,9 +780,9 @@ private:
 	};	
 
 	// Compares the ExitMask[0] value without SSE reads which seems to be more optimal
-	template <class Relocation>
+	template <class ScannerType>
 	static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
-	bool CheckFirstMask(const Scanner<Relocation, ExitMasks<MaskCount> >& scanner, typename Scanner<Relocation, ExitMasks<MaskCount> >::State state, size_t val)
+	bool CheckFirstMask(const ScannerType& scanner, typename ScannerType::State state, size_t val)
 	{
 		return (scanner.Header(state).Mask(0) == val);
 	}
@@ -699,6 +791,7 @@ public:
 
 	static const size_t ExitMaskCount = MaskCount;
 	static const size_t Signature = 0x2000 + MaskCount;
+	static const bool SeparateHeaders = false;
 
 	template <class Scanner>
 	struct ExtendedRowHeader {
@@ -797,25 +890,25 @@ public:
 		}
 	}
 
-	template <class Relocation>
+	template <class ScannerType>
 	static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
-	bool NoExit(const Scanner<Relocation, ExitMasks<MaskCount> >& scanner, typename Scanner<Relocation, ExitMasks<MaskCount> >::State state)
+	bool NoExit(const ScannerType& scanner, typename ScannerType::State state)
 	{
 		return CheckFirstMask(scanner, state, NO_EXIT_MASK);
 	}
 
-	template <class Relocation>
+	template <class ScannerType>
 	static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
-	bool NoShortcut(const Scanner<Relocation, ExitMasks<MaskCount> >& scanner, typename Scanner<Relocation, ExitMasks<MaskCount> >::State state)
+	bool NoShortcut(const ScannerType& scanner, typename ScannerType::State state)
 	{
 		return CheckFirstMask(scanner, state, NO_SHORTCUT_MASK);
 	}
 
-	template <class Relocation>
+	template <class ScannerType>
 	static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
-	const Word* Run(const Scanner<Relocation, ExitMasks<MaskCount> >& scanner, typename Scanner<Relocation, ExitMasks<MaskCount> >::State state, size_t alignOffset, const Word* begin, const Word* end)
+	const Word* Run(const ScannerType& scanner, typename ScannerType::State state, size_t alignOffset, const Word* begin, const Word* end)
 	{
-		return MaskChecker<typename Scanner<Relocation, ExitMasks<MaskCount> >::ScannerRowHeader, 0, MaskCount - 1>::Run(scanner.Header(state), alignOffset, begin, end);
+		return MaskChecker<typename ScannerType::ScannerRowHeader, 0, MaskCount - 1>::Run(scanner.Header(state), alignOffset, begin, end);
 	}
 
 };
@@ -826,6 +919,7 @@ struct NoShortcuts {
 
 	static const size_t ExitMaskCount = 0;
 	static const size_t Signature = 0x1000;
+	static const bool SeparateHeaders = false;
 
 	template <class Scanner>
 	struct ExtendedRowHeader {
@@ -852,31 +946,43 @@ struct NoShortcuts {
 	template <class Header>
 	static void FinishMasks(Header&, size_t) {}
 
-	template <class Relocation>
+	template <class ScannerType>
 	static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
-	bool NoExit(const Scanner<Relocation, NoShortcuts>&, typename Scanner<Relocation, NoShortcuts>::State)
+	bool NoExit(const ScannerType&, typename ScannerType::State)
 	{
 		// Cannot exit prematurely
 		return false;
 	}
 
-	template <class Relocation>
+	template <class ScannerType>
 	static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
-	bool NoShortcut(const Scanner<Relocation, NoShortcuts>&, typename Scanner<Relocation, NoShortcuts>::State)
+	bool NoShortcut(const ScannerType&, typename ScannerType::State)
 	{
 		// There's no shortcut regardless of the state
 		return true;
 	}
 
-	template <class Relocation>
+	template <class ScannerType>
 	static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
-	const Word* Run(const Scanner<Relocation, NoShortcuts>&, typename Scanner<Relocation, NoShortcuts>::State, size_t, const Word* begin, const Word*)
+	const Word* Run(const ScannerType&, typename ScannerType::State, size_t, const Word* begin, const Word*)
 	{
 		// Stop shortcutting right at the beginning
 		return begin;
 	}
 };
 
+// Same shortcutting policy, but row headers (state flags and exit masks)
+// are kept in a separate array instead of preceding each transition row.
+// For scanners with few letter classes headers take more space than
+// transitions do, so keeping them apart makes rows several times smaller
+// and lets more of them fit into cache. On the other hand, Final(), Dead()
+// and shortcut checks become slightly more expensive.
+template<class Shortcutting>
+struct SplitRowHeaders: public Shortcutting {
+	static const size_t Signature = 0x10000 + Shortcutting::Signature;
+	static const bool SeparateHeaders = true;
+};
+
 #ifndef PIRE_DEBUG
 
 // The purpose of this template is to produce a number of ProcessChunk() calls
@@ -1068,6 +1174,135 @@ private:
 }
 
 
+namespace Impl {
+
+/// Builds a product of two scanners accepting states according to a set operation
+template<class Scanner>
+class ScannerProductTask: public ScannerGlueCommon<Scanner> {
+public:
+	typedef ScannerGlueCommon<Scanner> Base;
+	typedef typename Base::State State;
+	using Base::Lhs;
+	using Base::Rhs;
+	using Base::Sc;
+	using Base::Letters;
+
+	typedef GluedStateLookupTable<256*1024, typename Scanner::State> InvStates;
+
+	enum Operation { Intersection, Difference, Complement };
+
+	ScannerProductTask(const Scanner& lhs, const Scanner& rhs, Operation op)
+		: ScannerGlueCommon<Scanner>(lhs, rhs, LettersEquality<Scanner>(lhs.m_letters, rhs.m_letters))
+		, m_op(op)
+	{
+	}
+
+	void AcceptStates(const TVector<State>& states)
+	{
+		m_final.assign(states.size(), false);
+		size_t finalTableSize = states.size();
+		for (size_t state = 0; state != states.size(); ++state) {
+			const State& st = states[state];
+			if (m_op == Intersection)
+				m_final[state] = Lhs().Final(st.first) && Rhs().Final(st.second);
+			else if (m_op == Difference)
+				m_final[state] = Lhs().Final(st.first) && !Rhs().Final(st.second);
+			else
+				m_final[state] = !Lhs().Final(st.first);
+			if (m_final[state])
+				finalTableSize += (m_op == Complement) ? 1 : std::distance(Lhs().AcceptedRegexps(st.first).first, Lhs().AcceptedRegexps(st.first).second);
+		}
+
+		this->SetSc(std::unique_ptr<Scanner>(new Scanner));
+		Sc().Init(states.size(), Letters(), finalTableSize, size_t(0), (m_op == Complement) ? 1 : Lhs().RegexpsCount());
+
+		size_t* finalWriter = Sc().m_final;
+		for (size_t state = 0; state != states.size(); ++state) {
+			Sc().m_finalIndex[state] = finalWriter - Sc().m_final;
+			if (m_final[state] && m_op == Complement)
+				*finalWriter++ = 0;
+			else if (m_final[state])
+				finalWriter = std::copy(Lhs().AcceptedRegexps(states[state].first).first, Lhs().AcceptedRegexps(states[state].first).second, finalWriter);
+			*finalWriter++ = static_cast<size_t>(-1);
+			Sc().SetTag(state, m_final[state] ? Scanner::FinalFlag : 0);
+		}
+		m_preds.assign(states.size(), TVector<size_t>());
+	}
+
+	void Connect(size_t from, size_t to, Char letter)
+	{
+		Sc().SetJump(from, letter, to);
+		if (m_preds[to].empty() || m_preds[to].back() != from)
+			m_preds[to].push_back(from);
+	}
+
+	const Scanner& Success()
+	{
+		// States no final state is reachable from are dead
+		TVector<bool> alive(m_final);
+		TVector<size_t> queue;
+		for (size_t state = 0; state != m_final.size(); ++state)
+			if (m_final[state])
+				queue.push_back(state);
+		while (!queue.empty()) {
+			size_t state = queue.back();
+			queue.pop_back();
+			for (auto&& from : m_preds[state])
+				if (!alive[from]) {
+					alive[from] = true;
+					queue.push_back(from);
+				}
+		}
+		for (size_t state = 0; state != alive.size(); ++state)
+			if (!alive[state])
+				Sc().SetTag(state, Scanner::DeadFlag);
+
+		Sc().BuildShortcuts();
+		return Sc();
+	}
+
+private:
+	Operation m_op;
+	TVector<bool> m_final;
+	TVector< TVector<size_t> > m_preds;
+};
+
+}
+
+template<class Relocation, class Shortcutting>
+Impl::Scanner<Relocation, Shortcutting> Impl::Scanner<Relocation, Shortcutting>::Intersect(const Impl::Scanner<Relocation, Shortcutting>& lhs, const Impl::Scanner<Relocation, Shortcutting>& rhs, size_t maxSize /* = 0 */)
+{
+	if (lhs.Empty() || rhs.Empty())
+		return Impl::Scanner<Relocation, Shortcutting>();
+
+	static const size_t DefMaxSize = 80000;
+	Impl::ScannerProductTask< Impl::Scanner<Relocation, Shortcutting> > task(lhs, rhs, Impl::ScannerProductTask< Impl::Scanner<Relocation, Shortcutting> >::Intersection);
+	return Impl::Determine(task, maxSize ? maxSize : DefMaxSize);
+}
+
+template<class Relocation, class Shortcutting>
+Impl::Scanner<Relocation, Shortcutting> Impl::Scanner<Relocation, Shortcutting>::Subtract(const Impl::Scanner<Relocation, Shortcutting>& lhs, const Impl::Scanner<Relocation, Shortcutting>& rhs, size_t maxSize /* = 0 */)
+{
+	if (lhs.Empty() || rhs.Empty())
+		return lhs;
+
+	static const size_t DefMaxSize = 80000;
+	Impl::ScannerProductTask< Impl::Scanner<Relocation, Shortcutting> > task(lhs, rhs, Impl::ScannerProductTask< Impl::Scanner<Relocation, Shortcutting> >::Difference);
+	return Impl::Determine(task, maxSize ? maxSize : DefMaxSize);
+}
+
+template<class Relocation, class Shortcutting>
+Impl::Scanner<Relocation, Shortcutting> Impl::Scanner<Relocation, Shortcutting>::Complement(const Impl::Scanner<Relocation, Shortcutting>& sc, size_t maxSize /* = 0 */)
+{
+	if (sc.Empty())
+		throw Error("cannot complement an empty scanner");
+
+	// A product of a scanner with itself only has states of the form (s, s)
+	static const size_t DefMaxSize = 80000;
+	Impl::ScannerProductTask< Impl::Scanner<Relocation, Shortcutting> > task(sc, sc, Impl::ScannerProductTask< Impl::Scanner<Relocation, Shortcutting> >::Complement);
+	return Impl::Determine(task, maxSize ? maxSize : DefMaxSize);
+}
+
 template<class Relocation, class Shortcutting>
 struct StDumper< Impl::Scanner<Relocation, Shortcutting> > {
 
@@ -1098,8 +1333,11 @@ Impl::Scanner<Relocation, Shortcutting> Impl::Scanner<Relocation, Shortcutting>:
 		return lhs;
 	
 	static const size_t DefMaxSize = 80000;
+	PIRE_PROBE2(glue_begin, lhs.Size(), rhs.Size());
 	Impl::ScannerGlueTask< Impl::Scanner<Relocation, Shortcutting> > task(lhs, rhs);
-	return Impl::Determine(task, maxSize ? maxSize : DefMaxSize);
+	Impl::Scanner<Relocation, Shortcutting> glued = Impl::Determine(task, maxSize ? maxSize : DefMaxSize);
+	PIRE_PROBE1(glue_end, glued.Size());
+	return glued;
 }
 
 
@@ -1122,6 +1360,16 @@ typedef Impl::Scanner<Impl::Relocatable, Impl::NoShortcuts> ScannerNoMask;
 typedef Impl::Scanner<Impl::Nonrelocatable, Impl::ExitMasks<2> > NonrelocScanner;
 typedef Impl::Scanner<Impl::Nonrelocatable, Impl::NoShortcuts> NonrelocScannerNoMask;
 
+/**
+ * Same as Scanner and NonrelocScanner, but with state flags and exit masks
+ * stored apart from transition rows. Faster for scanners with a small number
+ * of letter classes (see Scanner::LettersCount()), which spend most of the time
+ * stepping rather than checking flags. Can be constructed from
+ * a Scanner (e.g. a glued one) and vice versa.
+ */
+typedef Impl::Scanner<Impl::Relocatable, Impl::SplitRowHeaders< Impl::ExitMasks<2> > > ScannerSplitHeaders;
+typedef Impl::Scanner<Impl::Nonrelocatable, Impl::SplitRowHeaders< Impl::ExitMasks<2> > > NonrelocScannerSplitHeaders;
+
 }
 
 namespace std {
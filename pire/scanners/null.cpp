@@ -4,11 +4,13 @@
 #include "simple.h"
 #include "slow.h"
 #include "loaded.h"
+#include "comb.h"
 
 namespace Pire {
 
 const SimpleScanner* SimpleScanner::m_null = &SimpleScanner::Null();
 const SlowScanner*   SlowScanner  ::m_null = &SlowScanner::Null();
 const LoadedScanner* LoadedScanner::m_null = &LoadedScanner::Null();
+const CombScanner*   CombScanner  ::m_null = &CombScanner::Null();
 
 }
@@ -29,6 +29,7 @@
 #include "../stub/stl.h"
 #include "../stub/defaults.h"
 #include "../stub/saveload.h"
+#include "../probes.h"
 
 namespace Pire {
 
@@ -80,20 +81,24 @@ public:
 
 	bool TakeAction(State&, Action) const { return false; }
 
+	/// Copies share the buffer of an in-memory scanner (or the memory of an mmap()-ed one)
 	SimpleScanner(const SimpleScanner& s): m(s.m)
 	{
-		if (!s.m_buffer) {
-			// Empty or mmap()-ed scanner, just copy pointers
-			m_buffer = 0;
-			m_transitions = s.m_transitions;
-		} else {
-			// In-memory scanner, perform deep copy
-			m_buffer = BufferType(new char[BufSize()]);
-			memcpy(m_buffer.get(), s.m_buffer.get(), BufSize());
-			Markup(m_buffer.get());
-
-			m.initial += (m_transitions - s.m_transitions) * sizeof(Transition);
+		m_buffer = s.m_buffer;
+		m_transitions = s.m_transitions;
+	}
+
+	/// Returns a copy of the scanner having a private buffer, which can be safely modified
+	SimpleScanner Clone() const
+	{
+		SimpleScanner s(*this);
+		if (!Empty()) {
+			s.m_buffer = BufferType(BufSize());
+			memcpy(s.m_buffer.get(), m_transitions, BufSize());
+			s.Markup(s.m_buffer.get());
+			s.m.initial += (s.m_transitions - m_transitions) * sizeof(Transition);
 		}
+		return s;
 	}
 	
 	// Makes a shallow ("weak") copy of the given scanner.
@@ -148,6 +153,7 @@ public:
 			Swap(s);
 			Impl::AdvancePtr(p, size, BufSize());
 		}
+		PIRE_PROBE3(mmap, ScannerIOTypes::SimpleScanner, Size(), reinterpret_cast<const char*>(p) - reinterpret_cast<const char*>(ptr));
 		return Impl::AlignPtr(p, size);
 	}
 
@@ -156,6 +162,21 @@ public:
 		return (s - reinterpret_cast<size_t>(m_transitions)) / (STATE_ROW_SIZE * sizeof(Transition));
 	}
 
+	/// Inverse of StateIndex(): returns the state having the given index
+	State IndexToState(size_t stateIndex) const
+	{
+		return reinterpret_cast<size_t>(m_transitions + stateIndex * STATE_ROW_SIZE + 1);
+	}
+
+	/// Packed states take this many 32-bit words (see PackState())
+	size_t PackedStateSize() const { return 1; }
+
+	/// Packs the state into PackedStateSize() words. Unlike states, packed states
+	/// do not depend on the scanner's address, so they remain valid after
+	/// the same scanner image has been reloaded (or mapped by another process).
+	void PackState(const State& s, ui32* packed) const { *packed = static_cast<ui32>(StateIndex(s)); }
+	void UnpackState(const ui32* packed, State& s) const { s = IndexToState(*packed); }
+
 	// Returns the size of the memory buffer used (or required) by scanner.
 	size_t BufSize() const
 	{
@@ -171,7 +192,7 @@ protected:
 		size_t initial;
 	} m;
 
-	using BufferType = std::unique_ptr<char[]>;
+	using BufferType = Impl::SharedArray<char>;
 	BufferType m_buffer;
 
 	Transition* m_transitions;
@@ -209,7 +230,7 @@ protected:
 
 	void SetJump(size_t oldState, Char c, size_t newState)
 	{
-		Y_ASSERT(m_buffer);
+		Y_ASSERT(m_buffer && !m_buffer.Shared());
 		Y_ASSERT(oldState < m.statesCount);
 		Y_ASSERT(newState < m.statesCount);
 		m_transitions[oldState * STATE_ROW_SIZE + 1 + c]
@@ -220,13 +241,13 @@ protected:
 
 	void SetInitial(size_t state)
 	{
-		Y_ASSERT(m_buffer);
+		Y_ASSERT(m_buffer && !m_buffer.Shared());
 		m.initial = reinterpret_cast<size_t>(m_transitions + state * STATE_ROW_SIZE + 1);
 	}
 
 	void SetTag(size_t state, size_t tag)
 	{
-		Y_ASSERT(m_buffer);
+		Y_ASSERT(m_buffer && !m_buffer.Shared());
 		m_transitions[state * STATE_ROW_SIZE] = tag;
 	}
 
@@ -239,7 +260,7 @@ inline SimpleScanner::SimpleScanner(Fsm& fsm, size_t distance)
 	fsm.Canonize();
 	
 	m.statesCount = fsm.Size();
-	m_buffer = BufferType(new char[BufSize()]);
+	m_buffer = BufferType(BufSize());
 	memset(m_buffer.get(), 0, BufSize());
 	Markup(m_buffer.get());
 	m.initial = reinterpret_cast<size_t>(m_transitions + fsm.Initial() * STATE_ROW_SIZE + 1);
@@ -32,6 +32,7 @@
 #include "../fsm.h"
 #include "../run.h"
 #include "../stub/saveload.h"
+#include "../probes.h"
 
 #ifdef PIRE_DEBUG
 #include <iostream>
@@ -47,6 +48,10 @@ namespace Pire {
  * Thus can be used to handle something sorta /x.{40}$/,
  * where deterministic FSM contains 2^40 states and hence cannot fit
  * in memory.
+ *
+ * Slow scanners can be agglutinated just like deterministic ones
+ * (see Glue()); since no determination is involved, the size of
+ * the result is merely the sum of the sizes of its parts.
  */
 class SlowScanner {
 public:
@@ -63,6 +68,7 @@ public:
 	struct State {
 		TVector<unsigned> states;
 		BitSet flags;
+		mutable TVector<size_t> accepted; ///< Storage for AcceptedRegexps() of glued scanners
 
 		State() {}
 		State(size_t size): flags(size) { states.reserve(size); }
@@ -85,7 +91,7 @@ public:
 	bool Empty() const { return m_finals == Null().m_finals; }
 	
 	size_t Id() const {return (size_t) -1;}
-	size_t RegexpsCount() const { return Empty() ? 0 : 1; }
+	size_t RegexpsCount() const { return Empty() ? 0 : m.regexpsCount; }
 
 	void Initialize(State& state) const
 	{
@@ -105,24 +111,10 @@ public:
 		next.flags.Clear();
 		next.states.clear();
 		for (auto&& state : current.states) {
-			const unsigned* begin = 0;
-			const unsigned* end = 0;
-			if (!m_vecptr) {
-				const size_t* pos = m_jumpPos + state * m.lettersCount + l;
-				begin = m_jumps + pos[0];
-				end = m_jumps + pos[1];
-			} else {
-				const auto& v = (*m_vecptr)[state * m.lettersCount + l];
-				if (!v.empty()) {
-					begin = &v[0];
-					end = &v[0] + v.size();
-				}
-			}
-
-			for (; begin != end; ++begin)
-				if (!next.flags.Test(*begin)) {
-					next.flags.Set(*begin);
-					next.states.push_back(*begin);
+			for (auto jumps = Jumps(state, l); jumps.first != jumps.second; ++jumps.first)
+				if (!next.flags.Test(*jumps.first)) {
+					next.flags.Set(*jumps.first);
+					next.states.push_back(*jumps.first);
 				}
 		}
 
@@ -163,7 +155,18 @@ public:
 	}
 
 	ypair<const size_t*, const size_t*> AcceptedRegexps(const State& s) const {
-		return Final(s) ? Accept() : Deny();
+		if (m.regexpsCount <= 1)
+			return Final(s) ? Accept() : Deny();
+		s.accepted.clear();
+		for (auto&& state : s.states) {
+			auto accepted = StateAcceptedRegexps(state);
+			s.accepted.insert(s.accepted.end(), accepted.first, accepted.second);
+		}
+		std::sort(s.accepted.begin(), s.accepted.end());
+		s.accepted.erase(std::unique(s.accepted.begin(), s.accepted.end()), s.accepted.end());
+		if (s.accepted.empty())
+			return Deny();
+		return ymake_pair<const size_t*, const size_t*>(s.accepted.data(), s.accepted.data() + s.accepted.size());
 	}
 
 	bool CanStop(const State& s) const {
@@ -195,8 +198,13 @@ public:
 			Impl::MapPtr(s.m_jumps, s.m_jumpPos[s.m.statesCount * s.m.lettersCount], p, size);
 			if (need_actions)
 				Impl::MapPtr(s.m_actions, s.m_jumpPos[s.m.statesCount * s.m.lettersCount], p, size);
+			if (s.m.regexpsCount > 1) {
+				Impl::MapPtr(s.m_acceptPos, s.m.statesCount + 1, p, size);
+				Impl::MapPtr(s.m_accept, s.m_acceptPos[s.m.statesCount], p, size);
+			}
 			Swap(s);
 		}
+		PIRE_PROBE3(mmap, ScannerIOTypes::SlowScanner, Size(), reinterpret_cast<const char*>(p) - reinterpret_cast<const char*>(ptr));
 		return (const void*) p;
 	}
 
@@ -209,7 +217,10 @@ public:
 		DoSwap(m.statesCount, s.m.statesCount);
 		DoSwap(m.lettersCount, s.m.lettersCount);
 		DoSwap(m.start, s.m.start);
+		DoSwap(m.regexpsCount, s.m.regexpsCount);
 		DoSwap(m_letters, s.m_letters);
+		DoSwap(m_acceptPos, s.m_acceptPos);
+		DoSwap(m_accept, s.m_accept);
 		DoSwap(m_pool, s.m_pool);
 		DoSwap(m_vec, s.m_vec);
 		
@@ -235,6 +246,8 @@ public:
 			m_actions = s.m_actions;
 			m_jumpPos = s.m_jumpPos;
 			m_letters = s.m_letters;
+			m_acceptPos = s.m_acceptPos;
+			m_accept = s.m_accept;
 			m_vecptr = 0;
 		} else {
 			// In-memory scanner, perform deep copy
@@ -245,6 +258,14 @@ public:
 			m_actions = 0;
 			alloc(m_finals, m.statesCount);
 			memcpy(m_finals, s.m_finals, sizeof(*m_finals) * m.statesCount);
+			m_acceptPos = 0;
+			m_accept = 0;
+			if (m.regexpsCount > 1) {
+				alloc(m_acceptPos, m.statesCount + 1);
+				memcpy(m_acceptPos, s.m_acceptPos, sizeof(*m_acceptPos) * (m.statesCount + 1));
+				alloc(m_accept, m_acceptPos[m.statesCount]);
+				memcpy(m_accept, s.m_accept, sizeof(*m_accept) * m_acceptPos[m.statesCount]);
+			}
 			m_vecptr = &m_vec;
 		}
 	}
@@ -261,6 +282,7 @@ public:
 
 		m.statesCount = fsm.Size();
 		m.lettersCount = fsm.Letters().Size();
+		m.regexpsCount = 1;
 
 		m_vec.resize(m.statesCount * m.lettersCount);
 		if (need_actions)
@@ -270,6 +292,8 @@ public:
 		m_jumps = 0;
 		m_actions = 0;
 		m_jumpPos = 0;
+		m_acceptPos = 0;
+		m_accept = 0;
 		alloc(m_finals, m.statesCount);
 
 		// Build letter translation table
@@ -284,6 +308,18 @@ public:
 
 	SlowScanner& operator = (const SlowScanner& s) { SlowScanner(s).Swap(*this); return *this; }
 
+	/**
+	 * Agglutinates two scanners together, producing a scanner which checks
+	 * a string against both of them (AcceptedRegexps() tells which regexps
+	 * have matched). This is a plain union of the automata, so the result
+	 * is never larger than the sum of sizes of the operands plus one state.
+	 *
+	 * Returns default-constructed scanner if the result would have
+	 * more than @p maxSize states (zero means no limit).
+	 * Scanners with actions cannot be glued.
+	 */
+	static SlowScanner Glue(const SlowScanner& lhs, const SlowScanner& rhs, size_t maxSize = 0);
+
 	~SlowScanner()
 	{
 		for (auto&& i : m_pool)
@@ -342,9 +378,12 @@ private:
 		size_t statesCount;
 		size_t lettersCount;
 		size_t start;
+		size_t regexpsCount;
 	} m;
 
 	bool* m_finals;
+	size_t* m_acceptPos; ///< Glued scanners only: offsets of states' lists in m_accept
+	size_t* m_accept;    ///< Glued scanners only: regexps accepted by each state
 	unsigned* m_jumps;
 	Action* m_actions;
 	size_t* m_jumpPos;
@@ -380,9 +419,38 @@ private:
 		m_actions = s.m_actions;
 		m_jumpPos = s.m_jumpPos;
 		m_letters = s.m_letters;
+		m_acceptPos = s.m_acceptPos;
+		m_accept = s.m_accept;
 		m_vecptr = s.m_vecptr;
 		m_pool.clear();
 	}
+
+	ypair<const unsigned*, const unsigned*> Jumps(size_t state, size_t letter) const
+	{
+		if (!m_vecptr) {
+			const size_t* pos = m_jumpPos + state * m.lettersCount + letter;
+			return ymake_pair(m_jumps + pos[0], m_jumps + pos[1]);
+		}
+		const auto& v = (*m_vecptr)[state * m.lettersCount + letter];
+		return v.empty()
+			? ymake_pair<const unsigned*, const unsigned*>(0, 0)
+			: ymake_pair(v.data(), v.data() + v.size());
+	}
+
+	ypair<const size_t*, const size_t*> StateAcceptedRegexps(size_t state) const
+	{
+		if (m.regexpsCount <= 1)
+			return m_finals[state] ? Accept() : Deny();
+		return ymake_pair(m_accept + m_acceptPos[state], m_accept + m_acceptPos[state + 1]);
+	}
+
+	/// Appends transitions of state @p from of @p sc by its letter class @p fromLetter to the given state
+	void AppendJumps(size_t state, size_t letter, const SlowScanner& sc, size_t from, size_t fromLetter, size_t shift)
+	{
+		TVector<unsigned>& jumps = m_vec[state * m.lettersCount + letter];
+		for (auto range = sc.Jumps(from, fromLetter); range.first != range.second; ++range.first)
+			jumps.push_back(*range.first + shift);
+	}
 	
 	void SetJump(size_t oldState, Char c, size_t newState, unsigned long action)
 	{
@@ -424,6 +492,75 @@ inline SlowScanner Fsm::Compile(size_t distance) {
 	return SlowScanner(*this, false, true, distance);
 }
 
+inline SlowScanner SlowScanner::Glue(const SlowScanner& lhs, const SlowScanner& rhs, size_t maxSize /* = 0 */)
+{
+	if (lhs.Empty())
+		return rhs;
+	if (rhs.Empty())
+		return lhs;
+	if (lhs.need_actions || rhs.need_actions)
+		throw Error("Cannot glue slow scanners with actions");
+
+	// States of lhs go first, then states of rhs, then the new initial state,
+	// which has transitions and regexps of both initial states
+	const size_t start = lhs.m.statesCount + rhs.m.statesCount;
+	if (maxSize && start + 1 > maxSize)
+		return SlowScanner();
+
+	SlowScanner sc;
+	sc.m.statesCount = start + 1;
+	sc.m.start = start;
+	sc.m.regexpsCount = lhs.RegexpsCount() + rhs.RegexpsCount();
+
+	// Letter classes of the glued scanner are pairs of letter classes of lhs and rhs
+	TMap<ypair<size_t, size_t>, size_t> classIndex;
+	TVector< ypair<size_t, size_t> > classes;
+	sc.alloc(sc.m_letters, MaxChar);
+	for (size_t ch = 0; ch != MaxChar; ++ch) {
+		auto cls = ymake_pair(lhs.m_letters[ch], rhs.m_letters[ch]);
+		auto ins = classIndex.insert(ymake_pair(cls, classes.size()));
+		if (ins.second)
+			classes.push_back(cls);
+		sc.m_letters[ch] = ins.first->second;
+	}
+	sc.m.lettersCount = classes.size();
+
+	sc.m_vec.resize(sc.m.statesCount * sc.m.lettersCount);
+	sc.m_vecptr = &sc.m_vec;
+	for (size_t letter = 0; letter != classes.size(); ++letter) {
+		for (size_t i = 0; i != lhs.m.statesCount; ++i)
+			sc.AppendJumps(i, letter, lhs, i, classes[letter].first, 0);
+		for (size_t i = 0; i != rhs.m.statesCount; ++i)
+			sc.AppendJumps(lhs.m.statesCount + i, letter, rhs, i, classes[letter].second, lhs.m.statesCount);
+		sc.AppendJumps(start, letter, lhs, lhs.m.start, classes[letter].first, 0);
+		sc.AppendJumps(start, letter, rhs, rhs.m.start, classes[letter].second, lhs.m.statesCount);
+	}
+
+	TVector<size_t> accept;
+	sc.alloc(sc.m_finals, sc.m.statesCount);
+	sc.alloc(sc.m_acceptPos, sc.m.statesCount + 1);
+	auto append = [&accept](ypair<const size_t*, const size_t*> regexps, size_t shift) {
+		for (; regexps.first != regexps.second; ++regexps.first)
+			accept.push_back(*regexps.first + shift);
+	};
+	for (size_t i = 0; i != sc.m.statesCount; ++i) {
+		sc.m_acceptPos[i] = accept.size();
+		if (i < lhs.m.statesCount)
+			append(lhs.StateAcceptedRegexps(i), 0);
+		else if (i < start)
+			append(rhs.StateAcceptedRegexps(i - lhs.m.statesCount), lhs.RegexpsCount());
+		else {
+			append(lhs.StateAcceptedRegexps(lhs.m.start), 0);
+			append(rhs.StateAcceptedRegexps(rhs.m.start), lhs.RegexpsCount());
+		}
+		sc.m_finals[i] = (accept.size() != sc.m_acceptPos[i]);
+	}
+	sc.m_acceptPos[sc.m.statesCount] = accept.size();
+	sc.alloc(sc.m_accept, accept.size());
+	std::copy(accept.begin(), accept.end(), sc.m_accept);
+	return sc;
+}
+
 inline const SlowScanner& SlowScanner::Null()
 {
 	static const SlowScanner n = Fsm::MakeFalse().Compile<SlowScanner>();
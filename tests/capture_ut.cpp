@@ -229,6 +229,24 @@ SIMPLE_UNIT_TEST_SUITE(TestPireCapture) {
 		}
 	}
 
+	SIMPLE_UNIT_TEST(GroupsInRepetitions)
+	{
+		const char* str = "xabbbcx";
+		State state = RunRegexp(Compile("a(b+)c", 1), str);
+		UNIT_ASSERT(state.Captured());
+		UNIT_ASSERT_EQUAL(Captured(state, str), ystring("bbb"));
+
+		str = "--xx=yyz--";
+		state = RunRegexp(Compile("(x)*=(y+)z", 2), str);
+		UNIT_ASSERT(state.Captured());
+		UNIT_ASSERT_EQUAL(Captured(state, str), ystring("yy"));
+
+		str = "id=(42);";
+		state = RunRegexp(Compile("id=\\((()[0-9]{1,3})\\);", 1), str);
+		UNIT_ASSERT(state.Captured());
+		UNIT_ASSERT_EQUAL(Captured(state, str), ystring("42"));
+	}
+
 	SIMPLE_UNIT_TEST(Empty)
 	{
 		Pire::CapturingScanner sc;
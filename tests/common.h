@@ -88,6 +88,9 @@ struct Scanners {
 	Pire::HalfFinalScannerNoMask halfFinalNoMask;
 	Pire::NonrelocHalfFinalScanner nonrelocHalfFinal;
 	Pire::NonrelocHalfFinalScannerNoMask nonrelocHalfFinalNoMask;
+	Pire::ScannerSplitHeaders split;
+	Pire::NonrelocScannerSplitHeaders nonrelocSplit;
+	Pire::CompactSimpleScanner compact;
 
 	Scanners(const Pire::Fsm& fsm, size_t distance = 0)
 		: fast(Pire::Fsm(fsm).Compile<Pire::Scanner>(distance))
@@ -100,6 +103,9 @@ struct Scanners {
 		, halfFinalNoMask(Pire::Fsm(fsm).Compile<Pire::HalfFinalScannerNoMask>(distance))
 		, nonrelocHalfFinal(Pire::Fsm(fsm).Compile<Pire::NonrelocHalfFinalScanner>(distance))
 		, nonrelocHalfFinalNoMask(Pire::Fsm(fsm).Compile<Pire::NonrelocHalfFinalScannerNoMask>(distance))
+		, split(Pire::Fsm(fsm).Compile<Pire::ScannerSplitHeaders>(distance))
+		, nonrelocSplit(Pire::Fsm(fsm).Compile<Pire::NonrelocScannerSplitHeaders>(distance))
+		, compact(Pire::Fsm(fsm).Compile<Pire::CompactSimpleScanner>(distance))
 	{}
 
 	Scanners(const char* str, const char* options = "")
@@ -115,6 +121,9 @@ struct Scanners {
 		halfFinalNoMask = Pire::Fsm(fsm).Compile<Pire::HalfFinalScannerNoMask>();
 		nonrelocHalfFinal = Pire::Fsm(fsm).Compile<Pire::NonrelocHalfFinalScanner>();
 		nonrelocHalfFinalNoMask = Pire::Fsm(fsm).Compile<Pire::NonrelocHalfFinalScannerNoMask>();
+		split = Pire::Fsm(fsm).Compile<Pire::ScannerSplitHeaders>();
+		nonrelocSplit = Pire::Fsm(fsm).Compile<Pire::NonrelocScannerSplitHeaders>();
+		compact = Pire::Fsm(fsm).Compile<Pire::CompactSimpleScanner>();
 	}
 };
 
@@ -204,6 +213,9 @@ bool Matches(const Scanner& scanner, const char* str)
 		UNIT_ASSERT(Matches(m_scanners.halfFinalNoMask, str));\
 		UNIT_ASSERT(Matches(m_scanners.nonrelocHalfFinal, str));\
 		UNIT_ASSERT(Matches(m_scanners.nonrelocHalfFinalNoMask, str));\
+		UNIT_ASSERT(Matches(m_scanners.split, str));\
+		UNIT_ASSERT(Matches(m_scanners.nonrelocSplit, str));\
+		UNIT_ASSERT(Matches(m_scanners.compact, str));\
 	} while (false)
 
 #define DENIES(str) \
@@ -218,6 +230,9 @@ bool Matches(const Scanner& scanner, const char* str)
 		UNIT_ASSERT(!Matches(m_scanners.halfFinalNoMask, str));\
 		UNIT_ASSERT(!Matches(m_scanners.nonrelocHalfFinal, str));\
 		UNIT_ASSERT(!Matches(m_scanners.nonrelocHalfFinalNoMask, str));\
+		UNIT_ASSERT(!Matches(m_scanners.split, str));\
+		UNIT_ASSERT(!Matches(m_scanners.nonrelocSplit, str));\
+		UNIT_ASSERT(!Matches(m_scanners.compact, str));\
 	} while (false)
 
 
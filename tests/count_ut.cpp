@@ -457,6 +457,48 @@ SIMPLE_UNIT_TEST_SUITE(TestCount) {
 		}
 	}
 
+	template<class Scanner>
+	void PackedStateOne()
+	{
+		const auto& enc = Pire::Encodings::Latin1();
+		auto sc = Scanner::Glue(Scanner(MkFsm("[a-z]+", enc), MkFsm(".*", enc)), Scanner(MkFsm("[0-9]+", enc), MkFsm(".*", enc)));
+		const ystring head = "abc defg 12";
+		const ystring tail = "3 jklmn 4567 opqrst";
+
+		auto st = Run(sc, head.c_str());
+		TVector<ui32> packed(sc.PackedStateSize());
+		sc.PackState(st, packed.data());
+		Pire::Run(sc, st, tail.c_str(), tail.c_str() + tail.size());
+
+		// Packed state remains valid for another copy of the same scanner
+		BufferOutput wbuf;
+		::Save(&wbuf, sc);
+		MemoryInput rbuf(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+		Scanner sc2;
+		::Load(&rbuf, sc2);
+		UNIT_ASSERT_EQUAL(sc2.PackedStateSize(), packed.size());
+
+		typename Scanner::State st2;
+		sc2.UnpackState(packed.data(), st2);
+		Pire::Run(sc2, st2, tail.c_str(), tail.c_str() + tail.size());
+		UNIT_ASSERT_EQUAL(st2.Result(0), st.Result(0));
+		UNIT_ASSERT_EQUAL(st2.Result(1), st.Result(1));
+
+		ypair<const char*, const char*> chunk(tail.c_str(), tail.c_str() + tail.size());
+		Pire::RunFlows(sc2, packed.data(), &chunk, 1);
+		sc2.UnpackState(packed.data(), st2);
+		UNIT_ASSERT_EQUAL(sc2.StateIndex(st2), sc.StateIndex(st));
+		UNIT_ASSERT_EQUAL(st2.Result(0), st.Result(0));
+		UNIT_ASSERT_EQUAL(st2.Result(1), st.Result(1));
+	}
+
+	SIMPLE_UNIT_TEST(PackedState)
+	{
+		PackedStateOne<Pire::CountingScanner>();
+		PackedStateOne<Pire::AdvancedCountingScanner>();
+		PackedStateOne<Pire::NoGlueLimitCountingScanner>();
+	}
+
 	template<class Scanner>
 	void EmptyOne()
 	{
@@ -53,5 +53,18 @@ SIMPLE_UNIT_TEST(TwoFeatures)
 	UNIT_ASSERT("ABC" ==~ re);
 	UNIT_ASSERT(!("adc" ==~ re));
 }
+
+SIMPLE_UNIT_TEST(LargeDfa)
+{
+	// Determines to 65541 states, within the default limit
+	Pire::Regexp re("(a|b)*a(a|b){15}$");
+	UNIT_ASSERT("xbaaaaaaaaaaaaaaab" ==~ re);
+	UNIT_ASSERT(!("xbbaaaaaaaaaaaaaaa" ==~ re));
+
+	// Would exceed the limit, so goes to SlowScanner without determination
+	Pire::Regexp slow("a.{30}$");
+	UNIT_ASSERT("xxa012345678901234567890123456789" ==~ slow);
+	UNIT_ASSERT(!("xxa01234567890123456789012345678" ==~ slow));
+}
 	
 }
@@ -0,0 +1,105 @@
+/*
+ * incremental_ut.cpp --
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+
+#include <stub/hacks.h>
+#include <stub/saveload.h>
+#include <stub/memstreams.h>
+#include "stub/cppunit.h"
+#include <pire.h>
+#include <string.h>
+#include "common.h"
+
+SIMPLE_UNIT_TEST_SUITE(TestIncremental) {
+
+	template<class Scanner>
+	typename Scanner::State RunWhole(const Scanner& sc, const ystring& text)
+	{
+		return Pire::Runner(sc).Begin().Run(text).End().State();
+	}
+
+	ystring MkText(size_t len, unsigned seed)
+	{
+		ystring text;
+		for (size_t i = 0; i != len; ++i) {
+			seed = seed * 1103515245 + 12345;
+			text += "abcxyz\n"[(seed >> 16) % 7];
+		}
+		return text;
+	}
+
+	SIMPLE_UNIT_TEST(Edits)
+	{
+		Pire::Scanner sc = Pire::Scanner::Glue(
+			ParseRegexp("abc").Compile<Pire::Scanner>(),
+			ParseRegexp("^x[^\n]*z$").Compile<Pire::Scanner>());
+
+		TVector<ystring> chunks;
+		for (unsigned i = 0; i != 10; ++i)
+			chunks.push_back(MkText(100, i + 1));
+		ystring text;
+		for (auto&& chunk : chunks)
+			text += chunk;
+
+		Pire::IncrementalRunner<Pire::Scanner> runner(sc);
+		runner.Assign(text.c_str(), text.c_str() + text.size(), 100);
+		UNIT_ASSERT_EQUAL(runner.ChunksCount(), 10u);
+		UNIT_ASSERT_EQUAL(runner.State(), RunWhole(sc, text));
+
+		for (unsigned i = 0; i != 20; ++i) {
+			size_t idx = (i * 7) % chunks.size();
+			ystring& chunk = chunks[idx];
+			if (i % 3 == 0)
+				chunk.clear();
+			else
+				chunk = MkText(50 + i * 10, i + 20) + (i % 5 == 0 ? "abc" : "");
+			runner.Replace(idx, chunk.c_str(), chunk.c_str() + chunk.size());
+
+			text.clear();
+			for (auto&& c : chunks)
+				text += c;
+			UNIT_ASSERT_EQUAL(runner.State(), RunWhole(sc, text));
+			UNIT_ASSERT_EQUAL(runner.Final(), sc.Final(RunWhole(sc, text)));
+		}
+	}
+
+	SIMPLE_UNIT_TEST(Append)
+	{
+		Pire::Scanner sc = ParseRegexp("^(a|b)*abb(a|b)*$", "n").Compile<Pire::Scanner>();
+		Pire::IncrementalRunner<Pire::Scanner> runner(sc);
+		UNIT_ASSERT(!runner.Final());
+
+		const char* chunks[] = { "ab", "", "aab", "b", "ba", "c" };
+		ystring text;
+		for (size_t i = 0; i != sizeof(chunks) / sizeof(*chunks); ++i) {
+			runner.Append(chunks[i], chunks[i] + strlen(chunks[i]));
+			text += chunks[i];
+			UNIT_ASSERT_EQUAL(runner.Final(), Matches(sc, text.c_str()));
+		}
+		UNIT_ASSERT(!runner.Final());
+		runner.Replace(5, "", "");
+		UNIT_ASSERT(runner.Final());
+		runner.Replace(3, "a", "a" + 1);
+		UNIT_ASSERT(!runner.Final());
+	}
+}
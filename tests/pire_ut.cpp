@@ -27,6 +27,7 @@
 #include <stub/memstreams.h>
 #include "stub/cppunit.h"
 #include <stdexcept>
+#include <thread>
 #include "common.h"
 
 SIMPLE_UNIT_TEST_SUITE(TestPire) {
@@ -270,6 +271,33 @@ SIMPLE_UNIT_TEST(Reverse)
 	}
 }
 
+SIMPLE_UNIT_TEST(Normalize)
+{
+	Pire::InputNormalization norm;
+	norm.Lowercase().Digits().Whitespace();
+	UNIT_ASSERT_EQUAL(norm['Q'], 'q');
+	UNIT_ASSERT_EQUAL(norm['7'], '0');
+	UNIT_ASSERT_EQUAL(norm['\t'], ' ');
+	UNIT_ASSERT_EQUAL(norm['-'], '-');
+
+	SCANNER(ParseRegexp("^id 0+ of$").Normalize(norm)) {
+		ACCEPTS("id 42 of");
+		ACCEPTS("ID\t123 Of");
+		DENIES ("id 4x of");
+		DENIES ("id  1 of");
+	}
+
+	// Normalization survives serialization
+	Pire::Scanner sc = ParseRegexp("abc").Normalize(norm).Compile<Pire::Scanner>();
+	BufferOutput wbuf;
+	Save(&wbuf, sc);
+	MemoryInput rbuf(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+	Pire::Scanner loaded;
+	Load(&rbuf, loaded);
+	UNIT_ASSERT(Matches(loaded, "xxAbCxx"));
+	UNIT_ASSERT(!Matches(loaded, "xxAbDxx"));
+}
+
 #if defined(__GNUC__)
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Warray-bounds"
@@ -702,6 +730,873 @@ SIMPLE_UNIT_TEST(Glue)
 	TestGlue<Pire::NonrelocHalfFinalScanner>();
 	TestGlue<Pire::HalfFinalScannerNoMask>();
 	TestGlue<Pire::NonrelocHalfFinalScannerNoMask>();
+	TestGlue<Pire::ScannerSplitHeaders>();
+	TestGlue<Pire::NonrelocScannerSplitHeaders>();
+	TestGlue<Pire::SlowScanner>();
+}
+
+SIMPLE_UNIT_TEST(SplitHeaders)
+{
+	Pire::Scanner sc = Pire::Scanner::Glue(
+		ParseRegexp("ab+c").Compile<Pire::Scanner>(),
+		ParseRegexp("[0-9]{3}").Compile<Pire::Scanner>());
+	Pire::ScannerSplitHeaders split(sc);
+	UNIT_ASSERT_EQUAL(split.Size(), sc.Size());
+	// Transition rows are stored without headers
+	UNIT_ASSERT(split.IndexToState(1) - split.IndexToState(0) < sc.IndexToState(1) - sc.IndexToState(0));
+	UNIT_ASSERT(Matches(split, "xxabbbc"));
+	UNIT_ASSERT(Matches(split, "........................................123......"));
+	UNIT_ASSERT(!Matches(split, "........................................12.3....."));
+
+	// Converting back yields an identical scanner
+	Pire::Scanner back(split);
+	BufferOutput lhs, rhs;
+	Save(&lhs, sc);
+	Save(&rhs, back);
+	UNIT_ASSERT_EQUAL(ystring(lhs.Buffer().Data(), lhs.Buffer().Size()), ystring(rhs.Buffer().Data(), rhs.Buffer().Size()));
+
+	BufferOutput wbuf;
+	Save(&wbuf, split);
+	Pire::ScannerSplitHeaders loaded;
+	MemoryInput rbuf(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+	Load(&rbuf, loaded);
+	UNIT_ASSERT(Matches(loaded, "xxabbbc"));
+
+	Pire::Scanner wrong;
+	MemoryInput rbuf2(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+	try {
+		Load(&rbuf2, wrong);
+		UNIT_ASSERT(!"Should report layout mismatch");
+	}
+	catch (Pire::Error&) {}
+}
+
+template<class Scanner>
+void TestGlueToStream(const Scanner& lhs, const Scanner& rhs, size_t memoryBudget)
+{
+	BufferOutput expected, actual;
+	Save(&expected, Scanner::Glue(lhs, rhs));
+	UNIT_ASSERT(Pire::GlueToStream(lhs, rhs, &actual, memoryBudget));
+	UNIT_ASSERT_EQUAL(ystring(actual.Buffer().Data(), actual.Buffer().Size()),
+		ystring(expected.Buffer().Data(), expected.Buffer().Size()));
+
+	TVector<char> buf(actual.Buffer().Size() + sizeof(size_t));
+	const char* ptr = Pire::Impl::AlignUp(&buf[0], sizeof(size_t));
+	memcpy((void*) ptr, actual.Buffer().Data(), actual.Buffer().Size());
+	Scanner mapped;
+	UNIT_ASSERT_EQUAL(mapped.Mmap(ptr, actual.Buffer().Size()), ptr + actual.Buffer().Size());
+	UNIT_ASSERT_EQUAL(mapped.RegexpsCount(), lhs.RegexpsCount() + rhs.RegexpsCount());
+}
+
+SIMPLE_UNIT_TEST(GlueToStream)
+{
+	TestGlueToStream(
+		ParseRegexp("ab+c").Compile<Pire::Scanner>(),
+		ParseRegexp("[0-9]{3}").Compile<Pire::Scanner>(),
+		Pire::DefaultGlueMemoryBudget);
+	TestGlueToStream(
+		ParseRegexp("ab+c").Compile<Pire::ScannerSplitHeaders>(),
+		ParseRegexp("[0-9]{3}").Compile<Pire::ScannerSplitHeaders>(),
+		Pire::DefaultGlueMemoryBudget);
+	TestGlueToStream(
+		ParseRegexp("x").Compile<Pire::ScannerNoMask>(),
+		Pire::ScannerNoMask(),
+		Pire::DefaultGlueMemoryBudget);
+
+	// Large enough to spill both states and rows to temporary files
+	Pire::Scanner lhs = Pire::Lexer(".*a.{8}").Parse().Compile<Pire::Scanner>();
+	Pire::Scanner rhs = Pire::Lexer(".*b.{7}").Parse().Compile<Pire::Scanner>();
+	TestGlueToStream(lhs, rhs, 1 << 20);
+
+	BufferOutput out;
+	UNIT_ASSERT(!Pire::GlueToStream(lhs, rhs, &out, 1));
+	UNIT_ASSERT(!Pire::GlueToStream(lhs, rhs, &out, Pire::DefaultGlueMemoryBudget, 100));
+	UNIT_ASSERT_EQUAL(out.Buffer().Size(), size_t(0));
+}
+
+template<class Scanner>
+typename Scanner::State InitialState(const Scanner& sc)
+{
+	typename Scanner::State st;
+	sc.Initialize(st);
+	return st;
+}
+
+template<class Scanner>
+void TestSharedCopies()
+{
+	Scanner sc = ParseRegexp("ab+c|[0-9]{3}").Compile<Scanner>();
+	Scanner copy(sc);
+	Scanner assigned;
+	assigned = copy;
+	// Copies share the tables...
+	UNIT_ASSERT_EQUAL(InitialState(copy), InitialState(sc));
+	UNIT_ASSERT_EQUAL(InitialState(assigned), InitialState(sc));
+	// ... and outlive the original
+	sc = Scanner();
+	UNIT_ASSERT(Matches(copy, "xxabbbc"));
+	UNIT_ASSERT(Matches(assigned, "123"));
+	UNIT_ASSERT(!Matches(assigned, "12.3"));
+
+	Scanner clone = copy.Clone();
+	UNIT_ASSERT(InitialState(clone) != InitialState(copy));
+	UNIT_ASSERT(Matches(clone, "xxabbbc"));
+	UNIT_ASSERT(!Matches(clone, "12.3"));
+	UNIT_ASSERT(Scanner().Clone().Empty());
+}
+
+SIMPLE_UNIT_TEST(SharedCopies)
+{
+	TestSharedCopies<Pire::Scanner>();
+	TestSharedCopies<Pire::NonrelocScanner>();
+	TestSharedCopies<Pire::SimpleScanner>();
+}
+
+SIMPLE_UNIT_TEST(PatternSet)
+{
+	const char* patterns[] = { "abc", "foo.*", "a(b)c", "foo.*bar", "[a]bc|abc", "x+", "xx*" };
+	Pire::PatternSet<Pire::Scanner> set;
+	for (size_t i = 0; i != sizeof(patterns) / sizeof(*patterns); ++i)
+		UNIT_ASSERT_EQUAL(set.Add(ParseRegexp(patterns[i]).Compile<Pire::Scanner>()), i);
+	UNIT_ASSERT_EQUAL(set.Size(), 7u);
+	UNIT_ASSERT_EQUAL(set.GluedCount(), 4u);
+	UNIT_ASSERT_EQUAL(set.GluedIndex(2), set.GluedIndex(0));
+	UNIT_ASSERT_EQUAL(set.GluedIndex(4), set.GluedIndex(0));
+	UNIT_ASSERT_EQUAL(set.GluedIndex(6), set.GluedIndex(5));
+	UNIT_ASSERT(set.GluedIndex(1) != set.GluedIndex(3));
+	UNIT_ASSERT_EQUAL(set.Patterns(set.GluedIndex(0)).size(), 3u);
+
+	Pire::Scanner sc = set.Glue();
+	UNIT_ASSERT_EQUAL(sc.RegexpsCount(), 4u);
+	Pire::Scanner::State st = Pire::Runner(sc).Begin().Run(ystring("xx foo bar")).End().State();
+	TSet<size_t> accepted(sc.AcceptedRegexps(st).first, sc.AcceptedRegexps(st).second);
+	UNIT_ASSERT(accepted.count(set.GluedIndex(1)) && accepted.count(set.GluedIndex(3)) && accepted.count(set.GluedIndex(5)));
+	UNIT_ASSERT(!accepted.count(set.GluedIndex(0)));
+
+	set.PruneSubsumed();
+	UNIT_ASSERT(set.Subsumed(3));
+	UNIT_ASSERT(!set.Subsumed(1));
+	UNIT_ASSERT_EQUAL(set.GluedIndex(3), set.GluedIndex(1));
+	UNIT_ASSERT_EQUAL(set.GluedCount(), 3u);
+	UNIT_ASSERT_EQUAL(set.Glue().RegexpsCount(), 3u);
+}
+
+SIMPLE_UNIT_TEST(PrefixDispatcher)
+{
+	const char* patterns[] = { "^http://foo.*$", "^https?://bar.*$", "^ftp://.*$", "^.*error.*$", "^x$" };
+	TVector<Pire::Scanner> scanners;
+	Pire::Scanner glued;
+	for (size_t i = 0; i != sizeof(patterns) / sizeof(*patterns); ++i) {
+		scanners.push_back(ParseRegexp(patterns[i], "n").Compile<Pire::Scanner>());
+		glued = i ? Pire::Scanner::Glue(glued, scanners.back()) : scanners.back();
+	}
+
+	const char* texts[] = { "http://foo/", "https://bar", "http://bar", "ftp://error", "x", "xx", "", "h", "zzz error", "zzz" };
+	UNIT_ASSERT(Matches(glued, "ftp://error") && Matches(glued, "x") && Matches(glued, "zzz error"));
+	for (size_t prefixLen = 1; prefixLen <= 2; ++prefixLen) {
+		Pire::PrefixDispatcher<Pire::Scanner> dispatcher(scanners, prefixLen);
+		UNIT_ASSERT_EQUAL(dispatcher.RegexpsCount(), glued.RegexpsCount());
+		for (size_t i = 0; i != sizeof(texts) / sizeof(*texts); ++i) {
+			auto state = RunRegexp(dispatcher, texts[i]);
+			auto expectedState = RunRegexp(glued, texts[i]);
+			auto accepted = dispatcher.AcceptedRegexps(state);
+			auto expected = glued.AcceptedRegexps(expectedState);
+			UNIT_ASSERT_EQUAL(TVector<size_t>(accepted.first, accepted.second), TVector<size_t>(expected.first, expected.second));
+			UNIT_ASSERT_EQUAL(dispatcher.Final(state), glued.Final(expectedState));
+		}
+	}
+
+	// The unanchored pattern goes everywhere; other ones share groups only when they share a prefix
+	Pire::PrefixDispatcher<Pire::Scanner> dispatcher(scanners);
+	for (size_t i = 1; i != dispatcher.GroupsCount(); ++i)
+		UNIT_ASSERT(dispatcher.GroupScanner(i).RegexpsCount() <= 3);
+
+	scanners.erase(scanners.begin() + 3);
+	Pire::PrefixDispatcher<Pire::Scanner> anchored(scanners, 2);
+	auto state = RunRegexp(anchored, "zz");
+	UNIT_ASSERT(anchored.Dead(state));
+	UNIT_ASSERT(!Matches(anchored, "zzz error"));
+	UNIT_ASSERT(Matches(anchored, "x"));
+	UNIT_ASSERT(Matches(anchored, "ftp://"));
+}
+
+SIMPLE_UNIT_TEST(Interest)
+{
+	Pire::Scanner sc = Pire::Scanner::Glue(
+		Pire::Scanner::Glue(ParseRegexp("foo").Compile<Pire::Scanner>(), ParseRegexp("bar").Compile<Pire::Scanner>()),
+		ParseRegexp("^baz.*$", "n").Compile<Pire::Scanner>());
+	Pire::PossibleRegexps<Pire::Scanner> possible(sc);
+	UNIT_ASSERT(possible.SetsCount() < sc.Size());
+
+	Pire::Scanner::State st;
+	sc.Initialize(st);
+	Pire::Step(sc, st, Pire::BeginMark);
+	UNIT_ASSERT_EQUAL(possible.Possible(st).size(), 3u);
+
+	Pire::BitSet mask(sc.RegexpsCount());
+	mask.Set(0);
+	Pire::RegexpInterest<Pire::Scanner> foo(possible, mask);
+	mask.Set(1);
+	Pire::RegexpInterest<Pire::Scanner> fooBar(possible, mask);
+	mask.Clear();
+	mask.Set(2);
+	Pire::RegexpInterest<Pire::Scanner> baz(possible, mask);
+
+	const ystring text = "xx foo yy bar zz";
+	auto run = [&](const Pire::RegexpInterest<Pire::Scanner>& interest) {
+		sc.Initialize(st);
+		Pire::Step(sc, st, Pire::BeginMark);
+		return Pire::RunUntilDecided(sc, interest, st, text.c_str(), text.c_str() + text.size()) - text.c_str();
+	};
+	UNIT_ASSERT_EQUAL(run(foo), 6);
+	UNIT_ASSERT(sc.Final(st));
+	UNIT_ASSERT_EQUAL(run(fooBar), 13);
+	UNIT_ASSERT_EQUAL(run(baz), 1);
+	UNIT_ASSERT(!possible.Possible(st, 2));
+	UNIT_ASSERT(possible.Possible(st, 1));
+
+	// Not surrounded: an accepted regexp may still be lost on the next character
+	Pire::Scanner plain = Pire::Scanner::Glue(
+		Pire::Lexer("abc").Parse().Compile<Pire::Scanner>(),
+		Pire::Lexer("zzz").Parse().Compile<Pire::Scanner>());
+	Pire::PossibleRegexps<Pire::Scanner> plainPossible(plain);
+	Pire::BitSet both(plain.RegexpsCount());
+	both.Set(0);
+	both.Set(1);
+	Pire::RegexpInterest<Pire::Scanner> plainBoth(plainPossible, both);
+	for (ystring plainText : { "abc", "abcd" }) {
+		plain.Initialize(st);
+		const char* stop = Pire::RunUntilDecided(plain, plainBoth, st, plainText.c_str(), plainText.c_str() + plainText.size());
+		UNIT_ASSERT_EQUAL(stop, plainText.c_str() + plainText.size());
+		UNIT_ASSERT(!plainPossible.Certain(st, 0));
+		UNIT_ASSERT_EQUAL(plainPossible.Possible(st, 0), (plainText == "abc"));
+		const bool matches = Pire::Matches(plain, plainText.c_str(), plainText.c_str() + plainText.size());
+		UNIT_ASSERT_EQUAL(matches, (plainText == "abc"));
+		UNIT_ASSERT_EQUAL(plain.Final(st), matches);
+	}
+}
+
+template<class Scanner>
+void TestPackedStates()
+{
+	Scanner sc = ParseRegexp("a.*b|[0-9]+x").Compile<Scanner>();
+	const char* texts[] = { "", "a", "xxaxxbxx", "12x", "b1a2", "123", "aaaaaaaaaab" };
+	const size_t count = sizeof(texts) / sizeof(*texts);
+	const size_t stride = sc.PackedStateSize();
+
+	TVector<ui32> packed(count * stride);
+	TVector< ypair<const char*, const char*> > chunks;
+	typename Scanner::State st;
+	for (size_t i = 0; i != count; ++i) {
+		sc.Initialize(st);
+		Pire::Step(sc, st, Pire::BeginMark);
+		sc.PackState(st, packed.data() + i * stride);
+		chunks.push_back(ymake_pair(texts[i], texts[i] + strlen(texts[i])));
+	}
+	Pire::RunFlows(sc, packed.data(), chunks.data(), count);
+
+	// Unpacked states must be the same as if each text was run separately,
+	// also by another copy of the scanner
+	BufferOutput wbuf;
+	Save(&wbuf, sc);
+	Scanner sc2;
+	MemoryInput rbuf(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+	Load(&rbuf, sc2);
+	for (size_t i = 0; i != count; ++i) {
+		auto expected = RunRegexp(sc, texts[i]);
+		sc.UnpackState(packed.data() + i * stride, st);
+		Pire::Step(sc, st, Pire::EndMark);
+		UNIT_ASSERT_EQUAL(sc.StateIndex(st), sc.StateIndex(expected));
+		sc2.UnpackState(packed.data() + i * stride, st);
+		Pire::Step(sc2, st, Pire::EndMark);
+		UNIT_ASSERT_EQUAL(sc2.StateIndex(st), sc.StateIndex(expected));
+		UNIT_ASSERT_EQUAL(sc2.Final(st), sc.Final(expected));
+	}
+}
+
+SIMPLE_UNIT_TEST(PackedStates)
+{
+	TestPackedStates<Pire::Scanner>();
+	TestPackedStates<Pire::NonrelocScanner>();
+	TestPackedStates<Pire::SimpleScanner>();
+}
+
+SIMPLE_UNIT_TEST(RegexpHits)
+{
+	Pire::Scanner sc = Pire::Scanner::Glue(
+		Pire::Scanner::Glue(ParseRegexp("foo").Compile<Pire::Scanner>(), ParseRegexp("bar").Compile<Pire::Scanner>()),
+		ParseRegexp("baz").Compile<Pire::Scanner>());
+	const char* texts[] = { "foo", "foobar", "xxx", "bar", "foo bar" };
+
+	Pire::RegexpHits<Pire::Scanner> hits(sc);
+	for (size_t i = 0; i != sizeof(texts) / sizeof(*texts); ++i)
+		hits.Record(RunRegexp(sc, texts[i]));
+	UNIT_ASSERT_EQUAL(hits.Scans(), 5u);
+	TVector<ui64> counts = hits.Counts();
+	UNIT_ASSERT_EQUAL(counts.size(), 3u);
+	UNIT_ASSERT_EQUAL(counts[0], 3u);
+	UNIT_ASSERT_EQUAL(counts[1], 3u);
+	UNIT_ASSERT_EQUAL(counts[2], 0u);
+	UNIT_ASSERT_EQUAL(hits.NeverHit(), TVector<size_t>(1, 2));
+
+	hits.Reset();
+	UNIT_ASSERT_EQUAL(hits.Scans(), 0u);
+	UNIT_ASSERT_EQUAL(hits.NeverHit().size(), 3u);
+
+	// Only every 4th scan is looked at, counts are scaled accordingly
+	Pire::RegexpHits<Pire::Scanner> sampled(sc, 4, 1);
+	for (size_t i = 0; i != 100; ++i)
+		sampled.Record(RunRegexp(sc, i % 2 ? "foo" : "bar"));
+	UNIT_ASSERT_EQUAL(sampled.Scans(), 100u);
+	counts = sampled.Counts();
+	UNIT_ASSERT_EQUAL(counts[0] + counts[1], 100u);
+	UNIT_ASSERT_EQUAL(counts[2], 0u);
+
+	// Instances sample independently of each other
+	Pire::RegexpHits<Pire::Scanner> first(sc, 2, 1);
+	Pire::RegexpHits<Pire::Scanner> second(sc, 2, 1);
+	Pire::Scanner::State barState = RunRegexp(sc, "bar");
+	for (size_t i = 0; i != 1000; ++i) {
+		first.Record(barState);
+		second.Record(barState);
+	}
+	UNIT_ASSERT_EQUAL(first.Counts()[1], 1000u);
+	UNIT_ASSERT_EQUAL(second.Counts()[1], 1000u);
+	UNIT_ASSERT(second.NeverHit().size() == 2);
+
+	// Concurrent scans, more threads than shards
+	Pire::RegexpHits<Pire::Scanner> shared(sc, 1, 2);
+	Pire::Scanner::State fooState = RunRegexp(sc, "foo");
+	TVector<std::thread> threads;
+	for (size_t t = 0; t != 4; ++t)
+		threads.push_back(std::thread([&]() {
+			for (size_t i = 0; i != 1000; ++i)
+				shared.Record(fooState);
+		}));
+	for (auto&& thread : threads)
+		thread.join();
+	UNIT_ASSERT_EQUAL(shared.Scans(), 4000u);
+	UNIT_ASSERT_EQUAL(shared.Counts()[0], 4000u);
+}
+
+SIMPLE_UNIT_TEST(AnyScanner)
+{
+	Pire::Fsm fsm = ParseRegexp("ab+c");
+	TVector<Pire::AnyScanner> scanners;
+	scanners.push_back(Pire::Scanner(fsm));
+	scanners.push_back(Pire::NonrelocScanner(fsm));
+	scanners.push_back(Pire::SimpleScanner(fsm));
+	scanners.push_back(Pire::SlowScanner(fsm));
+	scanners.push_back(Pire::Scanner::Glue(Pire::Scanner(fsm), ParseRegexp("x").Compile<Pire::Scanner>()));
+
+	const ystring text = "abbbc";
+	const ystring noise = "abd";
+	const ystring prefix = "abbcxx";
+	ypair<const char*, const char*> texts[] = {
+		ymake_pair(text.c_str(), text.c_str() + text.size()),
+		ymake_pair(noise.c_str(), noise.c_str() + noise.size())
+	};
+	for (auto&& sc : scanners) {
+		UNIT_ASSERT(!sc.Empty());
+		UNIT_ASSERT(sc.Matches(text));
+		UNIT_ASSERT(!sc.Matches(noise));
+		bool results[2];
+		sc.Matches(texts, 2, results);
+		UNIT_ASSERT(results[0] && !results[1]);
+		TVector<size_t> ids;
+		sc.AcceptedRegexps(text.c_str(), text.c_str() + text.size(), ids);
+		UNIT_ASSERT_EQUAL(ids, TVector<size_t>(1, 0));
+	}
+
+	Pire::AnyScanner prefixes(ParseRegexp("ab+c", "n").Compile<Pire::Scanner>());
+	UNIT_ASSERT_EQUAL(prefixes.LongestPrefix(prefix.c_str(), prefix.c_str() + prefix.size()), prefix.c_str() + 4);
+	UNIT_ASSERT_EQUAL(prefixes.ShortestPrefix(prefix.c_str(), prefix.c_str() + prefix.size()), prefix.c_str() + 4);
+
+	UNIT_ASSERT(scanners[2].IsA<Pire::SimpleScanner>());
+	UNIT_ASSERT(!scanners[2].IsA<Pire::Scanner>());
+	UNIT_ASSERT_EQUAL(scanners[4].As<Pire::Scanner>().RegexpsCount(), 2u);
+	try {
+		scanners[0].As<Pire::SlowScanner>();
+		UNIT_ASSERT(!"Should report type mismatch");
+	}
+	catch (Pire::Error&) {}
+
+	Pire::AnyScanner copy = scanners[3];
+	UNIT_ASSERT(copy.IsA<Pire::SlowScanner>() && copy.Matches(text));
+	UNIT_ASSERT(Pire::AnyScanner().Empty());
+	UNIT_ASSERT(!Pire::AnyScanner().Matches(text));
+}
+
+SIMPLE_UNIT_TEST(RunCursor)
+{
+	Pire::Scanner sc = ParseRegexp("a[^b]{3}b|c.*d").Compile<Pire::Scanner>();
+	ystring text;
+	for (size_t i = 0; i != 10000; ++i)
+		text += "abcde"[(i * 7 + i / 13) % 5];
+	const char* begin = text.c_str();
+	const char* end = begin + text.size();
+	auto expected = Pire::Runner(sc).Begin().Run(begin, end).End().State();
+
+	for (size_t budget : { 1, 7, 64, 1000, 20000 }) {
+		// Start off the word boundary
+		auto st = Pire::Runner(sc).Begin().Run(begin, begin + 1).State();
+		Pire::RunCursor<Pire::Scanner> cursor(sc, st, begin + 1, end);
+		size_t slices = 0;
+		while (!cursor.Done()) {
+			size_t scanned = cursor.Advance(budget);
+			UNIT_ASSERT(scanned > 0 && scanned <= budget);
+			++slices;
+		}
+		UNIT_ASSERT(slices >= (text.size() - 1) / budget);
+		UNIT_ASSERT_EQUAL(cursor.Position(), end);
+		cursor.Step(Pire::EndMark);
+		UNIT_ASSERT_EQUAL(sc.StateIndex(cursor.State()), sc.StateIndex(expected));
+	}
+
+	Pire::RunCursor<Pire::Scanner> cursor(sc, begin, end);
+	cursor.Step(Pire::BeginMark);
+	UNIT_ASSERT(!cursor.AdvanceUntil(Pire::RunCursor<Pire::Scanner>::Clock::now(), 100));
+	UNIT_ASSERT(cursor.Position() > begin && cursor.Position() <= begin + 100);
+	size_t yields = 0;
+	cursor.Run(1000, [&yields]() { ++yields; });
+	UNIT_ASSERT(cursor.Done());
+	UNIT_ASSERT(yields >= 9);
+	UNIT_ASSERT_EQUAL(sc.StateIndex(cursor.Step(Pire::EndMark).State()), sc.StateIndex(expected));
+
+	// A zero slice does not stall the cursor
+	Pire::RunCursor<Pire::Scanner> zero(sc, begin, end);
+	UNIT_ASSERT_EQUAL(zero.Advance(0), 0u);
+	UNIT_ASSERT(zero.AdvanceUntil(Pire::RunCursor<Pire::Scanner>::Clock::now(), 0));
+	Pire::RunCursor<Pire::Scanner> zeroRun(sc, begin, end);
+	zeroRun.Run(0, []() {});
+	UNIT_ASSERT(zeroRun.Done());
+}
+
+namespace {
+	/// Hooks parenthesized subexpressions without saying so,
+	/// which should make the parser build each of them separately
+	struct HookingFeature: public Pire::Feature {
+		size_t calls = 0;
+		void Parenthesized(Pire::Fsm&) { ++calls; }
+	};
+}
+
+SIMPLE_UNIT_TEST(SharedSubexpressions)
+{
+	const char* patterns[] = {
+		"(ab|cd)x(ab|cd)y(ab|cd)",
+		"([0-9]{1,3}\\.){3}[0-9]{1,3}",
+		"(a[^b]c)*|(a[^b]c)+d|a[^b]c",
+		"^(a|b)(a|b)$",
+		"(.x)(.x)?(.x){2,}",
+		"((ab)*(ab)*)+"
+	};
+	const char* texts[] = { "", "abxcdyab", "abxabyxx", "10.0.0.1", "1.2.3", "abcadcd", "azcazc", "ab", "aa", "axbxcx", "zx", "abab", "xyzabab" };
+	for (auto&& pattern : patterns) {
+		Pire::Lexer shared(pattern);
+		Pire::Lexer separate(pattern);
+		UNIT_ASSERT(!separate.SubexpressionSharing());
+		shared.SetSubexpressionSharing();
+		UNIT_ASSERT(!shared.HooksParenthesized());
+		Pire::Scanner sc1 = shared.Parse().Surround().Compile<Pire::Scanner>();
+		Pire::Scanner sc2 = separate.Parse().Surround().Compile<Pire::Scanner>();
+		for (auto&& text : texts)
+			UNIT_ASSERT_EQUAL(Matches(sc1, text), Matches(sc2, text));
+
+		// Features hooking Parenthesized() see every subexpression even if sharing is asked for
+		HookingFeature* hookedSharing = new HookingFeature;
+		HookingFeature* hookedSeparate = new HookingFeature;
+		Pire::Lexer hooked1(pattern);
+		Pire::Lexer hooked2(pattern);
+		hooked1.SetSubexpressionSharing().AddFeature(Pire::Feature::Ptr(hookedSharing));
+		hooked2.AddFeature(Pire::Feature::Ptr(hookedSeparate));
+		UNIT_ASSERT(hooked1.HooksParenthesized());
+		Pire::Scanner sc3 = hooked1.Parse().Surround().Compile<Pire::Scanner>();
+		hooked2.Parse();
+		UNIT_ASSERT(hookedSeparate->calls > 0);
+		UNIT_ASSERT_EQUAL(hookedSharing->calls, hookedSeparate->calls);
+		for (auto&& text : texts)
+			UNIT_ASSERT_EQUAL(Matches(sc1, text), Matches(sc3, text));
+	}
+}
+
+template<class Scanner>
+void TestSetOperations()
+{
+	Scanner black = Scanner::Glue(ParseRegexp("ab+").Compile<Scanner>(), ParseRegexp("[0-9]{3}").Compile<Scanner>());
+	Scanner allow = ParseRegexp("abbb|12").Compile<Scanner>();
+	Scanner both = Scanner::Intersect(black, allow);
+	Scanner denied = Scanner::Subtract(black, allow);
+	Scanner other = Scanner::Complement(black);
+	UNIT_ASSERT(!both.Empty() && !denied.Empty() && !other.Empty());
+	UNIT_ASSERT_EQUAL(both.RegexpsCount(), 2u);
+	UNIT_ASSERT_EQUAL(denied.RegexpsCount(), 2u);
+	UNIT_ASSERT_EQUAL(other.RegexpsCount(), 1u);
+
+	const char* texts[] = { "", "ab", "xabbbx", "123", "12", "x12x", "abbb 123", "cd", "1a2b3" };
+	for (auto&& text : texts) {
+		bool b = Matches(black, text);
+		bool a = Matches(allow, text);
+		UNIT_ASSERT_EQUAL(Matches(both, text), (b && a));
+		UNIT_ASSERT_EQUAL(Matches(denied, text), (b && !a));
+		UNIT_ASSERT_EQUAL(Matches(other, text), !b);
+
+		auto expected = black.AcceptedRegexps(RunRegexp(black, text));
+		auto st = RunRegexp(denied, text);
+		auto accepted = denied.AcceptedRegexps(st);
+		if (denied.Final(st))
+			UNIT_ASSERT_EQUAL(TVector<size_t>(accepted.first, accepted.second), TVector<size_t>(expected.first, expected.second));
+		else
+			UNIT_ASSERT(accepted.first == accepted.second);
+	}
+
+	// Unanchored states which cannot lead to acceptance are dead
+	Scanner anchored = Scanner::Subtract(ParseRegexp("^ab.*$", "n").Compile<Scanner>(), ParseRegexp("^abc.*$", "n").Compile<Scanner>());
+	UNIT_ASSERT(anchored.Dead(RunRegexp(anchored, "abcd")));
+	UNIT_ASSERT(!anchored.Dead(Pire::Runner(anchored).Begin().Run(ystring("abd")).State()));
+	UNIT_ASSERT(Matches(anchored, "abd"));
+
+	UNIT_ASSERT(Scanner::Intersect(Scanner(), allow).Empty());
+	UNIT_ASSERT(Matches(Scanner::Subtract(black, Scanner()), "ab"));
+	UNIT_ASSERT(Scanner::Intersect(black, allow, 1).Empty());
+}
+
+SIMPLE_UNIT_TEST(SetOperations)
+{
+	TestSetOperations<Pire::Scanner>();
+	TestSetOperations<Pire::NonrelocScanner>();
+	TestSetOperations<Pire::ScannerNoMask>();
+
+	// Operands may be mmap()-ed
+	Pire::Scanner black = ParseRegexp("bad|worse").Compile<Pire::Scanner>();
+	BufferOutput wbuf;
+	Save(&wbuf, black);
+	TVector<char> buf(wbuf.Buffer().Size() + sizeof(size_t));
+	const void* ptr = Pire::Impl::AlignUp(&buf[0], sizeof(size_t));
+	memcpy((void*) ptr, wbuf.Buffer().Data(), wbuf.Buffer().Size());
+	Pire::Scanner mapped;
+	mapped.Mmap(ptr, wbuf.Buffer().Size());
+	Pire::Scanner policy = Pire::Scanner::Subtract(mapped, ParseRegexp("not bad").Compile<Pire::Scanner>());
+	UNIT_ASSERT(Matches(policy, "it is bad"));
+	UNIT_ASSERT(!Matches(policy, "it is not bad"));
+	UNIT_ASSERT(!Matches(policy, "not bad, but worse"));
+	UNIT_ASSERT(Matches(policy, "worse than not"));
+}
+
+SIMPLE_UNIT_TEST(RunTiled)
+{
+	Pire::Scanner sc = ParseRegexp("ab+c").Compile<Pire::Scanner>();
+	Pire::SimpleScanner simple = ParseRegexp("^x[^\n]*z$").Compile<Pire::SimpleScanner>();
+	Pire::ScannerNoMask nomask = ParseRegexp("c[0-9]+").Compile<Pire::ScannerNoMask>();
+
+	ystring text;
+	unsigned seed = 1;
+	for (size_t i = 0; i != 10000; ++i) {
+		seed = seed * 1103515245 + 12345;
+		text += "abcxz0\n"[(seed >> 16) % 7];
+	}
+	for (size_t offset = 0; offset != 4; ++offset) {
+		const char* begin = text.c_str() + offset;
+		const char* end = text.c_str() + text.size() - offset;
+		for (size_t tile : { 1, 100, 4096, 100000 }) {
+			auto r1 = Pire::Runner(sc).Begin();
+			auto r2 = Pire::Runner(simple).Begin();
+			auto r3 = Pire::Runner(nomask).Begin();
+			Pire::RunTiled(begin, end, tile, r1, r2, r3);
+			UNIT_ASSERT_EQUAL(r1.End().State(), Pire::Runner(sc).Begin().Run(begin, end).End().State());
+			UNIT_ASSERT_EQUAL(r2.End().State(), Pire::Runner(simple).Begin().Run(begin, end).End().State());
+			UNIT_ASSERT_EQUAL(r3.End().State(), Pire::Runner(nomask).Begin().Run(begin, end).End().State());
+
+			TVector< Pire::RunHelper<Pire::Scanner> > runners(2, Pire::Runner(sc));
+			runners[0].Begin();
+			Pire::RunTiledRange(begin, end, tile, runners.begin(), runners.end());
+			UNIT_ASSERT_EQUAL(runners[0].End().State(), r1.State());
+			UNIT_ASSERT_EQUAL(runners[1].State(), Pire::Runner(sc).Run(begin, end).State());
+		}
+	}
+}
+
+SIMPLE_UNIT_TEST(ScanPool)
+{
+	Pire::Scanner sc = Pire::Scanner::Glue(
+		ParseRegexp("ab+c").Compile<Pire::Scanner>(),
+		ParseRegexp("^x[^\n]*z$").Compile<Pire::Scanner>());
+	Pire::NonrelocScanner nonreloc = ParseRegexp("c[0-9]+").Compile<Pire::NonrelocScanner>();
+	Pire::SlowScanner slow = ParseRegexp("a.{3}c").Compile<Pire::SlowScanner>();
+
+	// Skewed sizes; the largest ones are split into chunks
+	TVector<ystring> docs;
+	unsigned seed = 1;
+	for (size_t len : { 0, 1, 10, 100, 1000, 50000, 200000, 7, 3000 }) {
+		ystring text;
+		for (size_t i = 0; i != len; ++i) {
+			seed = seed * 1103515245 + 12345;
+			text += "abcxz0\n"[(seed >> 16) % 7];
+		}
+		docs.push_back(text);
+	}
+	docs.push_back("x" + ystring(100000, 'a') + "z");
+
+	Pire::ScanPool pool(3, 1024);
+	UNIT_ASSERT_EQUAL(pool.ThreadsCount(), 3u);
+	TVector< std::future<Pire::Scanner::State> > results;
+	TVector< std::future<Pire::SlowScanner::State> > slowResults;
+	std::atomic<size_t> mismatches(0), calls(0);
+	for (auto&& doc : docs) {
+		results.push_back(pool.Scan(sc, doc));
+		slowResults.push_back(pool.Scan(slow, doc));
+		Pire::NonrelocScanner::State expected = Pire::Runner(nonreloc).Begin().Run(doc).End().State();
+		pool.Scan(nonreloc, doc.c_str(), doc.c_str() + doc.size(), [&, expected](const Pire::NonrelocScanner::State& st) {
+			if (st != expected)
+				++mismatches;
+			++calls;
+		});
+	}
+	for (size_t i = 0; i != docs.size(); ++i) {
+		Pire::Scanner::State st = results[i].get();
+		UNIT_ASSERT_EQUAL(st, Pire::Runner(sc).Begin().Run(docs[i]).End().State());
+		UNIT_ASSERT_EQUAL(slow.Final(slowResults[i].get()), slow.Final(Pire::Runner(slow).Begin().Run(docs[i]).End().State()));
+		if (i + 1 == docs.size())
+			UNIT_ASSERT(sc.Final(st));
+	}
+	while (calls.load() != docs.size())
+		std::this_thread::yield();
+	UNIT_ASSERT_EQUAL(mismatches.load(), 0u);
+}
+
+template<class Scanner>
+void TestCompactSimpleScanner()
+{
+	Scanner sc = ParseRegexp("^x[^\n]*z$|a[0-9]+b").Compile<Scanner>();
+	Pire::SimpleScanner simple = ParseRegexp("^x[^\n]*z$|a[0-9]+b").Compile<Pire::SimpleScanner>();
+	UNIT_ASSERT_EQUAL(sc.Size(), simple.Size());
+	UNIT_ASSERT(sc.BufSize() * 3 <= simple.BufSize() * 2);
+
+	BufferOutput wbuf;
+	Save(&wbuf, sc);
+	MemoryInput rbuf(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+	Scanner loaded;
+	Load(&rbuf, loaded);
+	TVector<char> buf(wbuf.Buffer().Size() + sizeof(size_t));
+	const void* ptr = Pire::Impl::AlignUp(&buf[0], sizeof(size_t));
+	memcpy((void*) ptr, wbuf.Buffer().Data(), wbuf.Buffer().Size());
+	Scanner mapped;
+	UNIT_ASSERT_EQUAL(mapped.Mmap(ptr, wbuf.Buffer().Size()), (const void*) ((const char*) ptr + wbuf.Buffer().Size()));
+	Scanner clone = mapped.Clone();
+
+	const char* texts[] = { "", "xz", "x123z", "yxz", "a1b", "ab", "zza999bzz", "x\nz", "xa1bz" };
+	for (auto&& text : texts) {
+		bool expected = Matches(simple, text);
+		UNIT_ASSERT_EQUAL(Matches(sc, text), expected);
+		UNIT_ASSERT_EQUAL(Matches(loaded, text), expected);
+		UNIT_ASSERT_EQUAL(Matches(mapped, text), expected);
+		UNIT_ASSERT_EQUAL(Matches(clone, text), expected);
+		UNIT_ASSERT_EQUAL(sc.StateIndex(RunRegexp(sc, text)), simple.StateIndex(RunRegexp(simple, text)));
+	}
+	Scanner anchored = ParseRegexp("^abc", "n").Compile<Scanner>();
+	UNIT_ASSERT(anchored.Dead(Pire::Runner(anchored).Begin().Run(ystring("abd")).State()));
+	UNIT_ASSERT(!anchored.Dead(Pire::Runner(anchored).Begin().Run(ystring("ab")).State()));
+	UNIT_ASSERT_EQUAL(Pire::ShortestPrefix(sc, "a12bcd", "a12bcd" + 6) - "a12bcd", 4);
+}
+
+SIMPLE_UNIT_TEST(CompactSimpleScanner)
+{
+	TestCompactSimpleScanner<Pire::CompactSimpleScanner>();
+	TestCompactSimpleScanner<Pire::CompactSimpleScanner16>();
+	UNIT_ASSERT(Pire::CompactSimpleScanner16::Fits(200));
+	UNIT_ASSERT(!Pire::CompactSimpleScanner16::Fits(1000));
+	UNIT_ASSERT(Pire::CompactSimpleScanner::Fits(1000000));
+	try {
+		ParseRegexp("(a|b)*a(a|b){8}", "n").Compile<Pire::CompactSimpleScanner16>();
+		UNIT_ASSERT(false);
+	} catch (Pire::Error&) {}
+
+	// Cell width is a part of the format
+	BufferOutput wbuf;
+	Save(&wbuf, ParseRegexp("abc").Compile<Pire::CompactSimpleScanner>());
+	MemoryInput rbuf(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+	Pire::CompactSimpleScanner16 sc16;
+	try {
+		Load(&rbuf, sc16);
+		UNIT_ASSERT(false);
+	} catch (Pire::Error&) {}
+}
+
+SIMPLE_UNIT_TEST(ParserValues)
+{
+	// Empty concatenations, alone and next to groups and repetitions
+	REGEXP2("^()$", "n") {
+		ACCEPTS("");
+		DENIES("a");
+	}
+	REGEXP2("^(|a)b$", "n") {
+		ACCEPTS("b");
+		ACCEPTS("ab");
+		DENIES("aab");
+	}
+	REGEXP2("^x()y$", "n") {
+		ACCEPTS("xy");
+		DENIES("x");
+	}
+	REGEXP2("^(ab){2}c*(d|e)+f?$", "n") {
+		ACCEPTS("ababd");
+		ACCEPTS("ababccdedf");
+		DENIES("abd");
+		DENIES("ababcc");
+	}
+	REGEXP2("^((a|)b)*$", "n") {
+		ACCEPTS("");
+		ACCEPTS("babb");
+		DENIES("aa");
+	}
+
+	// Values held by the parser are released when it stops at an error,
+	// and the lexer remains usable afterwards
+	const char* broken[] = { "(ab", "ab)", "a{2", "[ab", "a|(b|(c", "((a)b))" };
+	Pire::Lexer lexer;
+	for (auto&& pattern : broken) {
+		lexer.Assign(pattern, pattern + strlen(pattern));
+		try {
+			lexer.Parse();
+			UNIT_ASSERT(!"Should report syntax error");
+		}
+		catch (Pire::Error&) {}
+	}
+	const char* good = "a(b|c)+";
+	lexer.Assign(good, good + strlen(good));
+	Pire::Scanner sc = lexer.Parse().Surround().Compile<Pire::Scanner>();
+	UNIT_ASSERT(Matches(sc, "xabcx"));
+	UNIT_ASSERT(!Matches(sc, "xax"));
+}
+
+SIMPLE_UNIT_TEST(SizeEstimate)
+{
+	Pire::Fsm fsm = ParseRegexp("(abc|def)+x?");
+	Pire::Fsm::SizeEstimate estimate = fsm.EstimateDeterminedSize();
+	UNIT_ASSERT_EQUAL(estimate.Confidence, 1.0);
+	fsm.Determine();
+	UNIT_ASSERT_EQUAL(estimate.States, fsm.Size());
+
+	estimate = ParseRegexp("a.{30}$").EstimateDeterminedSize();
+	UNIT_ASSERT(estimate.Confidence < 0.5);
+	UNIT_ASSERT(estimate.Exceeds(Pire::Fsm::DefaultMaxSize));
+
+	estimate = ParseRegexp("a.{5}$").EstimateDeterminedSize(10);
+	UNIT_ASSERT(estimate.Confidence < 1.0);
+	UNIT_ASSERT(!estimate.Exceeds(Pire::Fsm::DefaultMaxSize));
+
+	// Counted repetitions after loops are extrapolated within a small factor,
+	// and those which determine within the limit are not given up on
+	const char* fitting[] = { "a.{12}$", "(a|b)*a(a|b){10}$", "(a|b)*a(a|b){15}$", "(ab|cd)*e.{12}$" };
+	for (auto&& pattern : fitting) {
+		fsm = ParseRegexp(pattern);
+		estimate = fsm.EstimateDeterminedSize();
+		UNIT_ASSERT(estimate.Confidence < 0.9);
+		UNIT_ASSERT(!estimate.Exceeds(Pire::Fsm::DefaultMaxSize));
+		UNIT_ASSERT(fsm.Determine());
+		UNIT_ASSERT(estimate.MinStates <= 2 * fsm.Size());
+		UNIT_ASSERT(fsm.Size() <= estimate.States && estimate.States <= 3 * fsm.Size());
+	}
+
+	// Repetitions getting narrower further on make the extrapolation far too high,
+	// but the conservative estimate still holds
+	fsm = ParseRegexp("(abc|abd)*x.{8}y.{8}$");
+	estimate = fsm.EstimateDeterminedSize();
+	UNIT_ASSERT(estimate.States > Pire::Fsm::DefaultMaxSize);
+	UNIT_ASSERT(estimate.Confidence < 0.5);
+	UNIT_ASSERT(!estimate.Exceeds(Pire::Fsm::DefaultMaxSize));
+	UNIT_ASSERT(fsm.Determine());
+	UNIT_ASSERT(fsm.Size() < Pire::Fsm::DefaultMaxSize);
+	UNIT_ASSERT(estimate.MinStates <= 2 * fsm.Size());
+}
+
+SIMPLE_UNIT_TEST(EpsilonCycles)
+{
+	// 0 -> {1 <-> 2} -> 3 -a-> 4, 2 -b-> 5, with 4 final and 5 dead
+	Pire::Fsm fsm;
+	fsm.Resize(6);
+	fsm.SetFinal(0, false);
+	fsm.Connect(0, 1);
+	fsm.Connect(1, 2);
+	fsm.Connect(2, 1);
+	fsm.Connect(2, 3);
+	fsm.Connect(3, 4, 'a');
+	fsm.Connect(2, 5, 'b');
+	fsm.SetFinal(4, true);
+	fsm.SetTag(3, 1);
+
+	UNIT_ASSERT_EQUAL(fsm.DeadStates(), TSet<size_t>(std::initializer_list<size_t>{5}));
+	fsm.RemoveEpsilons();
+	for (size_t state = 0; state != 4; ++state) {
+		UNIT_ASSERT(fsm.Connected(state, 4, 'a'));
+		UNIT_ASSERT_EQUAL(fsm.Connected(state, 5, 'b'), (state != 3));
+		UNIT_ASSERT_EQUAL(fsm.Tag(state), 1ul);
+	}
+	UNIT_ASSERT(!fsm.Connected(0, 1));
+	fsm.RemoveDeadEnds();
+	UNIT_ASSERT(!fsm.Connected(0, 5, 'b'));
+	UNIT_ASSERT(fsm.Connected(0, 4, 'a'));
+
+	Pire::Scanner sc = fsm.Compile<Pire::Scanner>();
+	Pire::Scanner::State st;
+	sc.Initialize(st);
+	Pire::Step(sc, st, 'a');
+	UNIT_ASSERT(sc.Final(st));
+	sc.Initialize(st);
+	Pire::Step(sc, st, 'b');
+	UNIT_ASSERT(sc.Dead(st));
+}
+
+template<class Scanner>
+TSet<size_t> AcceptedBy(const Scanner& sc, const char* text)
+{
+	typename Scanner::State st = Pire::Runner(sc).Begin().Run(ystring(text)).End().State();
+	return TSet<size_t>(sc.AcceptedRegexps(st).first, sc.AcceptedRegexps(st).second);
+}
+
+SIMPLE_UNIT_TEST(Comb)
+{
+	const char* patterns[] = { "foo", "bar.*baz", "[0-9]+x", "^qux$", "hello world", "a[^b]c" };
+	const char* texts[] = { "", "foo", "xbarbaz", "12x", "qux", "xqux", "hello world foo", "abc", "aac bar 1x baz" };
+	Pire::Scanner sc;
+	for (size_t i = 0; i != sizeof(patterns) / sizeof(*patterns); ++i) {
+		Pire::Scanner next = ParseRegexp(patterns[i]).Compile<Pire::Scanner>();
+		sc = i ? Pire::Scanner::Glue(sc, next) : next;
+	}
+
+	TVector<size_t> hot;
+	Pire::Scanner::State init;
+	sc.Initialize(init);
+	hot.push_back(sc.StateIndex(init));
+	Pire::CombScanner combs[] = { Pire::CombScanner(sc), Pire::CombScanner(sc, hot) };
+	for (auto&& comb : combs) {
+		UNIT_ASSERT_EQUAL(comb.Size(), sc.Size());
+		UNIT_ASSERT_EQUAL(comb.RegexpsCount(), sc.RegexpsCount());
+		for (size_t i = 0; i != sizeof(texts) / sizeof(*texts); ++i)
+			UNIT_ASSERT(AcceptedBy(comb, texts[i]) == AcceptedBy(sc, texts[i]));
+	}
+	UNIT_ASSERT(combs[0].BufSize() < sc.BufSize());
+	UNIT_ASSERT(combs[0].CombSize() < combs[1].CombSize());
+
+	BufferOutput wbuf;
+	Save(&wbuf, combs[0]);
+	MemoryInput rbuf(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+	Pire::CombScanner loaded;
+	Load(&rbuf, loaded);
+	for (size_t i = 0; i != sizeof(texts) / sizeof(*texts); ++i)
+		UNIT_ASSERT(AcceptedBy(loaded, texts[i]) == AcceptedBy(sc, texts[i]));
+
+	TVector<char> buf(wbuf.Buffer().Size() + sizeof(size_t));
+	const char* ptr = Pire::Impl::AlignUp(&buf[0], sizeof(size_t));
+	memcpy((void*) ptr, wbuf.Buffer().Data(), wbuf.Buffer().Size());
+	Pire::CombScanner mapped;
+	UNIT_ASSERT_EQUAL(mapped.Mmap(ptr, wbuf.Buffer().Size()), ptr + wbuf.Buffer().Size());
+	for (size_t i = 0; i != sizeof(texts) / sizeof(*texts); ++i)
+		UNIT_ASSERT(AcceptedBy(mapped, texts[i]) == AcceptedBy(sc, texts[i]));
+
+	Pire::CombScanner single = ParseRegexp("a.{5}$").Compile<Pire::CombScanner>();
+	UNIT_ASSERT(Matches(single, "xxa12345"));
+	UNIT_ASSERT(!Matches(single, "xxa1234"));
 }
 
 SIMPLE_UNIT_TEST(Slow)
@@ -711,6 +1606,40 @@ SIMPLE_UNIT_TEST(Slow)
 	UNIT_ASSERT( Matches(sc, "....a.............................."));
 	UNIT_ASSERT(!Matches(sc, "....a..............................."));
 	UNIT_ASSERT(!Matches(sc, "....a............................."));
+
+	// Gluing does not determine anything, so the result is as small as its parts
+	Pire::SlowScanner glued = Pire::SlowScanner::Glue(sc, ParseRegexp("b.{20}$", "").Compile<Pire::SlowScanner>());
+	UNIT_ASSERT_EQUAL(glued.RegexpsCount(), size_t(2));
+	UNIT_ASSERT(glued.Size() < 2 * sc.Size() + 1);
+	UNIT_ASSERT(Pire::SlowScanner::Glue(sc, glued, 10).Empty());
+
+	BufferOutput wbuf;
+	Save(&wbuf, glued);
+	Pire::SlowScanner loaded;
+	MemoryInput rbuf(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+	Load(&rbuf, loaded);
+	TVector<char> buf(wbuf.Buffer().Size() + sizeof(size_t));
+	const char* ptr = Pire::Impl::AlignUp(&buf[0], sizeof(size_t));
+	memcpy((void*) ptr, wbuf.Buffer().Data(), wbuf.Buffer().Size());
+	Pire::SlowScanner mapped;
+	UNIT_ASSERT_EQUAL(mapped.Mmap(ptr, wbuf.Buffer().Size()), ptr + wbuf.Buffer().Size());
+
+	const Pire::SlowScanner* scanners[] = { &glued, &loaded, &mapped };
+	for (auto&& scanner : scanners) {
+		//                                  123456789012345678901234567890
+		auto state = RunRegexp(*scanner, "..a.........b....................");
+		auto res = scanner->AcceptedRegexps(state);
+		UNIT_ASSERT_EQUAL(res.second - res.first, ssize_t(2));
+		state = RunRegexp(*scanner, "..a.........c....................");
+		res = scanner->AcceptedRegexps(state);
+		UNIT_ASSERT_EQUAL(res.second - res.first, ssize_t(1));
+		UNIT_ASSERT_EQUAL(res.first[0], size_t(0));
+		state = RunRegexp(*scanner, "..b....................");
+		res = scanner->AcceptedRegexps(state);
+		UNIT_ASSERT_EQUAL(res.second - res.first, ssize_t(1));
+		UNIT_ASSERT_EQUAL(res.first[0], size_t(1));
+		UNIT_ASSERT(!Matches(*scanner, "..b..................."));
+	}
 }
 
 class AlignedString {
@@ -825,6 +1754,8 @@ SIMPLE_UNIT_TEST(EmptyScanner)
 	}
 
 	BasicTestEmptySaveLoadMmap<Pire::SimpleScanner>();
+	BasicTestEmptySaveLoadMmap<Pire::CompactSimpleScanner>();
+	BasicTestEmptySaveLoadMmap<Pire::CompactSimpleScanner16>();
 
 	BasicTestEmptySaveLoadMmap<Pire::SlowScanner>();
 }
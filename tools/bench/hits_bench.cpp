@@ -0,0 +1,149 @@
+/*
+ * hits_bench.cpp -- overhead of RegexpHits on scans of short texts
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include <pire/pire.h>
+#include <pire/stub/lexical_cast.h>
+
+typedef std::chrono::steady_clock Clock;
+
+std::runtime_error usage(
+	"Usage: hits_bench [-j threads] [-n texts] [-l length] [-s sample_rate] [-c repetition_count] regexp...\n"
+	"Scans short texts in several threads, without hit counters and with RegexpHits\n"
+	"recording every scan and every sample_rate-th scan");
+
+std::vector<std::string> MakeTexts(size_t count, size_t length)
+{
+	std::vector<std::string> texts(count);
+	unsigned seed = 17;
+	for (auto&& text : texts) {
+		text.reserve(length);
+		for (size_t j = 0; j != length; ++j) {
+			seed = seed * 1103515245 + 12345;
+			text += "abcdefghijklmnopqrstuvwxyz 0123456789\n"[(seed >> 16) % 38];
+		}
+	}
+	return texts;
+}
+
+/// Scans all texts in @p threads threads, @p rounds times over, passing each final state to @p record
+template<class Record>
+Clock::duration Scan(const Pire::Scanner& sc, const std::vector<std::string>& texts, size_t threads, size_t rounds, Record record)
+{
+	Clock::time_point start = Clock::now();
+	std::vector<std::thread> workers;
+	for (size_t t = 0; t != threads; ++t)
+		workers.push_back(std::thread([&, t]() {
+			for (size_t round = 0; round != rounds; ++round)
+				for (size_t i = t; i < texts.size(); i += threads)
+					record(Pire::Runner(sc).Begin().Run(texts[i]).End().State());
+		}));
+	for (auto&& worker : workers)
+		worker.join();
+	return Clock::now() - start;
+}
+
+void Report(const std::string& name, Clock::duration elapsed, Clock::duration baseline)
+{
+	double sec = std::chrono::duration<double>(elapsed).count();
+	double base = std::chrono::duration<double>(baseline).count();
+	std::cout << name << ": " << static_cast<long long>(sec * 1000000) << " us\t"
+		<< (sec - base) * 100 / base << "% overhead" << std::endl;
+}
+
+void Main(int argc, char** argv)
+{
+	size_t threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	size_t count = 100000;
+	size_t length = 64;
+	size_t sampleRate = 64;
+	size_t rounds = 10;
+	int repCount = 3;
+	std::vector<std::string> patterns;
+	for (--argc, ++argv; argc; --argc, ++argv) {
+		if (!strcmp(*argv, "-j") && argc >= 2) {
+			threads = Pire::FromString<size_t>(argv[1]);
+			--argc, ++argv;
+		} else if (!strcmp(*argv, "-n") && argc >= 2) {
+			count = Pire::FromString<size_t>(argv[1]);
+			--argc, ++argv;
+		} else if (!strcmp(*argv, "-l") && argc >= 2) {
+			length = Pire::FromString<size_t>(argv[1]);
+			--argc, ++argv;
+		} else if (!strcmp(*argv, "-s") && argc >= 2) {
+			sampleRate = Pire::FromString<size_t>(argv[1]);
+			--argc, ++argv;
+		} else if (!strcmp(*argv, "-c") && argc >= 2) {
+			repCount = Pire::FromString<int>(argv[1]);
+			--argc, ++argv;
+		} else
+			patterns.push_back(*argv);
+	}
+	if (patterns.empty() || !threads || !count)
+		throw usage;
+
+	Pire::Scanner sc;
+	for (auto&& pattern : patterns) {
+		Pire::Scanner next = Pire::Lexer(pattern).Parse().Surround().Compile<Pire::Scanner>();
+		sc = sc.Empty() ? next : Pire::Scanner::Glue(sc, next);
+		if (sc.Empty())
+			throw std::runtime_error("too many regexps to glue");
+	}
+
+	std::vector<std::string> texts = MakeTexts(count, length);
+	std::cout << texts.size() << " texts of " << length << " bytes, " << threads << " threads, "
+		<< sc.RegexpsCount() << " regexps, " << sc.Size() << " states" << std::endl;
+
+	for (int rep = 0; rep != repCount; ++rep) {
+		Clock::duration plain = Scan(sc, texts, threads, rounds, [&](const Pire::Scanner::State& st) {
+			// Keep the scan from being optimized away
+			static thread_local size_t finals = 0;
+			finals += sc.Final(st);
+		});
+		std::cout << "no counters: " << std::chrono::duration_cast<std::chrono::microseconds>(plain).count() << " us" << std::endl;
+
+		Pire::RegexpHits<Pire::Scanner> all(sc);
+		Report("every scan ", Scan(sc, texts, threads, rounds, [&](const Pire::Scanner::State& st) { all.Record(st); }), plain);
+
+		Pire::RegexpHits<Pire::Scanner> sampled(sc, sampleRate);
+		Report("sampled    ", Scan(sc, texts, threads, rounds, [&](const Pire::Scanner::State& st) { sampled.Record(st); }), plain);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try {
+		Main(argc, argv);
+		return 0;
+	}
+	catch (std::exception& e) {
+		std::cout << "hits_bench: " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,143 @@
+/*
+ * pool_bench.cpp -- ScanPool versus hand-made fan-out on skewed document sizes
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include <pire/pire.h>
+#include <pire/stub/lexical_cast.h>
+
+typedef std::chrono::steady_clock Clock;
+
+std::runtime_error usage(
+	"Usage: pool_bench [-j threads] [-n documents] [-m max_size_mb] [-c repetition_count] regexp...\n"
+	"Scans documents of skewed sizes (a few are up to max_size, the rest about 1 KB)\n"
+	"with a static fan-out over threads and with Pire::ScanPool");
+
+/// Most documents are around 1 KB, every 64th is up to @p maxSize bytes
+std::vector<std::string> MakeDocuments(size_t count, size_t maxSize)
+{
+	std::vector<std::string> docs(count);
+	unsigned seed = 17;
+	for (size_t i = 0; i != count; ++i) {
+		seed = seed * 1103515245 + 12345;
+		size_t len = (i % 64 == 0) ? maxSize / (1 + (seed >> 16) % 4) : 512 + (seed >> 16) % 1024;
+		docs[i].reserve(len);
+		for (size_t j = 0; j != len; ++j) {
+			seed = seed * 1103515245 + 12345;
+			docs[i] += "abcdefghijklmnopqrstuvwxyz 0123456789\n"[(seed >> 16) % 38];
+		}
+	}
+	return docs;
+}
+
+void Report(const std::string& name, Clock::duration elapsed, size_t bytes, size_t matched)
+{
+	double sec = std::chrono::duration<double>(elapsed).count();
+	std::cout << name << ": " << static_cast<long long>(sec * 1000000) << " us\t"
+		<< bytes / (1024.0 * 1024.0 * sec) << " MB/sec\t" << matched << " matched" << std::endl;
+}
+
+void Main(int argc, char** argv)
+{
+	size_t threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	size_t count = 4096;
+	size_t maxSize = 64;
+	int repCount = 3;
+	std::vector<std::string> patterns;
+	for (--argc, ++argv; argc; --argc, ++argv) {
+		if (!strcmp(*argv, "-j") && argc >= 2) {
+			threads = Pire::FromString<size_t>(argv[1]);
+			--argc, ++argv;
+		} else if (!strcmp(*argv, "-n") && argc >= 2) {
+			count = Pire::FromString<size_t>(argv[1]);
+			--argc, ++argv;
+		} else if (!strcmp(*argv, "-m") && argc >= 2) {
+			maxSize = Pire::FromString<size_t>(argv[1]);
+			--argc, ++argv;
+		} else if (!strcmp(*argv, "-c") && argc >= 2) {
+			repCount = Pire::FromString<int>(argv[1]);
+			--argc, ++argv;
+		} else
+			patterns.push_back(*argv);
+	}
+	if (patterns.empty() || !threads || !count)
+		throw usage;
+
+	Pire::Scanner sc;
+	for (auto&& pattern : patterns) {
+		Pire::Scanner next = Pire::Lexer(pattern).Parse().Surround().Compile<Pire::Scanner>();
+		sc = sc.Empty() ? next : Pire::Scanner::Glue(sc, next);
+		if (sc.Empty())
+			throw std::runtime_error("too many regexps to glue");
+	}
+
+	std::vector<std::string> docs = MakeDocuments(count, maxSize << 20);
+	size_t bytes = 0;
+	for (auto&& doc : docs)
+		bytes += doc.size();
+	std::cout << docs.size() << " documents, " << bytes / (1024 * 1024) << " MB, "
+		<< threads << " threads, " << sc.Size() << " states" << std::endl;
+
+	for (int rep = 0; rep != repCount; ++rep) {
+		// Each thread takes an equal share of documents
+		std::vector<char> matches(docs.size());
+		Clock::time_point start = Clock::now();
+		std::vector<std::thread> workers;
+		for (size_t t = 0; t != threads; ++t)
+			workers.push_back(std::thread([&, t]() {
+				for (size_t i = t; i < docs.size(); i += threads)
+					matches[i] = sc.Final(Pire::Runner(sc).Begin().Run(docs[i]).End().State());
+			}));
+		for (auto&& worker : workers)
+			worker.join();
+		Report("fan-out ", Clock::now() - start, bytes, std::count(matches.begin(), matches.end(), 1));
+
+		std::fill(matches.begin(), matches.end(), 0);
+		start = Clock::now();
+		{
+			Pire::ScanPool pool(threads);
+			for (size_t i = 0; i != docs.size(); ++i)
+				pool.Scan(sc, docs[i].c_str(), docs[i].c_str() + docs[i].size(), [&, i](const Pire::Scanner::State& st) {
+					matches[i] = sc.Final(st);
+				});
+		}
+		Report("ScanPool", Clock::now() - start, bytes, std::count(matches.begin(), matches.end(), 1));
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try {
+		Main(argc, argv);
+		return 0;
+	}
+	catch (std::exception& e) {
+		std::cout << "pool_bench: " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,489 @@
+/*
+ * pire_stat.cpp -- inspects a saved scanner: table layout, state
+ *                  statistics and a cost model, optionally checked
+ *                  against a sample corpus
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+#include <algorithm>
+#include <bitset>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string.h>
+#include <vector>
+#include <pire/pire.h>
+#include <pire/extra.h>
+#include <pire/stub/lexical_cast.h>
+#include "../common/filemap.h"
+
+typedef std::chrono::steady_clock Clock;
+
+std::runtime_error usage(
+	"Usage: pire_stat [-c corpus] [-r repetition_count] [-g cpu_ghz] [-t top_states] scanner_file\n"
+	"Reports the layout of a saved scanner, its state statistics and an estimated cost per byte.\n"
+	"With a corpus, also measures throughput and how the scan is spread among states.");
+
+struct Options {
+	std::string file;
+	std::string corpus;
+	int repCount = 3;
+	double ghz = 0;
+	size_t top = 10;
+};
+
+/// A part of the scanner image
+struct Component {
+	std::string name;
+	size_t bytes;
+};
+
+/// Whatever a particular scanner type knows about itself
+struct Description {
+	std::string type;
+	size_t imageSize = 0;
+	std::vector<Component> layout;
+
+	/// Bytes of transition table a state occupies
+	size_t rowBytes = 0;
+	/// Table loads each input byte waits for (letter lookups can be issued ahead and do not count)
+	size_t dependentLoads = 1;
+
+	bool hasShortcuts = false;
+	size_t shortcutStates = 0;
+	size_t noExitStates = 0;
+};
+
+/**
+ * The cost model: a step waits for the load of the next transition, which
+ * takes the latency of the cache level the touched part of the table fits into.
+ * Sizes and latencies are those of a typical x86 core.
+ */
+struct CacheLevel {
+	const char* name;
+	size_t size;
+	double latency;
+};
+
+const CacheLevel CacheLevels[] = {
+	{ "L1",     32 << 10, 4 },
+	{ "L2",     1 << 20,  14 },
+	{ "L3",     16 << 20, 40 },
+	{ "memory", static_cast<size_t>(-1), 200 }
+};
+
+const size_t CacheLine = 64;
+
+const CacheLevel& LevelFor(size_t bytes)
+{
+	const CacheLevel* level = CacheLevels;
+	while (bytes > level->size)
+		++level;
+	return *level;
+}
+
+std::string Percent(size_t part, size_t total)
+{
+	return total ? Pire::ToString(static_cast<double>(part) * 100 / total).substr(0, 5) + "%" : "n/a";
+}
+
+std::string Bytes(size_t bytes)
+{
+	if (bytes >= (10 << 20))
+		return Pire::ToString(bytes >> 20) + " MB";
+	else if (bytes >= (10 << 10))
+		return Pire::ToString(bytes >> 10) + " KB";
+	else
+		return Pire::ToString(bytes) + " bytes";
+}
+
+void PrintCost(const std::string& what, double cyclesPerByte, const Options& opts)
+{
+	std::cout << what << ": " << cyclesPerByte << " cycles/byte, " << 1 / cyclesPerByte << " bytes/cycle";
+	if (opts.ghz)
+		std::cout << " (" << opts.ghz * 1000 / cyclesPerByte << " MB/sec at " << opts.ghz << " GHz)";
+	std::cout << std::endl;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Type-specific parts
+
+template<class Scanner>
+typename Scanner::State StateAt(const Scanner& sc, size_t idx) { return sc.IndexToState(idx); }
+
+Pire::CombScanner::State StateAt(const Pire::CombScanner&, size_t idx) { return idx; }
+
+/// Only Scanner has exit masks
+template<class Scanner>
+void CountShortcuts(const Scanner&, Description&) {}
+
+template<class Relocation, class Shortcutting>
+void CountShortcuts(const Pire::Impl::Scanner<Relocation, Shortcutting>& sc, Description& d)
+{
+	d.hasShortcuts = Shortcutting::ExitMaskCount != 0;
+	for (size_t i = 0; i != sc.Size(); ++i) {
+		typename Pire::Impl::Scanner<Relocation, Shortcutting>::State state = sc.IndexToState(i);
+		if (Shortcutting::NoExit(sc, state))
+			++d.noExitStates;
+		else if (!Shortcutting::NoShortcut(sc, state))
+			++d.shortcutStates;
+	}
+}
+
+template<class Scanner>
+size_t FinalTableSize(const Scanner& sc)
+{
+	size_t size = 0;
+	for (size_t i = 0; i != sc.Size(); ++i) {
+		auto accepted = sc.AcceptedRegexps(StateAt(sc, i));
+		size += (accepted.second - accepted.first) + 1;
+	}
+	return size;
+}
+
+template<class Relocation, class Shortcutting>
+void Describe(const Pire::Impl::Scanner<Relocation, Shortcutting>& sc, Description& d)
+{
+	typedef Pire::Impl::Scanner<Relocation, Shortcutting> Scanner;
+	d.type = std::string("Scanner")
+		+ (Shortcutting::ExitMaskCount ? ", exit masks" : ", no shortcuts")
+		+ (Shortcutting::SeparateHeaders ? ", split row headers" : "");
+	d.rowBytes = sc.IndexToState(1) - sc.IndexToState(0);
+
+	d.layout.push_back(Component { "letters", Pire::MaxChar * sizeof(typename Scanner::Letter) });
+	d.layout.push_back(Component { "final table", FinalTableSize(sc) * sizeof(size_t) });
+	d.layout.push_back(Component { "final index", sc.Size() * sizeof(size_t) });
+	d.layout.push_back(Component { "rows", sc.Size() * d.rowBytes });
+	if (Shortcutting::SeparateHeaders) {
+		size_t stride = reinterpret_cast<const char*>(&sc.Header(sc.IndexToState(1)))
+			- reinterpret_cast<const char*>(&sc.Header(sc.IndexToState(0)));
+		d.layout.push_back(Component { "row headers", sc.Size() * stride });
+	} else
+		d.layout.push_back(Component { "row headers (within rows)", sc.Size() * sizeof(typename Scanner::ScannerRowHeader) });
+	CountShortcuts(sc, d);
+}
+
+void Describe(const Pire::SimpleScanner& sc, Description& d)
+{
+	d.type = "SimpleScanner";
+	d.rowBytes = sc.IndexToState(1) - sc.IndexToState(0);
+	d.layout.push_back(Component { "rows", sc.BufSize() });
+}
+
+template<class Cell>
+void Describe(const Pire::Impl::CompactSimpleScanner<Cell>& sc, Description& d)
+{
+	d.type = "CompactSimpleScanner, " + Pire::ToString(sizeof(Cell) * 8) + "-bit cells";
+	d.rowBytes = (sc.IndexToState(1) - sc.IndexToState(0)) * sizeof(Cell);
+	d.layout.push_back(Component { "rows", sc.BufSize() });
+}
+
+void Describe(const Pire::CombScanner& sc, Description& d)
+{
+	d.type = "CombScanner";
+	// A step reads the state's base, then the cell; a cell takes 8 bytes
+	d.dependentLoads = 2;
+	d.rowBytes = sc.Size() ? sc.CombSize() * 8 / sc.Size() : 0;
+	d.layout.push_back(Component { "letters", Pire::MaxChar * sizeof(Pire::CombScanner::Letter) });
+	d.layout.push_back(Component { "final table", FinalTableSize(sc) * sizeof(size_t) });
+	d.layout.push_back(Component { "final index", sc.Size() * sizeof(Pire::ui32) });
+	d.layout.push_back(Component { "flags", sc.Size() * sizeof(Pire::CombScanner::Tag) });
+	d.layout.push_back(Component { "bases and defaults", sc.Size() * 8 });
+	d.layout.push_back(Component { "cells", sc.CombSize() * 8 });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Common parts
+
+void PrintLayout(const Description& d)
+{
+	std::cout << "image: " << Bytes(d.imageSize) << std::endl;
+	for (auto&& c : d.layout)
+		std::cout << "  " << c.name << ": " << Bytes(c.bytes) << std::endl;
+}
+
+/// Runs the scanner over the corpus a few times and reports the best run
+template<class Scanner>
+void Measure(const Scanner& sc, const FileMmap& corpus, const Options& opts)
+{
+	double best = 0;
+	bool final = false;
+	for (int rep = 0; rep != opts.repCount; ++rep) {
+		Clock::time_point start = Clock::now();
+		typename Scanner::State st;
+		sc.Initialize(st);
+		Pire::Step(sc, st, Pire::BeginMark);
+		Pire::Run(sc, st, corpus.Begin(), corpus.End());
+		Pire::Step(sc, st, Pire::EndMark);
+		double sec = std::chrono::duration<double>(Clock::now() - start).count();
+		if (!rep || sec < best)
+			best = sec;
+		final = sc.Final(st);
+	}
+	std::cout << "measured: " << corpus.Size() / (1024.0 * 1024.0 * best) << " MB/sec"
+		<< (final ? ", corpus matches" : ", corpus does not match") << std::endl;
+	if (opts.ghz && best)
+		std::cout << "measured: " << corpus.Size() / (best * opts.ghz * 1e9) << " bytes/cycle" << std::endl;
+}
+
+/**
+ * Steps through the corpus one character at a time, counting visits of
+ * each state and the characters read in it, and estimates the cost of
+ * a byte assuming the hottest states stay in the closest caches.
+ */
+template<class Scanner>
+void Profile(const Scanner& sc, const Description& d, const FileMmap& corpus, const Options& opts)
+{
+	std::vector<size_t> visits(sc.Size());
+	std::vector< std::bitset<Pire::MaxChar> > columns(sc.Size());
+	typename Scanner::State st;
+	sc.Initialize(st);
+	Pire::Step(sc, st, Pire::BeginMark);
+	for (const char* p = corpus.Begin(); p != corpus.End(); ++p) {
+		size_t idx = sc.StateIndex(st);
+		++visits[idx];
+		columns[idx].set(static_cast<unsigned char>(*p));
+		Pire::Step(sc, st, static_cast<unsigned char>(*p));
+	}
+
+	std::vector<size_t> order;
+	for (size_t i = 0; i != sc.Size(); ++i)
+		if (visits[i])
+			order.push_back(i);
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return visits[a] > visits[b]; });
+
+	size_t steps = corpus.Size();
+	std::cout << "corpus: " << Bytes(steps) << ", " << order.size() << " of " << sc.Size() << " states visited" << std::endl;
+	if (!steps)
+		return;
+
+	size_t top = 0;
+	for (size_t i = 0; i != std::min(opts.top, order.size()); ++i)
+		top += visits[order[i]];
+	std::cout << "hot states: top " << std::min(opts.top, order.size()) << " take " << Percent(top, steps) << " of steps" << std::endl;
+
+	// A state touches at most a cache line per distinct character read in it
+	const size_t thresholds[] = { 50, 90, 99 };
+	const size_t* threshold = thresholds;
+	size_t covered = 0;
+	size_t footprint = 0;
+	double cycles = 0;
+	for (size_t i = 0; i != order.size(); ++i) {
+		size_t idx = order[i];
+		footprint += std::min(d.rowBytes, columns[idx].count() * CacheLine);
+		cycles += static_cast<double>(visits[idx]) * LevelFor(footprint).latency;
+		covered += visits[idx];
+		for (; threshold != thresholds + 3 && covered * 100 >= steps * *threshold; ++threshold)
+			std::cout << "  " << *threshold << "% of steps: " << i + 1 << " states, "
+				<< Bytes(footprint) << " touched" << std::endl;
+	}
+	PrintCost("estimated on corpus", cycles * d.dependentLoads / steps, opts);
+}
+
+template<class Scanner>
+void Inspect(const Scanner& sc, Description& d, const Options& opts)
+{
+	Describe(sc, d);
+	std::cout << "type: " << d.type << std::endl;
+	std::cout << "states: " << sc.Size() << ", letter classes: " << sc.LettersCount()
+		<< ", regexps: " << sc.RegexpsCount() << std::endl;
+	PrintLayout(d);
+
+	size_t finals = 0, dead = 0;
+	std::map<size_t, size_t> accepted;
+	for (size_t i = 0; i != sc.Size(); ++i) {
+		typename Scanner::State state = StateAt(sc, i);
+		finals += sc.Final(state) ? 1 : 0;
+		dead += sc.Dead(state) ? 1 : 0;
+		auto range = sc.AcceptedRegexps(state);
+		// Bucket by powers of two: 0, 1, 2, 3-4, 5-8, ...
+		size_t size = range.second - range.first;
+		size_t bucket = 0;
+		while (bucket < size)
+			bucket = bucket ? bucket * 2 : 1;
+		++accepted[bucket];
+	}
+	std::cout << "final states: " << finals << ", dead: " << dead;
+	if (d.hasShortcuts)
+		std::cout << ", no exit: " << d.noExitStates;
+	std::cout << std::endl;
+	if (d.hasShortcuts)
+		std::cout << "shortcut coverage: " << d.shortcutStates << " states (" << Percent(d.shortcutStates, sc.Size()) << ")" << std::endl;
+	else
+		std::cout << "shortcut coverage: none (no exit masks in this scanner type)" << std::endl;
+	std::cout << "accepted set sizes:";
+	for (auto&& bucket : accepted)
+		std::cout << " " << (bucket.first > 2 ? Pire::ToString(bucket.first / 2 + 1) + "-" : "")
+			<< bucket.first << ": " << bucket.second;
+	std::cout << std::endl;
+
+	const CacheLevel& level = LevelFor(sc.Size() * d.rowBytes);
+	std::cout << "row: " << d.rowBytes << " bytes, transition table fits into " << level.name << std::endl;
+	PrintCost("estimated for uniform access", level.latency * d.dependentLoads, opts);
+
+	if (!opts.corpus.empty()) {
+		FileMmap corpus(opts.corpus.c_str());
+		Profile(sc, d, corpus, opts);
+		Measure(sc, corpus, opts);
+	}
+}
+
+/// Scanners without numbered states: only sizes and throughput
+template<class Scanner>
+void InspectBasic(const Scanner& sc, size_t letters, Description& d, const Options& opts)
+{
+	std::cout << "type: " << d.type << std::endl;
+	std::cout << "states: " << sc.Size() << ", letter classes: " << letters
+		<< ", regexps: " << sc.RegexpsCount() << std::endl;
+	PrintLayout(d);
+	if (!opts.corpus.empty()) {
+		FileMmap corpus(opts.corpus.c_str());
+		Measure(sc, corpus, opts);
+	}
+}
+
+template<class Scanner>
+bool TryMmap(Scanner& sc, const FileMmap& fmap, Description& d)
+{
+	try {
+		const void* end = sc.Mmap(fmap.Begin(), fmap.Size());
+		d.imageSize = static_cast<const char*>(end) - fmap.Begin();
+		return true;
+	}
+	catch (Pire::Error&) {
+		return false;
+	}
+}
+
+void Main(int argc, char** argv)
+{
+	Options opts;
+	for (--argc, ++argv; argc; --argc, ++argv) {
+		if (!strcmp(*argv, "-c") && argc >= 2) {
+			opts.corpus = argv[1];
+			--argc, ++argv;
+		} else if (!strcmp(*argv, "-r") && argc >= 2) {
+			opts.repCount = Pire::FromString<int>(argv[1]);
+			--argc, ++argv;
+		} else if (!strcmp(*argv, "-g") && argc >= 2) {
+			opts.ghz = Pire::FromString<double>(argv[1]);
+			--argc, ++argv;
+		} else if (!strcmp(*argv, "-t") && argc >= 2) {
+			opts.top = Pire::FromString<size_t>(argv[1]);
+			--argc, ++argv;
+		} else if (opts.file.empty())
+			opts.file = *argv;
+		else
+			throw usage;
+	}
+	if (opts.file.empty() || opts.repCount <= 0)
+		throw usage;
+
+	FileMmap fmap(opts.file.c_str());
+	if (fmap.Size() < sizeof(Pire::Header))
+		throw std::runtime_error("file too short for a saved scanner");
+	Pire::Header hdr(Pire::ScannerIOTypes::NoScanner, 0);
+	memcpy(&hdr, fmap.Begin(), sizeof(hdr));
+	hdr.Validate(Pire::ScannerIOTypes::NoScanner, 0);
+
+	Description d;
+	switch (hdr.Type) {
+	case Pire::ScannerIOTypes::Scanner: {
+		// The header does not tell the shortcutting policy; Mmap() refuses a wrong one
+		Pire::Scanner sc;
+		Pire::ScannerNoMask noMask;
+		Pire::ScannerSplitHeaders split;
+		if (TryMmap(sc, fmap, d))
+			Inspect(sc, d, opts);
+		else if (TryMmap(noMask, fmap, d))
+			Inspect(noMask, d, opts);
+		else if (TryMmap(split, fmap, d))
+			Inspect(split, d, opts);
+		else
+			sc.Mmap(fmap.Begin(), fmap.Size());
+		break;
+	}
+	case Pire::ScannerIOTypes::SimpleScanner: {
+		Pire::SimpleScanner sc;
+		d.imageSize = static_cast<const char*>(sc.Mmap(fmap.Begin(), fmap.Size())) - fmap.Begin();
+		Inspect(sc, d, opts);
+		break;
+	}
+	case Pire::ScannerIOTypes::CompactSimpleScanner: {
+		Pire::CompactSimpleScanner sc;
+		Pire::CompactSimpleScanner16 sc16;
+		if (TryMmap(sc, fmap, d))
+			Inspect(sc, d, opts);
+		else {
+			d.imageSize = static_cast<const char*>(sc16.Mmap(fmap.Begin(), fmap.Size())) - fmap.Begin();
+			Inspect(sc16, d, opts);
+		}
+		break;
+	}
+	case Pire::ScannerIOTypes::CombScanner: {
+		Pire::CombScanner sc;
+		d.imageSize = static_cast<const char*>(sc.Mmap(fmap.Begin(), fmap.Size())) - fmap.Begin();
+		Inspect(sc, d, opts);
+		break;
+	}
+	case Pire::ScannerIOTypes::SlowScanner: {
+		Pire::SlowScanner sc;
+		d.imageSize = static_cast<const char*>(sc.Mmap(fmap.Begin(), fmap.Size())) - fmap.Begin();
+		d.type = "SlowScanner";
+		InspectBasic(sc, sc.GetLettersCount(), d, opts);
+		break;
+	}
+	case Pire::ScannerIOTypes::LoadedScanner: {
+		// Counting and capturing scanners share the layout
+		Pire::CountingScanner sc;
+		d.imageSize = static_cast<const char*>(sc.Mmap(fmap.Begin(), fmap.Size())) - fmap.Begin();
+		d.type = "LoadedScanner (counting or capturing)";
+		d.layout.push_back(Component { "letters", Pire::MaxChar * sizeof(Pire::LoadedScanner::Letter) });
+		d.layout.push_back(Component { "jumps", sc.Size() * sc.StateSize() });
+		d.layout.push_back(Component { "tags", sc.Size() * sizeof(Pire::LoadedScanner::Tag) });
+		InspectBasic(sc, sc.LettersCount(), d, opts);
+		break;
+	}
+	case Pire::ScannerIOTypes::NoGlueLimitCountingScanner: {
+		Pire::NoGlueLimitCountingScanner sc;
+		d.imageSize = static_cast<const char*>(sc.Mmap(fmap.Begin(), fmap.Size())) - fmap.Begin();
+		d.type = "NoGlueLimitCountingScanner";
+		InspectBasic(sc, sc.LettersCount(), d, opts);
+		break;
+	}
+	default:
+		throw std::runtime_error("unknown scanner type " + Pire::ToString(hdr.Type));
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try {
+		Main(argc, argv);
+		return 0;
+	}
+	catch (std::exception& e) {
+		std::cout << "pire_stat: " << e.what() << std::endl;
+		return 1;
+	}
+}